@@ -48,6 +48,10 @@ int main()
 	return 1;
     }
 
+    helper.setResizeCallback([&](int width, int height) -> void {
+	gfx.resize(width, height);
+    });
+
     KujoGFXPassAction pass_action(KujoGFXColor(0.0, 0.0, 1.0, 1.0));
 
     helper.run([&]() -> void {
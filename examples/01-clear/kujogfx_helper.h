@@ -75,6 +75,15 @@ class KujoGFXHelper
 	    #endif
 	}
 
+	// Called with the new size of the window in pixels,
+	// which has to be passed on to KujoGFX::resize()
+	void setResizeCallback(function<void(int, int)> func)
+	{
+	    resize_func = func;
+	}
+
+	function<void(int, int)> resize_func;
+
 	#if defined(KUJOGFX_PLATFORM_EMSCRIPTEN)
 	static constexpr bool use_emscripten = true;
 
@@ -191,6 +200,14 @@ class KujoGFXHelper
 		    switch (event.type)
 		    {
 			case SDL_EVENT_QUIT: quit = true; break;
+			case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+			{
+			    if (resize_func)
+			    {
+				resize_func(event.window.data1, event.window.data2);
+			    }
+			}
+			break;
 		    }
 		}
 
@@ -50,6 +50,10 @@ int main()
 	return 1;
     }
 
+    helper.setResizeCallback([&](int width, int height) -> void {
+	gfx.resize(width, height);
+    });
+
     const float vertices[] =
     {
 	// positions
@@ -58,13 +62,16 @@ int main()
 	-0.5f, -0.5f, 0.5f
     };
 
-    KujoGFXBuffer buffer;
-    buffer.setData(vertices);
+    KujoGFXBuffer buffer_desc;
+    buffer_desc.setData(vertices);
+    KujoGFXBufferHandle buffer = gfx.makeBuffer(buffer_desc);
+
+    KujoGFXShaderHandle shader = gfx.makeShader(KujoGFXShader(example_02_vertex, example_02_fragment, example_02_locations));
+    KujoGFXPipeline pipeline_desc;
+    pipeline_desc.shader = shader;
+    pipeline_desc.layout.attribs[0].format = VertexFormatFloat3;
 
-    KujoGFXShader shader(example_02_vertex, example_02_fragment, example_02_locations);
-    KujoGFXPipeline pipeline;
-    pipeline.shader = shader;
-    pipeline.layout.attribs[0].format = VertexFormatFloat3;
+    KujoGFXPipelineHandle pipeline = gfx.makePipeline(pipeline_desc);
 
     KujoGFXBindings bindings;
     bindings.vertex_buffers[0] = buffer;
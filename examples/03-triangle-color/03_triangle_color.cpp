@@ -50,6 +50,10 @@ int main()
 	return 1;
     }
 
+    helper.setResizeCallback([&](int width, int height) -> void {
+	gfx.resize(width, height);
+    });
+
     const float vertices[] =
     {
 	// Positions		// Colors
@@ -58,14 +62,17 @@ int main()
 	-0.5f, -0.5f, 0.5f,	0.0f, 0.0f, 1.0f, 1.0f
     };
 
-    KujoGFXBuffer buffer;
-    buffer.setData(vertices);
+    KujoGFXBuffer buffer_desc;
+    buffer_desc.setData(vertices);
+    KujoGFXBufferHandle buffer = gfx.makeBuffer(buffer_desc);
+
+    KujoGFXShaderHandle shader = gfx.makeShader(KujoGFXShader(example_03_vertex, example_03_fragment, example_03_locations));
+    KujoGFXPipeline pipeline_desc;
+    pipeline_desc.shader = shader;
+    pipeline_desc.layout.attribs[0].format = VertexFormatFloat3;
+    pipeline_desc.layout.attribs[1].format = VertexFormatFloat4;
 
-    KujoGFXShader shader(example_03_vertex, example_03_fragment, example_03_locations);
-    KujoGFXPipeline pipeline;
-    pipeline.shader = shader;
-    pipeline.layout.attribs[0].format = VertexFormatFloat3;
-    pipeline.layout.attribs[1].format = VertexFormatFloat4;
+    KujoGFXPipelineHandle pipeline = gfx.makePipeline(pipeline_desc);
 
     KujoGFXBindings bindings;
     bindings.vertex_buffers[0] = buffer;
@@ -50,6 +50,10 @@ int main()
 	return 1;
     }
 
+    helper.setResizeCallback([&](int width, int height) -> void {
+	gfx.resize(width, height);
+    });
+
     const float vertices[] =
     {
 	// Positions		// Colors
@@ -67,21 +71,25 @@ int main()
 	0, 2, 3
     };
 
-    KujoGFXBuffer vert_buffer;
-    vert_buffer.setData(vertices);
-
-    KujoGFXBuffer index_buffer;
-    index_buffer.setIndexBuffer();
-    index_buffer.setData(indices);
-
-    KujoGFXShader shader(example_04_vertex, example_04_fragment, example_04_locations);
-    KujoGFXPipeline pipeline;
-    pipeline.shader = shader;
-    pipeline.index_type = IndexTypeUint16;
-    pipeline.layout.attribs[0].offset = 0;
-    pipeline.layout.attribs[0].format = VertexFormatFloat3;
-    pipeline.layout.attribs[1].offset = 12;
-    pipeline.layout.attribs[1].format = VertexFormatFloat4;
+    KujoGFXBuffer vert_buffer_desc;
+    vert_buffer_desc.setData(vertices);
+    KujoGFXBufferHandle vert_buffer = gfx.makeBuffer(vert_buffer_desc);
+
+    KujoGFXBuffer index_buffer_desc;
+    index_buffer_desc.setIndexBuffer();
+    index_buffer_desc.setData(indices);
+    KujoGFXBufferHandle index_buffer = gfx.makeBuffer(index_buffer_desc);
+
+    KujoGFXShaderHandle shader = gfx.makeShader(KujoGFXShader(example_04_vertex, example_04_fragment, example_04_locations));
+    KujoGFXPipeline pipeline_desc;
+    pipeline_desc.shader = shader;
+    pipeline_desc.index_type = IndexTypeUint16;
+    pipeline_desc.layout.attribs[0].offset = 0;
+    pipeline_desc.layout.attribs[0].format = VertexFormatFloat3;
+    pipeline_desc.layout.attribs[1].offset = 12;
+    pipeline_desc.layout.attribs[1].format = VertexFormatFloat4;
+
+    KujoGFXPipelineHandle pipeline = gfx.makePipeline(pipeline_desc);
 
     KujoGFXBindings bindings;
     bindings.vertex_buffers[0] = vert_buffer;
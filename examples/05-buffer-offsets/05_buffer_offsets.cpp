@@ -59,6 +59,10 @@ int main()
 	return 1;
     }
 
+    helper.setResizeCallback([&](int width, int height) -> void {
+	gfx.resize(width, height);
+    });
+
     const Vertex vertices[] =
     {
 	// Positions       // Colors
@@ -84,19 +88,23 @@ int main()
 	0, 2, 3
     };
 
-    KujoGFXBuffer vert_buffer;
-    vert_buffer.setData(vertices);
+    KujoGFXBuffer vert_buffer_desc;
+    vert_buffer_desc.setData(vertices);
+    KujoGFXBufferHandle vert_buffer = gfx.makeBuffer(vert_buffer_desc);
+
+    KujoGFXBuffer index_buffer_desc;
+    index_buffer_desc.setIndexBuffer();
+    index_buffer_desc.setData(indices);
+    KujoGFXBufferHandle index_buffer = gfx.makeBuffer(index_buffer_desc);
 
-    KujoGFXBuffer index_buffer;
-    index_buffer.setIndexBuffer();
-    index_buffer.setData(indices);
+    KujoGFXShaderHandle shader = gfx.makeShader(KujoGFXShader(example_05_vertex, example_05_fragment, example_05_locations));
+    KujoGFXPipeline pipeline_desc;
+    pipeline_desc.shader = shader;
+    pipeline_desc.index_type = IndexTypeUint16;
+    pipeline_desc.layout.attribs[0].format = VertexFormatFloat2;
+    pipeline_desc.layout.attribs[1].format = VertexFormatFloat3;
 
-    KujoGFXShader shader(example_05_vertex, example_05_fragment, example_05_locations);
-    KujoGFXPipeline pipeline;
-    pipeline.shader = shader;
-    pipeline.index_type = IndexTypeUint16;
-    pipeline.layout.attribs[0].format = VertexFormatFloat2;
-    pipeline.layout.attribs[1].format = VertexFormatFloat3;
+    KujoGFXPipelineHandle pipeline = gfx.makePipeline(pipeline_desc);
 
     KujoGFXPassAction pass_action(KujoGFXColor(0.0, 0.0, 0.0, 1.0));
 
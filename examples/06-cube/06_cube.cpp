@@ -72,6 +72,10 @@ int main()
 	return 1;
     }
 
+    helper.setResizeCallback([&](int width, int height) -> void {
+	gfx.resize(width, height);
+    });
+
     const float vertices[] = 
     {
 	-1.0, -1.0, -1.0,     1.0, 0.0, 0.0, 1.0,
@@ -115,24 +119,28 @@ int main()
 	22, 21, 20, 23, 22, 20
     };
 
-    KujoGFXBuffer vert_buffer;
-    vert_buffer.setData(vertices);
+    KujoGFXBuffer vert_buffer_desc;
+    vert_buffer_desc.setData(vertices);
+    KujoGFXBufferHandle vert_buffer = gfx.makeBuffer(vert_buffer_desc);
+
+    KujoGFXBuffer index_buffer_desc;
+    index_buffer_desc.setIndexBuffer();
+    index_buffer_desc.setData(indices);
+    KujoGFXBufferHandle index_buffer = gfx.makeBuffer(index_buffer_desc);
 
-    KujoGFXBuffer index_buffer;
-    index_buffer.setIndexBuffer();
-    index_buffer.setData(indices);
+    KujoGFXShaderHandle shader = gfx.makeShader(KujoGFXShader(example_06_vertex, example_06_fragment, example_06_locations, example_06_uniforms));
 
-    KujoGFXShader shader(example_06_vertex, example_06_fragment, example_06_locations, example_06_uniforms);
+    KujoGFXPipeline pipeline_desc;
+    pipeline_desc.shader = shader;
+    pipeline_desc.index_type = IndexTypeUint16;
+    pipeline_desc.layout.buffers[0].stride = 28;
+    pipeline_desc.layout.attribs[0].format = VertexFormatFloat3;
+    pipeline_desc.layout.attribs[1].format = VertexFormatFloat4;
+    pipeline_desc.cull_mode = CullModeBack;
+    pipeline_desc.depth_state.is_write_enabled = true;
+    pipeline_desc.depth_state.compare_func = CompareFuncLessEqual;
 
-    KujoGFXPipeline pipeline;
-    pipeline.shader = shader;
-    pipeline.index_type = IndexTypeUint16;
-    pipeline.layout.buffers[0].stride = 28;
-    pipeline.layout.attribs[0].format = VertexFormatFloat3;
-    pipeline.layout.attribs[1].format = VertexFormatFloat4;
-    pipeline.cull_mode = CullModeBack;
-    pipeline.depth_state.is_write_enabled = true;
-    pipeline.depth_state.compare_func = CompareFuncLessEqual;
+    KujoGFXPipelineHandle pipeline = gfx.makePipeline(pipeline_desc);
 
     KujoGFXBindings bindings;
     bindings.vertex_buffers[0] = vert_buffer;
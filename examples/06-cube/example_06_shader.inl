@@ -3,65 +3,70 @@ KujoGFXShaderCodeDesc example_06_vertex = {
 /*
 #version 330
 
-uniform vec4 vs_params[4];
+layout(std140) uniform vs_params
+{
+    mat4 mvp;
+} _19;
+
 layout(location = 0) in vec4 position;
 out vec4 color;
 layout(location = 1) in vec4 in_color;
 
 void main()
 {
-    gl_Position = mat4(vs_params[0], vs_params[1], vs_params[2], vs_params[3]) * position;
+    gl_Position = _19.mvp * position;
     color = in_color;
 }
 
 */
 {
     0x23, 0x76, 0x65, 0x72, 0x73, 0x69, 0x6f, 0x6e, 
-    0x20, 0x33, 0x33, 0x30, 0x0a, 0x0a, 0x75, 0x6e, 
-    0x69, 0x66, 0x6f, 0x72, 0x6d, 0x20, 0x76, 0x65, 
-    0x63, 0x34, 0x20, 0x76, 0x73, 0x5f, 0x70, 0x61, 
-    0x72, 0x61, 0x6d, 0x73, 0x5b, 0x34, 0x5d, 0x3b, 
-    0x0a, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x28, 
-    0x6c, 0x6f, 0x63, 0x61, 0x74, 0x69, 0x6f, 0x6e, 
-    0x20, 0x3d, 0x20, 0x30, 0x29, 0x20, 0x69, 0x6e, 
-    0x20, 0x76, 0x65, 0x63, 0x34, 0x20, 0x70, 0x6f, 
-    0x73, 0x69, 0x74, 0x69, 0x6f, 0x6e, 0x3b, 0x0a, 
-    0x6f, 0x75, 0x74, 0x20, 0x76, 0x65, 0x63, 0x34, 
-    0x20, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3b, 0x0a, 
-    0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x28, 0x6c, 
-    0x6f, 0x63, 0x61, 0x74, 0x69, 0x6f, 0x6e, 0x20, 
-    0x3d, 0x20, 0x31, 0x29, 0x20, 0x69, 0x6e, 0x20, 
-    0x76, 0x65, 0x63, 0x34, 0x20, 0x69, 0x6e, 0x5f, 
-    0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3b, 0x0a, 0x0a, 
-    0x76, 0x6f, 0x69, 0x64, 0x20, 0x6d, 0x61, 0x69, 
-    0x6e, 0x28, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 
-    0x20, 0x20, 0x67, 0x6c, 0x5f, 0x50, 0x6f, 0x73, 
-    0x69, 0x74, 0x69, 0x6f, 0x6e, 0x20, 0x3d, 0x20, 
-    0x6d, 0x61, 0x74, 0x34, 0x28, 0x76, 0x73, 0x5f, 
-    0x70, 0x61, 0x72, 0x61, 0x6d, 0x73, 0x5b, 0x30, 
-    0x5d, 0x2c, 0x20, 0x76, 0x73, 0x5f, 0x70, 0x61, 
-    0x72, 0x61, 0x6d, 0x73, 0x5b, 0x31, 0x5d, 0x2c, 
-    0x20, 0x76, 0x73, 0x5f, 0x70, 0x61, 0x72, 0x61, 
-    0x6d, 0x73, 0x5b, 0x32, 0x5d, 0x2c, 0x20, 0x76, 
-    0x73, 0x5f, 0x70, 0x61, 0x72, 0x61, 0x6d, 0x73, 
-    0x5b, 0x33, 0x5d, 0x29, 0x20, 0x2a, 0x20, 0x70, 
-    0x6f, 0x73, 0x69, 0x74, 0x69, 0x6f, 0x6e, 0x3b, 
-    0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6c, 
-    0x6f, 0x72, 0x20, 0x3d, 0x20, 0x69, 0x6e, 0x5f, 
-    0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3b, 0x0a, 0x7d, 
-    0x0a, 0x0a
+    0x20, 0x33, 0x33, 0x30, 0x0a, 0x0a, 0x6c, 0x61, 
+    0x79, 0x6f, 0x75, 0x74, 0x28, 0x73, 0x74, 0x64, 
+    0x31, 0x34, 0x30, 0x29, 0x20, 0x75, 0x6e, 0x69, 
+    0x66, 0x6f, 0x72, 0x6d, 0x20, 0x76, 0x73, 0x5f, 
+    0x70, 0x61, 0x72, 0x61, 0x6d, 0x73, 0x0a, 0x7b, 
+    0x0a, 0x20, 0x20, 0x20, 0x20, 0x6d, 0x61, 0x74, 
+    0x34, 0x20, 0x6d, 0x76, 0x70, 0x3b, 0x0a, 0x7d, 
+    0x20, 0x5f, 0x31, 0x39, 0x3b, 0x0a, 0x0a, 0x6c, 
+    0x61, 0x79, 0x6f, 0x75, 0x74, 0x28, 0x6c, 0x6f, 
+    0x63, 0x61, 0x74, 0x69, 0x6f, 0x6e, 0x20, 0x3d, 
+    0x20, 0x30, 0x29, 0x20, 0x69, 0x6e, 0x20, 0x76, 
+    0x65, 0x63, 0x34, 0x20, 0x70, 0x6f, 0x73, 0x69, 
+    0x74, 0x69, 0x6f, 0x6e, 0x3b, 0x0a, 0x6f, 0x75, 
+    0x74, 0x20, 0x76, 0x65, 0x63, 0x34, 0x20, 0x63, 
+    0x6f, 0x6c, 0x6f, 0x72, 0x3b, 0x0a, 0x6c, 0x61, 
+    0x79, 0x6f, 0x75, 0x74, 0x28, 0x6c, 0x6f, 0x63, 
+    0x61, 0x74, 0x69, 0x6f, 0x6e, 0x20, 0x3d, 0x20, 
+    0x31, 0x29, 0x20, 0x69, 0x6e, 0x20, 0x76, 0x65, 
+    0x63, 0x34, 0x20, 0x69, 0x6e, 0x5f, 0x63, 0x6f, 
+    0x6c, 0x6f, 0x72, 0x3b, 0x0a, 0x0a, 0x76, 0x6f, 
+    0x69, 0x64, 0x20, 0x6d, 0x61, 0x69, 0x6e, 0x28, 
+    0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 
+    0x67, 0x6c, 0x5f, 0x50, 0x6f, 0x73, 0x69, 0x74, 
+    0x69, 0x6f, 0x6e, 0x20, 0x3d, 0x20, 0x5f, 0x31, 
+    0x39, 0x2e, 0x6d, 0x76, 0x70, 0x20, 0x2a, 0x20, 
+    0x70, 0x6f, 0x73, 0x69, 0x74, 0x69, 0x6f, 0x6e, 
+    0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 
+    0x6c, 0x6f, 0x72, 0x20, 0x3d, 0x20, 0x69, 0x6e, 
+    0x5f, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3b, 0x0a, 
+    0x7d, 0x0a, 0x0a
 },
 /*
 #version 300 es
 
-uniform vec4 vs_params[4];
+layout(std140) uniform vs_params
+{
+    mat4 mvp;
+} _19;
+
 layout(location = 0) in vec4 position;
 out vec4 color;
 layout(location = 1) in vec4 in_color;
 
 void main()
 {
-    gl_Position = mat4(vs_params[0], vs_params[1], vs_params[2], vs_params[3]) * position;
+    gl_Position = _19.mvp * position;
     color = in_color;
 }
 
@@ -69,38 +74,35 @@ void main()
 {
     0x23, 0x76, 0x65, 0x72, 0x73, 0x69, 0x6f, 0x6e, 
     0x20, 0x33, 0x30, 0x30, 0x20, 0x65, 0x73, 0x0a, 
-    0x0a, 0x75, 0x6e, 0x69, 0x66, 0x6f, 0x72, 0x6d, 
-    0x20, 0x76, 0x65, 0x63, 0x34, 0x20, 0x76, 0x73, 
-    0x5f, 0x70, 0x61, 0x72, 0x61, 0x6d, 0x73, 0x5b, 
-    0x34, 0x5d, 0x3b, 0x0a, 0x6c, 0x61, 0x79, 0x6f, 
-    0x75, 0x74, 0x28, 0x6c, 0x6f, 0x63, 0x61, 0x74, 
-    0x69, 0x6f, 0x6e, 0x20, 0x3d, 0x20, 0x30, 0x29, 
-    0x20, 0x69, 0x6e, 0x20, 0x76, 0x65, 0x63, 0x34, 
-    0x20, 0x70, 0x6f, 0x73, 0x69, 0x74, 0x69, 0x6f, 
-    0x6e, 0x3b, 0x0a, 0x6f, 0x75, 0x74, 0x20, 0x76, 
-    0x65, 0x63, 0x34, 0x20, 0x63, 0x6f, 0x6c, 0x6f, 
-    0x72, 0x3b, 0x0a, 0x6c, 0x61, 0x79, 0x6f, 0x75, 
-    0x74, 0x28, 0x6c, 0x6f, 0x63, 0x61, 0x74, 0x69, 
-    0x6f, 0x6e, 0x20, 0x3d, 0x20, 0x31, 0x29, 0x20, 
-    0x69, 0x6e, 0x20, 0x76, 0x65, 0x63, 0x34, 0x20, 
-    0x69, 0x6e, 0x5f, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 
-    0x3b, 0x0a, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 
-    0x6d, 0x61, 0x69, 0x6e, 0x28, 0x29, 0x0a, 0x7b, 
-    0x0a, 0x20, 0x20, 0x20, 0x20, 0x67, 0x6c, 0x5f, 
-    0x50, 0x6f, 0x73, 0x69, 0x74, 0x69, 0x6f, 0x6e, 
-    0x20, 0x3d, 0x20, 0x6d, 0x61, 0x74, 0x34, 0x28, 
+    0x0a, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x28, 
+    0x73, 0x74, 0x64, 0x31, 0x34, 0x30, 0x29, 0x20, 
+    0x75, 0x6e, 0x69, 0x66, 0x6f, 0x72, 0x6d, 0x20, 
     0x76, 0x73, 0x5f, 0x70, 0x61, 0x72, 0x61, 0x6d, 
-    0x73, 0x5b, 0x30, 0x5d, 0x2c, 0x20, 0x76, 0x73, 
-    0x5f, 0x70, 0x61, 0x72, 0x61, 0x6d, 0x73, 0x5b, 
-    0x31, 0x5d, 0x2c, 0x20, 0x76, 0x73, 0x5f, 0x70, 
-    0x61, 0x72, 0x61, 0x6d, 0x73, 0x5b, 0x32, 0x5d, 
-    0x2c, 0x20, 0x76, 0x73, 0x5f, 0x70, 0x61, 0x72, 
-    0x61, 0x6d, 0x73, 0x5b, 0x33, 0x5d, 0x29, 0x20, 
-    0x2a, 0x20, 0x70, 0x6f, 0x73, 0x69, 0x74, 0x69, 
-    0x6f, 0x6e, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 
-    0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x20, 0x3d, 0x20, 
-    0x69, 0x6e, 0x5f, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 
-    0x3b, 0x0a, 0x7d, 0x0a, 0x0a
+    0x73, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 
+    0x6d, 0x61, 0x74, 0x34, 0x20, 0x6d, 0x76, 0x70, 
+    0x3b, 0x0a, 0x7d, 0x20, 0x5f, 0x31, 0x39, 0x3b, 
+    0x0a, 0x0a, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 
+    0x28, 0x6c, 0x6f, 0x63, 0x61, 0x74, 0x69, 0x6f, 
+    0x6e, 0x20, 0x3d, 0x20, 0x30, 0x29, 0x20, 0x69, 
+    0x6e, 0x20, 0x76, 0x65, 0x63, 0x34, 0x20, 0x70, 
+    0x6f, 0x73, 0x69, 0x74, 0x69, 0x6f, 0x6e, 0x3b, 
+    0x0a, 0x6f, 0x75, 0x74, 0x20, 0x76, 0x65, 0x63, 
+    0x34, 0x20, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3b, 
+    0x0a, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x28, 
+    0x6c, 0x6f, 0x63, 0x61, 0x74, 0x69, 0x6f, 0x6e, 
+    0x20, 0x3d, 0x20, 0x31, 0x29, 0x20, 0x69, 0x6e, 
+    0x20, 0x76, 0x65, 0x63, 0x34, 0x20, 0x69, 0x6e, 
+    0x5f, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x3b, 0x0a, 
+    0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x6d, 0x61, 
+    0x69, 0x6e, 0x28, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 
+    0x20, 0x20, 0x20, 0x67, 0x6c, 0x5f, 0x50, 0x6f, 
+    0x73, 0x69, 0x74, 0x69, 0x6f, 0x6e, 0x20, 0x3d, 
+    0x20, 0x5f, 0x31, 0x39, 0x2e, 0x6d, 0x76, 0x70, 
+    0x20, 0x2a, 0x20, 0x70, 0x6f, 0x73, 0x69, 0x74, 
+    0x69, 0x6f, 0x6e, 0x3b, 0x0a, 0x20, 0x20, 0x20, 
+    0x20, 0x63, 0x6f, 0x6c, 0x6f, 0x72, 0x20, 0x3d, 
+    0x20, 0x69, 0x6e, 0x5f, 0x63, 0x6f, 0x6c, 0x6f, 
+    0x72, 0x3b, 0x0a, 0x7d, 0x0a, 0x0a
 },
 /*
 cbuffer vs_params : register(b0)
@@ -685,6 +687,6 @@ struct vs_params_t
 };
 
 vector<KujoGFXUniformDesc> example_06_uniforms = {
-    {UniformStageVertex, UniformLayoutStd140, 64, 0, {{UniformTypeFloat4, 4, "vs_params"}}}
+    {UniformStageVertex, UniformLayoutStd140, 64, 0, {{UniformTypeFloat4, 4, "vs_params"}}, "vs_params"}
 };
 
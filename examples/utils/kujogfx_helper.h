@@ -92,6 +92,13 @@ class KujoGFXHelper
 	    #endif
 	}
 
+	// Called with the new size of the window in pixels,
+	// which has to be passed on to KujoGFX::resize()
+	void setResizeCallback(function<void(int, int)> func)
+	{
+	    resize_func = func;
+	}
+
 	size_t getWidth()
 	{
 	    return m_width;
@@ -115,6 +122,7 @@ class KujoGFXHelper
     private:
 	size_t m_width = 0;
 	size_t m_height = 0;
+	function<void(int, int)> resize_func;
 
 	void updateSize(size_t w, size_t h)
 	{
@@ -247,6 +255,16 @@ class KujoGFXHelper
 		    switch (event.type)
 		    {
 			case SDL_EVENT_QUIT: quit = true; break;
+			case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+			{
+			    updateSize(event.window.data1, event.window.data2);
+
+			    if (resize_func)
+			    {
+				resize_func(event.window.data1, event.window.data2);
+			    }
+			}
+			break;
 		    }
 		}
 
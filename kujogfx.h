@@ -22,14 +22,24 @@
 #include <cstdint>
 #include <cassert>
 #include <vector>
-#include <deque>
+#include <array>
+#include <cstring>
+#include <type_traits>
 #include <set>
 #include <map>
 #include <memory>
 #include <atomic>
 #include <algorithm>
 #include <unordered_map>
+#include <list>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
 #include <optional>
+#include <chrono>
+#include <functional>
 #if !defined(KUJOGFX_PLATFORM_EMSCRIPTEN)
 #include <vulkan/vulkan.h>
 #endif
@@ -191,11 +201,19 @@ namespace kujogfx
 	void *window_handle = NULL;
 	void *display_handle = NULL;
 	void *context_handle = NULL;
+	// Renders into an offscreen framebuffer of width x height instead of a window,
+	// in which case the window and display handles are ignored.
+	// Only backends that support it are considered
+	bool is_headless = false;
+	int width = 0;
+	int height = 0;
     };
 
     static constexpr uint32_t max_vertex_attribs = 16;
     static constexpr uint32_t max_vertex_buffer_bind_slots = 8;
     static constexpr uint32_t max_uniform_block_bind_slots = 8;
+    // Returned by KujoGFX::appendBuffer() when nothing was appended
+    static constexpr uint32_t invalid_append_offset = UINT32_MAX;
 
     struct KujoGFXColor
     {
@@ -247,6 +265,16 @@ namespace kujogfx
 	IndexTypeUint32
     };
 
+    // Immutable buffers are initialized once at creation.
+    // Dynamic buffers can be overwritten with updateBuffer() at most once per frame,
+    // while stream buffers are refilled each frame with one or more appendBuffer() calls
+    enum KujoGFXBufferUsage : int
+    {
+	BufferUsageImmutable = 0,
+	BufferUsageDynamic,
+	BufferUsageStream
+    };
+
     enum KujoGFXPrimitiveType : int
     {
 	PrimitiveTriangles = 0,
@@ -324,6 +352,175 @@ namespace kujogfx
 	}
     };
 
+    // Resource handles pack the index of a pool slot into the lower bits
+    // and the generation of that slot into the upper bits,
+    // so that handles of destroyed resources can be detected as stale.
+    // An ID of 0 is never handed out and marks an invalid handle
+    static constexpr uint32_t handle_index_bits = 20;
+    static constexpr uint32_t handle_index_mask = ((1u << handle_index_bits) - 1);
+    static constexpr uint32_t handle_generation_mask = ((1u << (32 - handle_index_bits)) - 1);
+
+    template<typename T>
+    struct KujoGFXHandle
+    {
+	uint32_t id = 0;
+
+	bool isValid() const
+	{
+	    return (id != 0);
+	}
+
+	uint32_t getIndex() const
+	{
+	    return (id & handle_index_mask);
+	}
+
+	uint32_t getGeneration() const
+	{
+	    return (id >> handle_index_bits);
+	}
+
+	bool operator==(const KujoGFXHandle &handle) const
+	{
+	    return (id == handle.id);
+	}
+
+	bool operator!=(const KujoGFXHandle &handle) const
+	{
+	    return (id != handle.id);
+	}
+    };
+
+    class KujoGFXShader;
+    class KujoGFXBuffer;
+    class KujoGFXPipeline;
+
+    using KujoGFXShaderHandle = KujoGFXHandle<KujoGFXShader>;
+    using KujoGFXBufferHandle = KujoGFXHandle<KujoGFXBuffer>;
+    using KujoGFXPipelineHandle = KujoGFXHandle<KujoGFXPipeline>;
+
+    // Dense slot array with a free list, indexed by resource handles
+    template<typename T, typename Handle>
+    class KujoGFXPool
+    {
+	struct PoolSlot
+	{
+	    T item;
+	    uint32_t generation = 0;
+	    bool is_active = false;
+	};
+
+	public:
+	    KujoGFXPool()
+	    {
+
+	    }
+
+	    Handle alloc(const T &item)
+	    {
+		uint32_t index = 0;
+
+		if (!free_slots.empty())
+		{
+		    index = free_slots.back();
+		    free_slots.pop_back();
+		}
+		else
+		{
+		    // Any further index would spill into the generation bits
+		    if (slots.size() > handle_index_mask)
+		    {
+			kujogfxlog::error() << "Resource pool is full!";
+			return Handle();
+		    }
+
+		    index = uint32_t(slots.size());
+		    slots.emplace_back();
+		}
+
+		auto &slot = slots.at(index);
+		// Generation 0 is skipped, so that no valid handle has an ID of 0
+		slot.generation = ((slot.generation + 1) & handle_generation_mask);
+
+		if (slot.generation == 0)
+		{
+		    slot.generation = 1;
+		}
+
+		slot.item = item;
+		slot.is_active = true;
+		num_active += 1;
+
+		Handle handle;
+		handle.id = ((slot.generation << handle_index_bits) | index);
+		return handle;
+	    }
+
+	    void free(Handle handle)
+	    {
+		if (!isValid(handle))
+		{
+		    return;
+		}
+
+		auto &slot = slots.at(handle.getIndex());
+		slot.item = T();
+		slot.is_active = false;
+		free_slots.push_back(handle.getIndex());
+		num_active -= 1;
+	    }
+
+	    bool isValid(Handle handle) const
+	    {
+		if (!handle.isValid() || (handle.getIndex() >= slots.size()))
+		{
+		    return false;
+		}
+
+		auto &slot = slots[handle.getIndex()];
+		return (slot.is_active && (slot.generation == handle.getGeneration()));
+	    }
+
+	    // Returns NULL for invalid or stale handles
+	    T *lookup(Handle handle)
+	    {
+		if (!isValid(handle))
+		{
+		    return NULL;
+		}
+
+		return &slots[handle.getIndex()].item;
+	    }
+
+	    size_t size() const
+	    {
+		return num_active;
+	    }
+
+	    template<typename Func>
+	    void forEach(Func func)
+	    {
+		for (size_t index = 0; index < slots.size(); index++)
+		{
+		    auto &slot = slots[index];
+
+		    if (slot.is_active)
+		    {
+			Handle handle;
+			handle.id = ((slot.generation << handle_index_bits) | uint32_t(index));
+			func(handle, slot.item);
+		    }
+		}
+	    }
+
+	private:
+	    // Slots never move as the pool grows, so that pointers returned by lookup()
+	    // stay valid while another thread allocates, as in render thread mode
+	    deque<PoolSlot> slots;
+	    vector<uint32_t> free_slots;
+	    size_t num_active = 0;
+    };
+
     struct KujoGFXSemantic
     {
 	string name = "";
@@ -391,16 +588,19 @@ namespace kujogfx
 	size_t desc_size = 0;
 	uint32_t desc_binding = 0;
 	vector<KujoGFXGLSLUniform> glsl_uniforms = {};
+	// Name of the GLSL uniform block of std140 layouts.
+	// Left empty for shaders that only declare the flattened uniforms
+	string block_name = "";
     };
 
     class KujoGFXShader
     {
 	public:
-	    KujoGFXShader() : id(generateID())
+	    KujoGFXShader()
 	    {
 	    }
 
-	    KujoGFXShader(KujoGFXShaderCodeDesc vert, KujoGFXShaderCodeDesc frag, KujoGFXShaderLocations loc, vector<KujoGFXUniformDesc> uniform = {}) : id(generateID())
+	    KujoGFXShader(KujoGFXShaderCodeDesc vert, KujoGFXShaderCodeDesc frag, KujoGFXShaderLocations loc, vector<KujoGFXUniformDesc> uniform = {})
 	    {
 		vert_code = convertCode(vert);
 		frag_code = convertCode(frag);
@@ -413,21 +613,7 @@ namespace kujogfx
  	    KujoGFXShaderLocations locations;
 	    vector<KujoGFXUniformDesc> uniforms;
 
-	    uint32_t getID() const
-	    {
-		return id;
-	    }
-
 	private:
-	    uint32_t id;
-
-	    static atomic<uint32_t> next_id;
-
-	    static uint32_t generateID()
-	    {
-		return next_id++;
-	    }
-
 	    KujoGFXShaderCode convertCode(KujoGFXShaderCodeDesc desc)
 	    {
 		KujoGFXShaderCode code;
@@ -459,11 +645,22 @@ namespace kujogfx
 		return data_ptr;
 	    }
 
-	    size_t getSize()
+	    const void* getData() const
+	    {
+		return data_ptr;
+	    }
+
+	    size_t getSize() const
 	    {
 		return data_size;
 	    }
 
+	    void setData(const void *data, size_t size)
+	    {
+		data_ptr = const_cast<void*>(data);
+		data_size = size;
+	    }
+
 	    template<typename T, size_t N>
 	    void setData(T (&arr)[N])
 	    {
@@ -528,49 +725,77 @@ namespace kujogfx
     class KujoGFXBuffer : public KujoGFXData
     {
 	public:
-	    KujoGFXBuffer() : id(generateID())
+	    KujoGFXBuffer()
 	    {
 		setVertexBuffer();
 	    }
 
-	    bool isVertexBuffer()
+	    bool isVertexBuffer() const
 	    {
 		return is_vertex_buffer;
 	    }
 
-	    bool isIndexBuffer()
+	    bool isIndexBuffer() const
 	    {
 		return is_index_buffer;
 	    }
 
+	    bool isIndirectBuffer() const
+	    {
+		return is_indirect_buffer;
+	    }
+
 	    void setVertexBuffer()
 	    {
 		is_vertex_buffer = true;
 		is_index_buffer = false;
+		is_indirect_buffer = false;
 	    }
 
 	    void setIndexBuffer()
 	    {
 		is_vertex_buffer = false;
 		is_index_buffer = true;
+		is_indirect_buffer = false;
 	    }
 
-	    uint32_t getID() const
+	    // Holds the arguments of drawIndirect(),
+	    // laid out as KujoGFXDrawIndirectArgs or KujoGFXDrawIndexedIndirectArgs
+	    void setIndirectBuffer()
 	    {
-		return id;
+		is_vertex_buffer = false;
+		is_index_buffer = false;
+		is_indirect_buffer = true;
 	    }
 
-	private:
-	    bool is_vertex_buffer = false;
-	    bool is_index_buffer = false;
+	    KujoGFXBufferUsage getUsage() const
+	    {
+		return buffer_usage;
+	    }
+
+	    void setUsage(KujoGFXBufferUsage usage)
+	    {
+		buffer_usage = usage;
+	    }
 
-	    uint32_t id;
-	    static atomic<uint32_t> next_id;
+	    // Defaults to the size of the initial data,
+	    // which dynamic and stream buffers can be created without
+	    size_t getBufferSize() const
+	    {
+		return (buffer_size != 0) ? buffer_size : getSize();
+	    }
 
-	    static uint32_t generateID()
+	    void setBufferSize(size_t size)
 	    {
-		return next_id++;
+		buffer_size = size;
 	    }
+
+	private:
+	    bool is_vertex_buffer = false;
+	    bool is_index_buffer = false;
+	    bool is_indirect_buffer = false;
+	    KujoGFXBufferUsage buffer_usage = BufferUsageImmutable;
+	    size_t buffer_size = 0;
     };
 
     class KujoGFXBindings
@@ -582,9 +807,9 @@ namespace kujogfx
 		index_buffer_offset = 0;
 	    }
 
-	    array<KujoGFXBuffer, max_vertex_buffer_bind_slots> vertex_buffers;
+	    array<KujoGFXBufferHandle, max_vertex_buffer_bind_slots> vertex_buffers;
 	    array<uint32_t, max_vertex_buffer_bind_slots> vertex_buffer_offsets;
-	    KujoGFXBuffer index_buffer;
+	    KujoGFXBufferHandle index_buffer;
 	    uint32_t index_buffer_offset;
     };
 
@@ -636,7 +861,7 @@ namespace kujogfx
     class KujoGFXPipeline
     {
 	public:
-	    KujoGFXPipeline() : id(generateID())
+	    KujoGFXPipeline()
 	    {
 		primitive_type = PrimitiveTriangles;
 		index_type = IndexTypeNone;
@@ -644,49 +869,53 @@ namespace kujogfx
 		depth_state.compare_func = CompareFuncAlways;
 	    }
 
-	    KujoGFXShader shader;
+	    KujoGFXShaderHandle shader;
 	    KujoGFXVertexLayout layout;
 	    KujoGFXPrimitiveType primitive_type;
 	    KujoGFXIndexType index_type;
 	    KujoGFXCullMode cull_mode;
 	    KujoGFXDepthState depth_state;
-
-	    uint32_t getID() const
-	    {
-		return id;
-	    }
-
-	private:
-	    uint32_t id;
-	    static atomic<uint32_t> next_id;
-
-	    static uint32_t generateID()
-	    {
-		return next_id++;
-	    }
     };
 
-    atomic<uint32_t> KujoGFXShader::next_id{1};
-    atomic<uint32_t> KujoGFXBuffer::next_id{1};
-    atomic<uint32_t> KujoGFXPipeline::next_id{1};
-
     struct KujoGFXDraw
     {
 	int base_element = 0;
 	int num_elements = 0;
 	int num_instances = 0;
+	// Added to each index, so only used by indexed draws
+	int base_vertex = 0;
+	int base_instance = 0;
 
-	KujoGFXDraw() : base_element(0), num_elements(0), num_instances(0)
+	KujoGFXDraw() : base_element(0), num_elements(0), num_instances(0), base_vertex(0), base_instance(0)
 	{
 
 	}
 
-	KujoGFXDraw(int base, int num_elem, int num_inst) : base_element(base), num_elements(num_elem), num_instances(num_inst)
+	KujoGFXDraw(int base, int num_elem, int num_inst, int base_vert = 0, int base_inst = 0) : base_element(base), num_elements(num_elem), num_instances(num_inst), base_vertex(base_vert), base_instance(base_inst)
 	{
 
 	}
     };
 
+    // Arguments of one indirect draw, laid out like those of the native APIs
+    struct KujoGFXDrawIndirectArgs
+    {
+	uint32_t num_elements = 0;
+	uint32_t num_instances = 0;
+	uint32_t base_element = 0;
+	uint32_t base_instance = 0;
+    };
+
+    // Used instead of the above for pipelines with indices
+    struct KujoGFXDrawIndexedIndirectArgs
+    {
+	uint32_t num_elements = 0;
+	uint32_t num_instances = 0;
+	uint32_t base_element = 0;
+	int32_t base_vertex = 0;
+	uint32_t base_instance = 0;
+    };
+
     enum KujoGFXCommandType : int
     {
 	CommandNop = 0,
@@ -696,147 +925,607 @@ namespace kujogfx
 	CommandApplyBindings,
 	CommandApplyUniforms,
 	CommandDraw,
-	CommandCommit
+	CommandCommit,
+	CommandDestroyShader,
+	CommandDestroyBuffer,
+	CommandDestroyPipeline,
+	CommandUpdateBuffer,
+	CommandAppendBuffer,
+	CommandResize,
+	CommandReadPixels,
+	CommandExecuteEncoder,
+	CommandCreateBuffer,
+	CommandCreatePipeline,
+	CommandSortBarrier,
+	CommandMultiDraw,
+	CommandDrawIndirect
     };
 
-    struct KujoGFXCommand
+    struct KujoGFXCommandHeader
     {
 	KujoGFXCommandType cmd_type = CommandNop;
-	KujoGFXPass current_pass;
-	KujoGFXPipeline current_pipeline;
-	KujoGFXDraw current_draw_call;
-	KujoGFXBindings current_bindings;
-	int current_uniform_slot;
-	KujoGFXData current_uniform_data;
-
-	KujoGFXCommand() : cmd_type(CommandNop)
-	{
+	uint32_t cmd_size = 0;
+    };
 
-	}
+    struct KujoGFXBeginPassCommand
+    {
+	KujoGFXPass pass;
+    };
 
-	KujoGFXCommand(KujoGFXCommandType cmd_type) : cmd_type(cmd_type)
-	{
+    struct KujoGFXApplyPipelineCommand
+    {
+	KujoGFXPipelineHandle pipeline;
+    };
 
-	}
+    struct KujoGFXApplyBindingsCommand
+    {
+	KujoGFXBindings bindings;
+    };
 
-	KujoGFXCommand(KujoGFXPass pass) : cmd_type(CommandBeginPass), current_pass(pass)
-	{
+    struct KujoGFXApplyUniformsCommand
+    {
+	int ub_slot = 0;
+	KujoGFXData data;
+    };
 
-	}
+    struct KujoGFXDrawCommand
+    {
+	KujoGFXDraw draw_call;
+    };
 
-	KujoGFXCommand(KujoGFXPipeline pipeline) : cmd_type(CommandApplyPipeline), current_pipeline(pipeline)
-	{
+    // Destruction is recorded like any other command, so that
+    // commands recorded earlier in the frame can still use the resource
+    struct KujoGFXDestroyShaderCommand
+    {
+	KujoGFXShaderHandle shader;
+    };
 
-	}
+    struct KujoGFXDestroyBufferCommand
+    {
+	KujoGFXBufferHandle buffer;
+    };
 
-	KujoGFXCommand(KujoGFXDraw draw_call) : cmd_type(CommandDraw), current_draw_call(draw_call)
-	{
+    struct KujoGFXDestroyPipelineCommand
+    {
+	KujoGFXPipelineHandle pipeline;
+    };
 
-	}
+    struct KujoGFXUpdateBufferCommand
+    {
+	KujoGFXBufferHandle buffer;
+	KujoGFXData data;
+    };
 
-	KujoGFXCommand(KujoGFXBindings bindings) : cmd_type(CommandApplyBindings), current_bindings(bindings)
-	{
+    struct KujoGFXAppendBufferCommand
+    {
+	KujoGFXBufferHandle buffer;
+	uint32_t offset = 0;
+	KujoGFXData data;
+    };
 
-	}
+    struct KujoGFXResizeCommand
+    {
+	int width = 0;
+	int height = 0;
+    };
 
-	KujoGFXCommand(int ub_slot, KujoGFXData data) : cmd_type(CommandApplyUniforms), current_uniform_slot(ub_slot), current_uniform_data(data)
-	{
+    // Callbacks aren't trivially copyable, so they are kept
+    // by the frontend until the frame is replayed
+    struct KujoGFXReadPixelsCommand
+    {
+	uint32_t callback_index = 0;
+    };
 
-	}
+    // The draws are copied into the frame's data arena
+    struct KujoGFXMultiDrawCommand
+    {
+	KujoGFXData draws;
     };
 
-    class KujoGFXBackend
+    struct KujoGFXDrawIndirectCommand
     {
-	public:
-	    KujoGFXBackend()
-	    {
+	KujoGFXBufferHandle buffer;
+	uint32_t offset = 0;
+	uint32_t num_draws = 0;
+	uint32_t stride = 0;
+    };
 
-	    }
+    struct KujoGFXExecuteEncoderCommand
+    {
+	uint32_t encoder_index = 0;
+    };
+
+    // Only recorded in render thread mode, where the backend
+    // can't be called from the thread that makes the resource
+    struct KujoGFXCreateBufferCommand
+    {
+	KujoGFXBufferHandle buffer;
+	KujoGFXBuffer desc;
+    };
+
+    struct KujoGFXCreatePipelineCommand
+    {
+	KujoGFXPipelineHandle pipeline;
+    };
 
-	    ~KujoGFXBackend()
+    // Linear, variable-length command storage
+    // Every command is a header followed by a trivially-copyable payload,
+    // padded so that the next header stays 8-byte aligned.
+    // The underlying storage is only cleared at the end of a frame,
+    // so its capacity is reused by all following frames
+    class KujoGFXCommandStream
+    {
+	public:
+	    static constexpr size_t cmd_alignment = 8;
+
+	    KujoGFXCommandStream()
 	    {
 
 	    }
 
-	    virtual bool initBackend(void*, void*)
+	    void push(KujoGFXCommandType cmd_type)
 	    {
-		return true;
+		KujoGFXCommandHeader header;
+		header.cmd_type = cmd_type;
+		header.cmd_size = sizeof(KujoGFXCommandHeader);
+		write(&header, sizeof(header), header.cmd_size);
 	    }
 
-	    virtual void shutdownBackend()
+	    template<typename T>
+	    void push(KujoGFXCommandType cmd_type, const T &payload)
 	    {
-		return;
+		static_assert(is_trivially_copyable<T>::value, "Command payloads must be trivially copyable");
+		static_assert(alignof(T) <= cmd_alignment, "Command payload alignment is too large");
+
+		KujoGFXCommandHeader header;
+		header.cmd_type = cmd_type;
+		header.cmd_size = uint32_t(sizeof(KujoGFXCommandHeader) + kujogfxutil::alignU32(sizeof(T), cmd_alignment));
+		size_t offset = write(&header, sizeof(header), header.cmd_size);
+		memcpy(&cmd_buffer[offset + sizeof(KujoGFXCommandHeader)], &payload, sizeof(T));
 	    }
 
-	    virtual void* getContextHandle()
+	    // Payloads are read in place, the stream must not be written to while replaying
+	    template<typename T>
+	    static const T &payload(const KujoGFXCommandHeader *header)
 	    {
-		return NULL;
+		assert(header->cmd_size >= (sizeof(KujoGFXCommandHeader) + sizeof(T)));
+		return *reinterpret_cast<const T*>(reinterpret_cast<const uint8_t*>(header) + sizeof(KujoGFXCommandHeader));
 	    }
 
-	    virtual void beginPass(KujoGFXPass)
+	    const KujoGFXCommandHeader *first() const
 	    {
-		return;
+		return at(0);
 	    }
 
-	    virtual void endPass()
+	    const KujoGFXCommandHeader *next(const KujoGFXCommandHeader *header) const
 	    {
-		return;
+		size_t offset = (reinterpret_cast<const uint8_t*>(header) - cmd_buffer.data());
+		return at(offset + header->cmd_size);
 	    }
 
-	    virtual void setPipeline(KujoGFXPipeline)
+	    size_t size() const
 	    {
-		return;
+		return cmd_buffer.size();
 	    }
 
-	    virtual void createPipeline(KujoGFXPipeline&)
+	    bool empty() const
 	    {
-		return;
+		return cmd_buffer.empty();
 	    }
 
-	    virtual void applyPipeline()
+	    void reset()
 	    {
-		return;
+		cmd_buffer.clear();
 	    }
 
-	    virtual void createBuffer(KujoGFXBuffer)
+	private:
+	    // Default operator new alignment keeps every payload suitably aligned
+	    vector<uint8_t> cmd_buffer;
+
+	    size_t write(const void *header, size_t header_size, size_t cmd_size)
 	    {
-		return;
+		size_t offset = cmd_buffer.size();
+		cmd_buffer.resize(offset + cmd_size);
+		memcpy(&cmd_buffer[offset], header, header_size);
+		return offset;
 	    }
 
-	    virtual void applyBindings(KujoGFXBindings)
+	    const KujoGFXCommandHeader *at(size_t offset) const
 	    {
-		return;
+		if (offset >= cmd_buffer.size())
+		{
+		    return NULL;
+		}
+
+		return reinterpret_cast<const KujoGFXCommandHeader*>(&cmd_buffer[offset]);
 	    }
+    };
 
-	    virtual void applyUniforms(int, KujoGFXData)
+    // Holds copies of data that has to outlive the caller's buffers until its
+    // frame has been replayed. Allocations are carved out of fixed-size blocks,
+    // so earlier ones never move, and the blocks are kept across resets
+    class KujoGFXDataArena
+    {
+	public:
+	    static constexpr size_t block_size = 65536;
+	    static constexpr size_t data_alignment = 16;
+
+	    KujoGFXDataArena()
 	    {
-		return;
+
 	    }
 
-	    virtual void draw(KujoGFXDraw)
+	    KujoGFXData copy(const KujoGFXData &data)
 	    {
-		return;
+		KujoGFXData arena_data;
+
+		if (data.getSize() == 0)
+		{
+		    return arena_data;
+		}
+
+		void *mem_data = alloc(data.getSize());
+		memcpy(mem_data, data.getData(), data.getSize());
+		arena_data.setData(mem_data, data.getSize());
+		return arena_data;
 	    }
 
-	    virtual void commitFrame()
+	    void *alloc(size_t size)
 	    {
-		return;
+		size = ((size + (data_alignment - 1)) & ~(data_alignment - 1));
+		bytes_used += size;
+
+		while (current_block < blocks.size())
+		{
+		    auto &block = blocks[current_block];
+
+		    if ((block_pos + size) <= block.size)
+		    {
+			void *mem_data = (block.data.get() + block_pos);
+			block_pos += size;
+			return mem_data;
+		    }
+
+		    current_block += 1;
+		    block_pos = 0;
+		}
+
+		// Oversized allocations get a block of their own
+		Block block;
+		block.size = max(size, block_size);
+		block.data.reset(new uint8_t[block.size]);
+		blocks.push_back(move(block));
+		current_block = (blocks.size() - 1);
+		block_pos = size;
+		return blocks.back().data.get();
 	    }
-    };
 
-    class KujoGFX_Null : public KujoGFXBackend
-    {
-	public:
-	    KujoGFX_Null()
+	    // Checks if the memory was handed out since the last reset
+	    bool owns(const void *mem_data) const
 	    {
+		auto ptr = reinterpret_cast<const uint8_t*>(mem_data);
+
+		for (size_t index = 0; (index <= current_block) && (index < blocks.size()); index++)
+		{
+		    auto &block = blocks[index];
+		    size_t used_size = (index == current_block) ? block_pos : block.size;
+
+		    if ((ptr >= block.data.get()) && (ptr < (block.data.get() + used_size)))
+		    {
+			return true;
+		    }
+		}
 
+		return false;
 	    }
 
-	    ~KujoGFX_Null()
+	    size_t size() const
 	    {
+		return bytes_used;
+	    }
 
+	    void reset()
+	    {
+		current_block = 0;
+		block_pos = 0;
+		bytes_used = 0;
 	    }
-    };
+
+	private:
+	    // new[] aligns to at least 16 bytes for blocks this large
+	    struct Block
+	    {
+		unique_ptr<uint8_t[]> data;
+		size_t size = 0;
+	    };
+
+	    vector<Block> blocks;
+	    size_t current_block = 0;
+	    size_t block_pos = 0;
+	    size_t bytes_used = 0;
+    };
+
+    struct KujoGFXFrameStats
+    {
+	// Number of commands replayed in the frame
+	size_t num_commands = 0;
+	// Size of the recorded command stream
+	size_t bytes_recorded = 0;
+	// Bytes copied by the frontend outside of the command stream,
+	// i.e. resource descriptions passed to the make*() functions,
+	// and data copied to keep it alive for the render thread or encoders
+	size_t bytes_copied = 0;
+	// Only filled in by backends that keep several frames in flight.
+	// The number of earlier frames the GPU was still working on when
+	// the CPU started recording this one, 0 meaning the two ran serially
+	uint32_t num_frames_in_flight = 0;
+	// Time the CPU spent blocked waiting for a free frame slot
+	double fence_wait_ms = 0.0;
+	// Only filled in by backends that shadow the API state.
+	// The number of redundant state changes that were skipped
+	size_t num_filtered_calls = 0;
+	// Pipeline and bindings changes that reached the backend, and the number
+	// of applyPipeline() and applyBindings() calls that were recorded.
+	// The two only differ if draw sorting merged redundant changes
+	size_t num_pipeline_changes = 0;
+	size_t num_bindings_changes = 0;
+	size_t num_pipeline_changes_recorded = 0;
+	size_t num_bindings_changes_recorded = 0;
+	// Draws that went through the sort stage
+	size_t num_sorted_draws = 0;
+	// Backend draws saved by merging adjacent draws
+	size_t num_merged_draws = 0;
+    };
+
+    // Device memory usage of backends that manage their own memory
+    struct KujoGFXMemoryStats
+    {
+	// Device memory allocations made by the backend
+	size_t num_blocks = 0;
+	// Resources sub-allocated from those blocks
+	size_t num_allocations = 0;
+	size_t bytes_reserved = 0;
+	size_t bytes_used = 0;
+	size_t bytes_free = 0;
+	// The free space is split over num_free_ranges ranges,
+	// the largest of which is largest_free_range bytes long
+	size_t num_free_ranges = 0;
+	size_t largest_free_range = 0;
+
+	// 0 if all free space is contiguous, approaching 1 the more it is split up
+	float getFragmentation() const
+	{
+	    if (bytes_free == 0)
+	    {
+		return 0.f;
+	    }
+
+	    return (1.f - (float(largest_free_range) / float(bytes_free)));
+	}
+    };
+
+    enum KujoGFXPixelFormat : int
+    {
+	PixelFormatInvalid = 0,
+	PixelFormatRGBA8,
+	PixelFormatBGRA8
+    };
+
+    // Result of a pixel readback. The data points straight into the backend's
+    // mapped staging memory, and is only valid for the duration of the callback
+    struct KujoGFXPixels
+    {
+	const uint8_t *data = NULL;
+	int width = 0;
+	int height = 0;
+	// Bytes from the start of one row to the next
+	uint32_t row_pitch = 0;
+	KujoGFXPixelFormat format = PixelFormatInvalid;
+	// Set if the first row is the bottom one, as with OpenGL
+	bool is_bottom_up = false;
+    };
+
+    using KujoGFXReadCallback = function<void(const KujoGFXPixels&)>;
+
+    class KujoGFXBackend
+    {
+	public:
+	    KujoGFXBackend()
+	    {
+
+	    }
+
+	    virtual ~KujoGFXBackend()
+	    {
+
+	    }
+
+	    virtual bool initBackend(void*, void*)
+	    {
+		return true;
+	    }
+
+	    virtual void shutdownBackend()
+	    {
+		return;
+	    }
+
+	    virtual void* getContextHandle()
+	    {
+		return NULL;
+	    }
+
+	    virtual void beginPass(const KujoGFXPass&)
+	    {
+		return;
+	    }
+
+	    virtual void endPass()
+	    {
+		return;
+	    }
+
+	    virtual void setPipeline(KujoGFXPipelineHandle)
+	    {
+		return;
+	    }
+
+	    // Returns false if the pipeline could not be created,
+	    // in which case its handle is released by the frontend
+	    virtual bool createPipeline(KujoGFXPipelineHandle, KujoGFXPipeline&, const KujoGFXShader&)
+	    {
+		return true;
+	    }
+
+	    virtual void applyPipeline()
+	    {
+		return;
+	    }
+
+	    virtual void createBuffer(KujoGFXBufferHandle, const KujoGFXBuffer&)
+	    {
+		return;
+	    }
+
+	    // Resources passed to the destroy functions may still be in use by the GPU,
+	    // so backends with explicit synchronization defer the actual release
+	    // until the frame that last used them has completed
+	    virtual void destroyPipeline(KujoGFXPipelineHandle)
+	    {
+		return;
+	    }
+
+	    virtual void destroyBuffer(KujoGFXBufferHandle)
+	    {
+		return;
+	    }
+
+	    // Overwrites a dynamic buffer from the start, at most once per frame
+	    virtual void updateBuffer(KujoGFXBufferHandle, const KujoGFXData&)
+	    {
+		return;
+	    }
+
+	    // Writes to a stream buffer at an offset handed out by the frontend.
+	    // The first append of a frame always has an offset of 0
+	    virtual void appendBuffer(KujoGFXBufferHandle, uint32_t, const KujoGFXData&)
+	    {
+		return;
+	    }
+
+	    virtual void applyBindings(const KujoGFXBindings&)
+	    {
+		return;
+	    }
+
+	    virtual void applyUniforms(int, const KujoGFXData&)
+	    {
+		return;
+	    }
+
+	    virtual void draw(const KujoGFXDraw&)
+	    {
+		return;
+	    }
+
+	    // Backends without a native multi-draw issue the draws one by one
+	    virtual void multiDraw(const KujoGFXDraw *draws, size_t num_draws)
+	    {
+		for (size_t index = 0; index < num_draws; index++)
+		{
+		    draw(draws[index]);
+		}
+	    }
+
+	    // Returns false if the backend can't draw from indirect buffers.
+	    // The arguments have been checked to lie within the buffer
+	    virtual bool drawIndirect(KujoGFXBufferHandle, uint32_t, uint32_t, uint32_t)
+	    {
+		return false;
+	    }
+
+	    virtual void commitFrame()
+	    {
+		return;
+	    }
+
+	    virtual KujoGFXMemoryStats getMemoryStats()
+	    {
+		return KujoGFXMemoryStats();
+	    }
+
+	    // New size of the window's drawable area in pixels
+	    virtual void resize(int, int)
+	    {
+		return;
+	    }
+
+	    // Requests offscreen rendering before initBackend().
+	    // Returns false if the backend can't run without a window
+	    virtual bool setHeadless(int, int)
+	    {
+		return false;
+	    }
+
+	    // Maximum number of frames the CPU may record ahead of the GPU,
+	    // set before initBackend() by backends that pipeline frames themselves
+	    virtual void setFrameLatency(uint32_t)
+	    {
+		return;
+	    }
+
+	    // Adds the backend's frame pacing stats of the frame that was just replayed
+	    virtual void fillFrameStats(KujoGFXFrameStats&)
+	    {
+		return;
+	    }
+
+	    // Copies the color target into staging memory and calls back
+	    // once the copy has finished. Returns false if no copy was started
+	    virtual bool readPixels(KujoGFXReadCallback)
+	    {
+		return false;
+	    }
+
+	protected:
+	    // Backend resources live in plain vectors indexed by the pool slot of their handle
+	    template<typename T, typename Handle>
+	    static T &getSlot(vector<T> &slots, Handle handle)
+	    {
+		size_t index = handle.getIndex();
+
+		if (index >= slots.size())
+		{
+		    slots.resize(index + 1);
+		}
+
+		return slots[index];
+	    }
+    };
+
+    class KujoGFX_Null : public KujoGFXBackend
+    {
+	public:
+	    KujoGFX_Null()
+	    {
+
+	    }
+
+	    ~KujoGFX_Null()
+	    {
+
+	    }
+
+	    bool setHeadless(int, int)
+	    {
+		return true;
+	    }
+
+	    bool drawIndirect(KujoGFXBufferHandle, uint32_t, uint32_t, uint32_t)
+	    {
+		return true;
+	    }
+    };
 
     #if defined(KUJOGFX_PLATFORM_WINDOWS)
     class KujoGFX_D3D12 : public KujoGFXBackend
@@ -854,6 +1543,21 @@ namespace kujogfx
 	    ID3D12Resource *buffer = NULL;
 	    D3D12_VERTEX_BUFFER_VIEW vertex_view = {};
 	    D3D12_INDEX_BUFFER_VIEW index_view = {};
+	    // Dynamic and stream buffers stay mapped and are split
+	    // into regions, with the views pointing at the active one
+	    uint8_t *mapped = NULL;
+	    uint32_t region_size = 0;
+	    uint32_t num_regions = 1;
+	    uint32_t active_region = 0;
+	    uint64_t write_frame = UINT64_MAX;
+	};
+
+	// Object that is released once the fence has reached the value
+	// signalled at the end of the frame it was destroyed in
+	struct D3D12DeferredRelease
+	{
+	    uint64_t fence_value = 0;
+	    IUnknown *object = NULL;
 	};
 
 	public:
@@ -897,6 +1601,10 @@ namespace kujogfx
 
 	    static constexpr uint32_t frame_count = 3;
 
+	    // A region stays readable for the rest of the frame it is replaced in,
+	    // so one extra region is needed for a write to never touch memory in use
+	    static constexpr uint32_t num_buffer_regions = (frame_count + 1);
+
 	    ID3D12Debug *debug = NULL;
 	    IDXGIFactory4 *factory = NULL;
 	    ID3D12Device *device = NULL;
@@ -906,6 +1614,8 @@ namespace kujogfx
 	    uint32_t rtv_descriptor_size = 0;
 
 	    size_t frame_index = 0;
+	    // Number of frames submitted so far
+	    uint64_t frame_number = 0;
 
 	    array<ID3D12Resource*, frame_count> render_targets;
 	    array<ID3D12CommandAllocator*, frame_count> command_allocators;
@@ -914,10 +1624,12 @@ namespace kujogfx
 	    HANDLE fence_event;
 	    array<uint64_t, frame_count> fence_values;
 
-	    unordered_map<uint32_t, D3D12Pipeline> pipelines;
-	    D3D12Pipeline current_pipeline;
+	    vector<D3D12Pipeline> pipelines;
+	    D3D12Pipeline *current_pipeline = NULL;
+
+	    vector<D3D12Buffer> buffers;
 
-	    unordered_map<uint32_t, D3D12Buffer> buffers;
+	    vector<D3D12DeferredRelease> deferred_releases;
 
 	    array<uint32_t, max_vertex_buffer_bind_slots> vertex_strides;
 
@@ -1023,16 +1735,15 @@ namespace kujogfx
 	    void shutdownD3D12()
 	    {
 		waitForGPU();
+		releaseDeferred(true);
 
-		for (auto &iter : buffers)
+		for (auto &buffer : buffers)
 		{
-		    auto buffer = iter.second;
 		    safeShutdown(buffer.buffer);
 		}
 
-		for (auto &iter : pipelines)
+		for (auto &pipeline : pipelines)
 		{
-		    auto pipeline = iter.second;
 		    safeShutdown(pipeline.pipeline_state);
 		    safeShutdown(pipeline.root_signature);
 		}
@@ -1060,7 +1771,7 @@ namespace kujogfx
 		safeShutdown(debug);
 	    }
 
-	    void beginPass(KujoGFXPass pass)
+	    void beginPass(const KujoGFXPass &pass)
 	    {
 		if (!fetchWindowRes())
 		{
@@ -1173,22 +1884,19 @@ namespace kujogfx
 		}
 	    }
 
-	    void setPipeline(KujoGFXPipeline pipeline)
+	    void setPipeline(KujoGFXPipelineHandle handle)
 	    {
-		auto cached_pipeline = pipelines.find(pipeline.getID());
-
-		if (cached_pipeline == pipelines.end())
+		if (handle.getIndex() >= pipelines.size())
 		{
 		    kujogfxlog::fatal() << "Could not find current pipeline!";
 		}
 
-		current_pipeline = cached_pipeline->second;
+		current_pipeline = &pipelines[handle.getIndex()];
 	    }
 
-	    void createPipeline(KujoGFXPipeline &pipeline)
+	    bool createPipeline(KujoGFXPipelineHandle handle, KujoGFXPipeline &pipeline, const KujoGFXShader &shader)
 	    {
 		D3D12Pipeline new_pipeline;
-		auto shader = pipeline.shader;
 
 		string vertex_src = shader.vert_code.hlsl_5_0_code;
 		string pixel_src = shader.frag_code.hlsl_5_0_code;
@@ -1308,24 +2016,32 @@ namespace kujogfx
 		new_pipeline.topology = getTopology(pipeline.primitive_type);
 		new_pipeline.index_format = getIndexFormat(pipeline.index_type);
 
-		current_pipeline = new_pipeline;
-		pipelines.insert(make_pair(pipeline.getID(), new_pipeline));
+		getSlot(pipelines, handle) = new_pipeline;
+		return true;
 	    }
 
 	    void applyPipeline()
 	    {
-		auto pipeline_state = current_pipeline.pipeline_state;
-		command_list->SetGraphicsRootSignature(current_pipeline.root_signature);
+		auto pipeline_state = current_pipeline->pipeline_state;
+		command_list->SetGraphicsRootSignature(current_pipeline->root_signature);
 		command_list->SetPipelineState(pipeline_state);
-		command_list->IASetPrimitiveTopology(current_pipeline.topology);
+		command_list->IASetPrimitiveTopology(current_pipeline->topology);
 	    }
 
-	    void createBuffer(KujoGFXBuffer buffer)
+	    void createBuffer(KujoGFXBufferHandle handle, const KujoGFXBuffer &buffer)
 	    {
 		D3D12Buffer d3d_buffer;
+		bool is_dynamic = (buffer.getUsage() != BufferUsageImmutable);
+		d3d_buffer.region_size = uint32_t(buffer.getBufferSize());
+
+		if (is_dynamic)
+		{
+		    d3d_buffer.region_size = ((d3d_buffer.region_size + 255) & ~uint32_t(255));
+		    d3d_buffer.num_regions = num_buffer_regions;
+		}
 
 		auto heap_properties = getHeapProperties(D3D12_HEAP_TYPE_UPLOAD);
-		auto buffer_desc = getBufferResourceDesc(buffer.getSize());
+		auto buffer_desc = getBufferResourceDesc(d3d_buffer.region_size * d3d_buffer.num_regions);
 
 		HRESULT hres = device->CreateCommittedResource(&heap_properties, D3D12_HEAP_FLAG_NONE, &buffer_desc, D3D12_RESOURCE_STATE_GENERIC_READ, NULL, IID_PPV_ARGS(&d3d_buffer.buffer));
 
@@ -1347,36 +2063,150 @@ namespace kujogfx
 		    kujogfxlog::fatal() << "Could not map buffer data!" << endl;
 		}
 
-		memcpy(buffer_data_begin, buffer.getData(), buffer.getSize());
-		d3d_buffer.buffer->Unmap(0, NULL);
+		if (buffer.getData() != NULL)
+		{
+		    memcpy(buffer_data_begin, buffer.getData(), buffer.getSize());
+		}
 
-		if (buffer.isIndexBuffer())
+		// Upload heaps can stay mapped for the lifetime of the resource
+		if (is_dynamic)
 		{
-		    auto &buffer_view = d3d_buffer.index_view;
-		    buffer_view.BufferLocation = d3d_buffer.buffer->GetGPUVirtualAddress();
-		    buffer_view.SizeInBytes = buffer.getSize();
+		    d3d_buffer.mapped = buffer_data_begin;
 		}
-		else if (buffer.isVertexBuffer())
+		else
 		{
-		    auto &buffer_view = d3d_buffer.vertex_view;
-		    buffer_view.BufferLocation = d3d_buffer.buffer->GetGPUVirtualAddress();
-		    buffer_view.SizeInBytes = buffer.getSize();
+		    d3d_buffer.buffer->Unmap(0, NULL);
 		}
 
-		buffers.insert(make_pair(buffer.getID(), d3d_buffer));
+		d3d_buffer.vertex_view.SizeInBytes = d3d_buffer.region_size;
+		d3d_buffer.index_view.SizeInBytes = d3d_buffer.region_size;
+		setActiveRegion(d3d_buffer, 0);
+
+		getSlot(buffers, handle) = d3d_buffer;
 		return;
 	    }
 
-	    D3D12Buffer findBuffer(KujoGFXBuffer buffer)
+	    void setActiveRegion(D3D12Buffer &buffer, uint32_t region)
+	    {
+		auto address = (buffer.buffer->GetGPUVirtualAddress() + (uint64_t(region) * buffer.region_size));
+		buffer.active_region = region;
+		buffer.vertex_view.BufferLocation = address;
+		buffer.index_view.BufferLocation = address;
+	    }
+
+	    void updateBuffer(KujoGFXBufferHandle handle, const KujoGFXData &data)
+	    {
+		writeBuffer(handle, 0, data);
+	    }
+
+	    void appendBuffer(KujoGFXBufferHandle handle, uint32_t offset, const KujoGFXData &data)
 	    {
-		auto iter = buffers.find(buffer.getID());
+		writeBuffer(handle, offset, data);
+	    }
 
-		if (iter != buffers.end())
+	    // The first write of every frame moves on to the next region,
+	    // which the GPU is guaranteed to be done with (see num_buffer_regions)
+	    void writeBuffer(KujoGFXBufferHandle handle, uint32_t offset, const KujoGFXData &data)
+	    {
+		if (!handle.isValid() || (handle.getIndex() >= buffers.size()))
 		{
-		    return iter->second;
+		    return;
+		}
+
+		auto &buffer = buffers[handle.getIndex()];
+
+		if (buffer.mapped == NULL)
+		{
+		    return;
+		}
+
+		if (buffer.write_frame != frame_number)
+		{
+		    setActiveRegion(buffer, ((buffer.active_region + 1) % buffer.num_regions));
+		    buffer.write_frame = frame_number;
+		}
+
+		uint8_t *mem_data = (buffer.mapped + (uint64_t(buffer.active_region) * buffer.region_size) + offset);
+		memcpy(mem_data, data.getData(), data.getSize());
+	    }
+
+	    D3D12Buffer findBuffer(KujoGFXBufferHandle handle)
+	    {
+		if (!handle.isValid() || (handle.getIndex() >= buffers.size()))
+		{
+		    return D3D12Buffer();
+		}
+
+		return buffers[handle.getIndex()];
+	    }
+
+	    void destroyBuffer(KujoGFXBufferHandle handle)
+	    {
+		auto buffer = findBuffer(handle);
+
+		if (buffer.buffer != NULL)
+		{
+		    deferRelease(buffer.buffer);
+		    buffers[handle.getIndex()] = D3D12Buffer();
+		}
+	    }
+
+	    void destroyPipeline(KujoGFXPipelineHandle handle)
+	    {
+		if (handle.getIndex() >= pipelines.size())
+		{
+		    return;
 		}
 
-		return {NULL, {}, {}};
+		auto &pipeline = pipelines[handle.getIndex()];
+
+		if (current_pipeline == &pipeline)
+		{
+		    current_pipeline = NULL;
+		}
+
+		deferRelease(pipeline.pipeline_state);
+		deferRelease(pipeline.root_signature);
+		pipeline = D3D12Pipeline();
+	    }
+
+	    void deferRelease(IUnknown *object)
+	    {
+		if (object == NULL)
+		{
+		    return;
+		}
+
+		// Commands recorded in the current frame may still reference the object
+		D3D12DeferredRelease release;
+		release.fence_value = fence_values[frame_index];
+		release.object = object;
+		deferred_releases.push_back(release);
+	    }
+
+	    void releaseDeferred(bool is_forced)
+	    {
+		if (deferred_releases.empty())
+		{
+		    return;
+		}
+
+		uint64_t completed_value = is_forced ? UINT64_MAX : fence->GetCompletedValue();
+		size_t num_pending = 0;
+
+		for (auto &release : deferred_releases)
+		{
+		    if (release.fence_value <= completed_value)
+		    {
+			release.object->Release();
+		    }
+		    else
+		    {
+			deferred_releases[num_pending++] = release;
+		    }
+		}
+
+		deferred_releases.resize(num_pending);
 	    }
 
 	    D3D12_VERTEX_BUFFER_VIEW adjustVertexBufferView(D3D12_VERTEX_BUFFER_VIEW view, uint32_t offs)
@@ -1425,9 +2255,10 @@ namespace kujogfx
 		return new_view;
 	    }
 
-	    void applyBindings(KujoGFXBindings bindings)
+	    void applyBindings(const KujoGFXBindings &bindings)
 	    {
-		vector<D3D12_VERTEX_BUFFER_VIEW> buffer_views;
+		array<D3D12_VERTEX_BUFFER_VIEW, max_vertex_buffer_bind_slots> buffer_views;
+		UINT num_buffer_views = 0;
 
 		for (size_t index = 0; index < bindings.vertex_buffers.size(); index++)
 		{
@@ -1439,11 +2270,12 @@ namespace kujogfx
 		    {
 			D3D12_VERTEX_BUFFER_VIEW buffer_view = adjustVertexBufferView(buffer.vertex_view, buffer_offset);
 			buffer_view.StrideInBytes = vertex_strides[index];
-			buffer_views.push_back(buffer_view);
+			buffer_views[num_buffer_views] = buffer_view;
+			num_buffer_views += 1;
 		    }
 		}
 
-		command_list->IASetVertexBuffers(0, buffer_views.size(), buffer_views.data());
+		command_list->IASetVertexBuffers(0, num_buffer_views, buffer_views.data());
 
 		auto index_buffer = findBuffer(bindings.index_buffer);
 
@@ -1451,30 +2283,31 @@ namespace kujogfx
 		{
 		    uint32_t index_offset = bindings.index_buffer_offset;
 		    D3D12_INDEX_BUFFER_VIEW buffer_view = adjustIndexBufferView(index_buffer.index_view, index_offset);
-		    buffer_view.Format = current_pipeline.index_format;
+		    buffer_view.Format = current_pipeline->index_format;
 		    command_list->IASetIndexBuffer(&buffer_view);
 		}
 	    }
 
-	    void applyUniforms(int, KujoGFXData)
+	    void applyUniforms(int, const KujoGFXData&)
 	    {
 		return;
 	    }
 
-	    void draw(KujoGFXDraw draw_call)
+	    void draw(const KujoGFXDraw &draw_call)
 	    {
 		UINT base_element = draw_call.base_element;
 		UINT num_elements = draw_call.num_elements;
 		UINT num_instances = draw_call.num_instances;
-		bool use_indexed_draw = (current_pipeline.index_format != DXGI_FORMAT_UNKNOWN);
+		UINT base_instance = draw_call.base_instance;
+		bool use_indexed_draw = (current_pipeline->index_format != DXGI_FORMAT_UNKNOWN);
 
 		if (use_indexed_draw)
 		{
-		    command_list->DrawIndexedInstanced(num_elements, num_instances, base_element, 0, 0);
+		    command_list->DrawIndexedInstanced(num_elements, num_instances, base_element, draw_call.base_vertex, base_instance);
 		}
 		else
 		{
-		    command_list->DrawInstanced(num_elements, num_instances, base_element, 0);
+		    command_list->DrawInstanced(num_elements, num_instances, base_element, base_instance);
 		}
 	    }
 
@@ -1490,6 +2323,7 @@ namespace kujogfx
 		    kujogfxlog::fatal() << "Could not present swapchain!" << printHRes(hres);
 		}
 
+		frame_number += 1;
 		moveToNextFrame();
 	    }
 
@@ -1751,6 +2585,7 @@ namespace kujogfx
 		}
 
 		fence_values[frame_index] = (current_fence_value + 1);
+		releaseDeferred(false);
 	    }
 
 	    D3D12_RESOURCE_BARRIER resBarrierTransition(ID3D12Resource *resource, D3D12_RESOURCE_STATES state_before, D3D12_RESOURCE_STATES state_after, uint32_t sub_resource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES, D3D12_RESOURCE_BARRIER_FLAGS flags = D3D12_RESOURCE_BARRIER_FLAG_NONE)
@@ -1942,13 +2777,13 @@ namespace kujogfx
 	    ID3D11DepthStencilView *depth_stencil_view;
 	    ID3D11Texture2D *depth_stencil_buffer;
 
-	    unordered_map<uint32_t, ID3D11Buffer*> buffers;
+	    vector<ID3D11Buffer*> buffers;
 
 	    vector<D3D11_INPUT_ELEMENT_DESC> layouts;
 	    array<UINT, max_vertex_buffer_bind_slots> vb_strides;
 
-	    unordered_map<uint32_t, D3D11Pipeline> pipelines;
-	    D3D11Pipeline current_pipeline;
+	    vector<D3D11Pipeline> pipelines;
+	    D3D11Pipeline *current_pipeline = NULL;
 
 	    KujoGFXPass current_pass;
 
@@ -2126,9 +2961,8 @@ namespace kujogfx
 
 	    void shutdownD3D11()
 	    {
-		for (auto &iter : buffers)
+		for (auto &buffer : buffers)
 		{
-		    auto buffer = iter.second;
 		    if (buffer != NULL)
 		    {
 			buffer->Release();
@@ -2136,60 +2970,65 @@ namespace kujogfx
 		    }
 		}
 
-		for (auto &iter : pipelines)
+		for (auto &pipeline : pipelines)
 		{
-		    auto pipeline = iter.second;
+		    releasePipeline(pipeline);
+		}
 
-		    for (auto &buffer : pipeline.cb_buffers)
-		    {
-			if (buffer.buffer != NULL)
-			{
-			    buffer.buffer->Release();
-			    buffer.buffer = NULL;
-			}
-		    }
+		depth_stencil_view->Release();
+		depth_stencil_buffer->Release();
+		render_target_view->Release();
+		swapchain->Release();
+		d3d11_device->Release();
+		d3d11_dev_con->Release();
+	    }
 
-		    if (pipeline.depth_stencil_state != NULL)
+	    void releasePipeline(D3D11Pipeline &pipeline)
+	    {
+		for (auto &buffer : pipeline.cb_buffers)
+		{
+		    if (buffer.buffer != NULL)
 		    {
-			pipeline.depth_stencil_state->Release();
-			pipeline.depth_stencil_state = NULL;
+			buffer.buffer->Release();
+			buffer.buffer = NULL;
 		    }
+		}
 
-		    if (pipeline.raster_state != NULL)
-		    {
-			pipeline.raster_state->Release();
-			pipeline.raster_state = NULL;
-		    }
+		if (pipeline.depth_stencil_state != NULL)
+		{
+		    pipeline.depth_stencil_state->Release();
+		    pipeline.depth_stencil_state = NULL;
+		}
 
-		    if (pipeline.vert_shader != NULL)
-		    {
-			pipeline.vert_shader->Release();
-			pipeline.vert_shader = NULL;
-		    }
+		if (pipeline.raster_state != NULL)
+		{
+		    pipeline.raster_state->Release();
+		    pipeline.raster_state = NULL;
+		}
 
-		    if (pipeline.pixel_shader != NULL)
-		    {
-			pipeline.pixel_shader->Release();
-			pipeline.pixel_shader = NULL;
-		    }
+		if (pipeline.vert_shader != NULL)
+		{
+		    pipeline.vert_shader->Release();
+		    pipeline.vert_shader = NULL;
+		}
 
-		    if (pipeline.vert_layout != NULL)
-		    {
-			pipeline.vert_layout->Release();
-			pipeline.vert_layout = NULL;
-		    }
+		if (pipeline.pixel_shader != NULL)
+		{
+		    pipeline.pixel_shader->Release();
+		    pipeline.pixel_shader = NULL;
 		}
 
-		depth_stencil_view->Release();
-		depth_stencil_buffer->Release();
-		render_target_view->Release();
-		swapchain->Release();
-		d3d11_device->Release();
-		d3d11_dev_con->Release();
+		if (pipeline.vert_layout != NULL)
+		{
+		    pipeline.vert_layout->Release();
+		    pipeline.vert_layout = NULL;
+		}
+
+		pipeline.cb_buffers.clear();
 	    }
 
 
-	    void beginPass(KujoGFXPass pass)
+	    void beginPass(const KujoGFXPass &pass)
 	    {
 		if (!fetchWindowRes())
 		{
@@ -2327,22 +3166,19 @@ namespace kujogfx
 		}
 	    }
 
-	    void setPipeline(KujoGFXPipeline pipeline)
+	    void setPipeline(KujoGFXPipelineHandle handle)
 	    {
-		auto cached_pipeline = pipelines.find(pipeline.getID());
-
-		if (cached_pipeline == pipelines.end())
+		if (handle.getIndex() >= pipelines.size())
 		{
 		    kujogfxlog::fatal() << "Could not find current pipeline!";
 		}
 
-		current_pipeline = cached_pipeline->second;
+		current_pipeline = &pipelines[handle.getIndex()];
 	    }
 
-	    void createPipeline(KujoGFXPipeline &pipeline)
+	    bool createPipeline(KujoGFXPipelineHandle handle, KujoGFXPipeline &pipeline, const KujoGFXShader &shader)
 	    {
 		D3D11Pipeline new_pipeline;
-		auto shader = pipeline.shader;
 
 		string vertex_src = shader.vert_code.hlsl_4_0_code;
 		string pixel_src = shader.frag_code.hlsl_4_0_code;
@@ -2495,8 +3331,8 @@ namespace kujogfx
 
 		vert_buffer->Release();
 		pixel_buffer->Release();
-		current_pipeline = new_pipeline;
-		pipelines.insert(make_pair(pipeline.getID(), new_pipeline));
+		getSlot(pipelines, handle) = new_pipeline;
+		return true;
 	    }
 
 	    void applyPipeline()
@@ -2504,9 +3340,9 @@ namespace kujogfx
 		array<ID3D11Buffer*, 8> vs_buffers = {};
 		array<ID3D11Buffer*, 8> ps_buffers = {};
 
-		for (size_t i = 0; i < current_pipeline.cb_buffers.size(); i++)
+		for (size_t i = 0; i < current_pipeline->cb_buffers.size(); i++)
 		{
-		    auto &buffer = current_pipeline.cb_buffers.at(i);
+		    auto &buffer = current_pipeline->cb_buffers.at(i);
 		    uint32_t register_b_n = buffer.binding;
 
 		    switch (buffer.stage)
@@ -2539,22 +3375,27 @@ namespace kujogfx
 		    }
 		}
 
-		d3d11_dev_con->RSSetState(current_pipeline.raster_state);
-		d3d11_dev_con->OMSetDepthStencilState(current_pipeline.depth_stencil_state, 0);
-		d3d11_dev_con->IASetInputLayout(current_pipeline.vert_layout);
-		d3d11_dev_con->VSSetShader(current_pipeline.vert_shader, 0, 0);
+		d3d11_dev_con->RSSetState(current_pipeline->raster_state);
+		d3d11_dev_con->OMSetDepthStencilState(current_pipeline->depth_stencil_state, 0);
+		d3d11_dev_con->IASetInputLayout(current_pipeline->vert_layout);
+		d3d11_dev_con->VSSetShader(current_pipeline->vert_shader, 0, 0);
 		d3d11_dev_con->VSSetConstantBuffers(0, vs_buffers.size(), vs_buffers.data());
-		d3d11_dev_con->PSSetShader(current_pipeline.pixel_shader, 0, 0);
+		d3d11_dev_con->PSSetShader(current_pipeline->pixel_shader, 0, 0);
 		d3d11_dev_con->PSSetConstantBuffers(0, ps_buffers.size(), ps_buffers.data());
-		d3d11_dev_con->IASetPrimitiveTopology(current_pipeline.topology);
+		d3d11_dev_con->IASetPrimitiveTopology(current_pipeline->topology);
 	    }
 
-	    D3D11_USAGE getUsage(KujoGFXBuffer)
+	    D3D11_USAGE getUsage(const KujoGFXBuffer &buffer)
 	    {
+		if (buffer.getUsage() != BufferUsageImmutable)
+		{
+		    return D3D11_USAGE_DYNAMIC;
+		}
+
 		return D3D11_USAGE_DEFAULT;
 	    }
 
-	    D3D11_BIND_FLAG getBindFlags(KujoGFXBuffer buffer)
+	    D3D11_BIND_FLAG getBindFlags(const KujoGFXBuffer &buffer)
 	    {
 		if (buffer.isIndexBuffer())
 		{
@@ -2570,59 +3411,139 @@ namespace kujogfx
 		}
 	    }
 
-	    D3D11_CPU_ACCESS_FLAG getCPUAccessFlags(KujoGFXBuffer)
+	    D3D11_CPU_ACCESS_FLAG getCPUAccessFlags(const KujoGFXBuffer &buffer)
 	    {
+		if (buffer.getUsage() != BufferUsageImmutable)
+		{
+		    return D3D11_CPU_ACCESS_WRITE;
+		}
+
 		return (D3D11_CPU_ACCESS_FLAG)0;
 	    }
 
-	    D3D11_RESOURCE_MISC_FLAG getMiscFlags(KujoGFXBuffer)
+	    D3D11_RESOURCE_MISC_FLAG getMiscFlags(const KujoGFXBuffer&)
 	    {
 		return (D3D11_RESOURCE_MISC_FLAG)0;
 	    }
 
-	    void createBuffer(KujoGFXBuffer buffer)
+	    void createBuffer(KujoGFXBufferHandle handle, const KujoGFXBuffer &buffer)
 	    {
 		ID3D11Buffer *d3d_buffer = NULL;
 		D3D11_BUFFER_DESC buffer_desc;
 		ZeroMemory(&buffer_desc, sizeof(buffer_desc));
 
 		buffer_desc.Usage = getUsage(buffer);
-		buffer_desc.ByteWidth = (UINT)buffer.getSize();
+		buffer_desc.ByteWidth = (UINT)buffer.getBufferSize();
 		buffer_desc.BindFlags = getBindFlags(buffer);
 		buffer_desc.CPUAccessFlags = getCPUAccessFlags(buffer);
 		buffer_desc.MiscFlags = getMiscFlags(buffer);
 
+		// Initial data has to cover the whole buffer,
+		// otherwise it is written with a regular update below
+		bool is_full_data = ((buffer.getData() != NULL) && (buffer.getSize() == buffer.getBufferSize()));
+
 		D3D11_SUBRESOURCE_DATA buffer_data;
 		ZeroMemory(&buffer_data, sizeof(buffer_data));
 		buffer_data.pSysMem = buffer.getData();
 
-		HRESULT hres = d3d11_device->CreateBuffer(&buffer_desc, &buffer_data, &d3d_buffer);
+		HRESULT hres = d3d11_device->CreateBuffer(&buffer_desc, (is_full_data ? &buffer_data : NULL), &d3d_buffer);
 
 		if (FAILED(hres))
 		{
 		    kujogfxlog::fatal() << "Failed to create buffer!";
 		}
 
-		buffers.insert(make_pair(buffer.getID(), d3d_buffer));
+		getSlot(buffers, handle) = d3d_buffer;
+
+		if (!is_full_data && (buffer.getData() != NULL))
+		{
+		    updateBuffer(handle, buffer);
+		}
 	    }
 
-	    ID3D11Buffer *findBuffer(KujoGFXBuffer buffer)
+	    ID3D11Buffer *findBuffer(KujoGFXBufferHandle handle)
 	    {
-		auto iter = buffers.find(buffer.getID());
-
-		if (iter == buffers.end())
+		if (!handle.isValid() || (handle.getIndex() >= buffers.size()))
 		{
 		    return NULL;
 		}
 
-		return iter->second;
+		return buffers[handle.getIndex()];
+	    }
+
+	    // D3D11 keeps released objects alive until the GPU is done with them,
+	    // so there is no need to defer the release ourselves
+	    void destroyBuffer(KujoGFXBufferHandle handle)
+	    {
+		ID3D11Buffer *buffer = findBuffer(handle);
+
+		if (buffer != NULL)
+		{
+		    buffer->Release();
+		    buffers[handle.getIndex()] = NULL;
+		}
+	    }
+
+	    void updateBuffer(KujoGFXBufferHandle handle, const KujoGFXData &data)
+	    {
+		writeBuffer(handle, 0, data, D3D11_MAP_WRITE_DISCARD);
+	    }
+
+	    // Only the first append of a frame discards the old contents,
+	    // the ones after it are guaranteed to not overwrite anything in use
+	    void appendBuffer(KujoGFXBufferHandle handle, uint32_t offset, const KujoGFXData &data)
+	    {
+		writeBuffer(handle, offset, data, ((offset == 0) ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE));
+	    }
+
+	    void writeBuffer(KujoGFXBufferHandle handle, uint32_t offset, const KujoGFXData &data, D3D11_MAP map_type)
+	    {
+		ID3D11Buffer *buffer = findBuffer(handle);
+
+		if (buffer == NULL)
+		{
+		    return;
+		}
+
+		D3D11_MAPPED_SUBRESOURCE mapped_res;
+		ZeroMemory(&mapped_res, sizeof(mapped_res));
+
+		HRESULT hres = d3d11_dev_con->Map(buffer, 0, map_type, 0, &mapped_res);
+
+		if (FAILED(hres))
+		{
+		    kujogfxlog::error() << "Could not map buffer! " << hresToString(hres);
+		    return;
+		}
+
+		uint8_t *mem_data = reinterpret_cast<uint8_t*>(mapped_res.pData);
+		memcpy((mem_data + offset), data.getData(), data.getSize());
+		d3d11_dev_con->Unmap(buffer, 0);
+	    }
+
+	    void destroyPipeline(KujoGFXPipelineHandle handle)
+	    {
+		if (handle.getIndex() >= pipelines.size())
+		{
+		    return;
+		}
+
+		auto &pipeline = pipelines[handle.getIndex()];
+
+		if (current_pipeline == &pipeline)
+		{
+		    current_pipeline = NULL;
+		}
+
+		releasePipeline(pipeline);
 	    }
 
-	    void applyBindings(KujoGFXBindings bindings)
+	    void applyBindings(const KujoGFXBindings &bindings)
 	    {
-		vector<ID3D11Buffer*> vertex_buffers;
-		vector<UINT> vertex_buffer_strides;
-		vector<UINT> vertex_buffer_offsets;
+		array<ID3D11Buffer*, max_vertex_buffer_bind_slots> vertex_buffers;
+		array<UINT, max_vertex_buffer_bind_slots> vertex_buffer_strides;
+		array<UINT, max_vertex_buffer_bind_slots> vertex_buffer_offsets;
+		UINT num_vertex_buffers = 0;
 
 		for (size_t index = 0; index < bindings.vertex_buffers.size(); index++)
 		{
@@ -2631,54 +3552,56 @@ namespace kujogfx
 
 		    if (vert_buffer != NULL)
 		    {
-			vertex_buffers.push_back(vert_buffer);
-			vertex_buffer_strides.push_back(vb_strides[index]);
-			vertex_buffer_offsets.push_back(bindings.vertex_buffer_offsets[index]);
+			vertex_buffers[num_vertex_buffers] = vert_buffer;
+			vertex_buffer_strides[num_vertex_buffers] = vb_strides[index];
+			vertex_buffer_offsets[num_vertex_buffers] = bindings.vertex_buffer_offsets[index];
+			num_vertex_buffers += 1;
 		    }
 		}
 
-		d3d11_dev_con->IASetVertexBuffers(0, vertex_buffers.size(), vertex_buffers.data(), vertex_buffer_strides.data(), vertex_buffer_offsets.data());
+		d3d11_dev_con->IASetVertexBuffers(0, num_vertex_buffers, vertex_buffers.data(), vertex_buffer_strides.data(), vertex_buffer_offsets.data());
 
 		ID3D11Buffer *index_buffer = findBuffer(bindings.index_buffer);
 
 		if (index_buffer != NULL)
 		{
-		    d3d11_dev_con->IASetIndexBuffer(index_buffer, current_pipeline.index_format, bindings.index_buffer_offset);
+		    d3d11_dev_con->IASetIndexBuffer(index_buffer, current_pipeline->index_format, bindings.index_buffer_offset);
 		}
 	    }
 
-	    void applyUniforms(int ub_slot, KujoGFXData data)
+	    void applyUniforms(int ub_slot, const KujoGFXData &data)
 	    {
-		assert((ub_slot >= 0) && (ub_slot < current_pipeline.cb_buffers.size()));
-		auto &buffer = current_pipeline.cb_buffers.at(ub_slot).buffer;
+		assert((ub_slot >= 0) && (ub_slot < current_pipeline->cb_buffers.size()));
+		auto &buffer = current_pipeline->cb_buffers.at(ub_slot).buffer;
 		assert(buffer != NULL);
 		d3d11_dev_con->UpdateSubresource(buffer, 0, NULL, data.getData(), 0, 0);
 	    }
 
-	    void draw(KujoGFXDraw draw_call)
+	    void draw(const KujoGFXDraw &draw_call)
 	    {
 		uint32_t base_element = draw_call.base_element;
 		uint32_t num_elements = draw_call.num_elements;
 		uint32_t num_instances = draw_call.num_instances;
-		bool use_indexed_draw = (current_pipeline.index_format != DXGI_FORMAT_UNKNOWN);
-		bool use_instanced_draw = (num_instances > 1);
+		uint32_t base_instance = draw_call.base_instance;
+		bool use_indexed_draw = (current_pipeline->index_format != DXGI_FORMAT_UNKNOWN);
+		bool use_instanced_draw = ((num_instances > 1) || (base_instance != 0));
 
 		if (use_indexed_draw)
 		{
 		    if (use_instanced_draw)
 		    {
-			d3d11_dev_con->DrawIndexedInstanced(num_elements, num_instances, base_element, 0, 0);
+			d3d11_dev_con->DrawIndexedInstanced(num_elements, num_instances, base_element, draw_call.base_vertex, base_instance);
 		    }
 		    else
 		    {
-			d3d11_dev_con->DrawIndexed(num_elements, base_element, 0);
+			d3d11_dev_con->DrawIndexed(num_elements, base_element, draw_call.base_vertex);
 		    }
 		}
 		else
 		{
 		    if (use_instanced_draw)
 		    {
-			d3d11_dev_con->DrawInstanced(num_elements, num_instances, base_element, 0);
+			d3d11_dev_con->DrawInstanced(num_elements, num_instances, base_element, base_instance);
 		    }
 		    else
 		    {
@@ -2739,6 +3662,19 @@ namespace kujogfx
 	struct GLUniformBlock
 	{
 	    vector<GLUniform> uniforms;
+	    // Set for std140 blocks declared as a uniform block in the shader,
+	    // which are sourced from the streaming uniform buffer instead
+	    bool is_ubo = false;
+	    uint32_t size = 0;
+	};
+
+	struct GLBuffer
+	{
+	    GLuint buffer = 0;
+	    GLenum usage = GL_STATIC_DRAW;
+	    GLsizeiptr size = 0;
+	    // Contents of indirect buffers, which live on the CPU only
+	    vector<uint8_t> indirect_data;
 	};
 
 	struct GLPipeline
@@ -2748,6 +3684,69 @@ namespace kujogfx
 	    GLenum primitive_type;
 	    GLenum index_type;
 	    vector<GLUniformBlock> uniform_blocks;
+	    // Fixed-function state, applied whenever the pipeline is bound
+	    KujoGFXCullMode cull_mode = CullModeNone;
+	    GLenum depth_func = GL_ALWAYS;
+	    GLboolean depth_mask = GL_FALSE;
+	};
+
+	// Identifies the vertex attribute setup of a pipeline and binding set.
+	// Handle IDs are used since they are never reused across generations
+	struct GLVertexArrayKey
+	{
+	    uint32_t pipeline_id = 0;
+	    array<uint32_t, max_vertex_buffer_bind_slots> vertex_buffers = {};
+	    array<uint32_t, max_vertex_buffer_bind_slots> vertex_buffer_offsets = {};
+
+	    bool operator==(const GLVertexArrayKey &key) const
+	    {
+		return ((pipeline_id == key.pipeline_id) && (vertex_buffers == key.vertex_buffers) && (vertex_buffer_offsets == key.vertex_buffer_offsets));
+	    }
+	};
+
+	struct GLReadback
+	{
+	    GLuint buffer = 0;
+	    GLsizeiptr size = 0;
+	    GLsync fence = NULL;
+	    KujoGFXReadCallback callback;
+	    int width = 0;
+	    int height = 0;
+	};
+
+	struct GLVertexArray
+	{
+	    GLVertexArrayKey key;
+	    uint64_t hash = 0;
+	    GLuint vao = 0;
+	    // The element array binding is part of the vertex array state.
+	    // It's tracked by handle id, since GL reuses the names of deleted buffers
+	    uint32_t element_buffer_id = 0;
+	};
+
+	struct GLUniformRange
+	{
+	    GLuint buffer = 0;
+	    GLintptr offset = 0;
+	    GLsizeiptr size = 0;
+	};
+
+	// Shadow copy of the GL state set by the backend.
+	// Only valid as long as nothing else touches the context
+	struct GLState
+	{
+	    GLuint program = 0;
+	    GLuint vertex_array = 0;
+	    GLuint array_buffer = 0;
+	    GLuint uniform_buffer = 0;
+	    GLuint copy_write_buffer = 0;
+	    array<GLUniformRange, max_uniform_block_bind_slots> uniform_ranges;
+	    bool is_cull_enabled = false;
+	    GLenum cull_face = GL_BACK;
+	    GLenum depth_func = GL_LESS;
+	    GLboolean depth_mask = GL_TRUE;
+	    array<GLint, 4> viewport = {};
+	    array<GLint, 4> scissor = {};
 	};
 
 	public:
@@ -2776,6 +3775,20 @@ namespace kujogfx
 		shutdownOpenGL();
 	    }
 
+	    bool setHeadless(int width, int height)
+	    {
+		#if defined(KUJOGFX_PLATFORM_LINUX)
+		is_headless = true;
+		window_width = width;
+		window_height = height;
+		return true;
+		#else
+		(void)width;
+		(void)height;
+		return false;
+		#endif
+	    }
+
 	    void *getContextHandle()
 	    {
 		#if defined(KUJOGFX_PLATFORM_WINDOWS) && !defined(KUJOGFX_USE_GLES)
@@ -2806,11 +3819,42 @@ namespace kujogfx
 	    void *win_handle = NULL;
 	    void *disp_handle = NULL;
 
-	    unordered_map<uint32_t, GLuint> buffers;
+	    // Headless contexts render into this framebuffer instead of a window surface
+	    bool is_headless = false;
+	    GLuint offscreen_fbo = 0;
+	    GLuint offscreen_color = 0;
+	    GLuint offscreen_depth = 0;
+
+	    vector<GLBuffer> buffers;
 	    uint32_t index_buffer_offset = 0;
+	    KujoGFXBufferHandle current_index_buffer;
+	    // Key of the vertex array set up by the last applyBindings()
+	    GLVertexArrayKey current_vertex_array_key;
 
 	    size_t gl_max_vertex_attribs = 0;
 
+	    // Uniform blocks are sub-allocated from this buffer, which is orphaned
+	    // at the first write of every frame and whenever it runs full
+	    static constexpr uint32_t uniform_buffer_size = (4 << 20);
+	    GLuint uniform_buffer = 0;
+	    uint32_t uniform_buffer_pos = 0;
+	    uint32_t uniform_alignment = 256;
+
+	    GLState gl_state;
+	    // State changes skipped in the current frame
+	    size_t num_filtered_calls = 0;
+
+	    // Scratch arrays of multiDraw()
+	    vector<GLint> multi_draw_firsts;
+	    vector<GLint> multi_draw_base_vertices;
+	    vector<GLsizei> multi_draw_counts;
+	    vector<const void*> multi_draw_indices;
+
+	    // Readbacks waiting on their fence, oldest first,
+	    // and the pack buffers of finished ones, kept for reuse
+	    list<GLReadback> pending_readbacks;
+	    vector<GLReadback> free_readbacks;
+
 	    bool loadGL()
 	    {
 		#if defined(KUJOGFX_USE_GLES)
@@ -2833,12 +3877,20 @@ namespace kujogfx
 		#endif
 	    }
 
+	    // Bound whenever no cached vertex array is, so that buffer
+	    // creation never disturbs the element binding of a cached one
 	    GLuint gl_vao;
 
 	    KujoGFXPass current_pass;
 
-	    unordered_map<uint32_t, GLPipeline> pipelines;
-	    GLPipeline current_pipeline;
+	    vector<GLPipeline> pipelines;
+	    GLPipeline *current_pipeline = NULL;
+	    uint32_t current_pipeline_id = 0;
+
+	    // Vertex arrays in least recently used order, most recent first
+	    static constexpr size_t max_vertex_arrays = 256;
+	    list<GLVertexArray> vertex_arrays;
+	    unordered_map<uint64_t, list<GLVertexArray>::iterator> vertex_array_map;
 
 	    bool createGLContext()
 	    {
@@ -2981,9 +4033,56 @@ namespace kujogfx
 
 	    #elif defined(KUJOGFX_PLATFORM_LINUX)
 	    EGLDisplay m_display;
-	    EGLSurface m_surface;
+	    EGLSurface m_surface = EGL_NO_SURFACE;
 	    EGLContext m_context;
 
+	    bool hasEGLExtension(EGLDisplay display, const char *name)
+	    {
+		const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+
+		if (extensions == NULL)
+		{
+		    return false;
+		}
+
+		stringstream ext_str(extensions);
+		string ext;
+
+		while (ext_str >> ext)
+		{
+		    if (ext == name)
+		    {
+			return true;
+		    }
+		}
+
+		return false;
+	    }
+
+	    // Mesa's surfaceless platform needs neither a display server nor a GPU,
+	    // so llvmpipe works on machines without either
+	    EGLDisplay getHeadlessDisplay()
+	    {
+		#if !defined(EGL_PLATFORM_SURFACELESS_MESA)
+		const EGLenum EGL_PLATFORM_SURFACELESS_MESA = 0x31DD;
+		#endif
+
+		// Without a default display, glad can't detect EGL 1.5 and leaves this unloaded
+		auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYPROC>(eglGetProcAddress("eglGetPlatformDisplay"));
+
+		if ((get_platform_display != NULL) && hasEGLExtension(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless"))
+		{
+		    EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+
+		    if (display != EGL_NO_DISPLAY)
+		    {
+			return display;
+		    }
+		}
+
+		return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	    }
+
 	    bool createEGLContext()
 	    {
 		int egl_version = gladLoaderLoadEGL(NULL);
@@ -3001,7 +4100,7 @@ namespace kujogfx
 		auto display_type = reinterpret_cast<EGLNativeDisplayType>(disp_handle);
 		auto window_type = reinterpret_cast<EGLNativeWindowType>(win_handle);
 
-		m_display = eglGetDisplay(display_type);
+		m_display = is_headless ? getHeadlessDisplay() : eglGetDisplay(display_type);
 
 		if (m_display == EGL_NO_DISPLAY)
 		{
@@ -3038,9 +4137,18 @@ namespace kujogfx
 		    return false;
 		}
 
+		// Headless contexts only need a pbuffer if they can't be made current without a surface
+		bool is_surfaceless = (is_headless && hasEGLExtension(m_display, "EGL_KHR_surfaceless_context"));
+		EGLint surface_type = EGL_WINDOW_BIT;
+
+		if (is_headless)
+		{
+		    surface_type = is_surfaceless ? 0 : EGL_PBUFFER_BIT;
+		}
+
 		EGLint config_attrib[] = 
 		{
-		    EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+		    EGL_SURFACE_TYPE, surface_type,
 		    EGL_CONFORMANT, attrib_bit,
 		    EGL_RENDERABLE_TYPE, attrib_bit,
 		    EGL_COLOR_BUFFER_TYPE, EGL_RGB_BUFFER,
@@ -3074,9 +4182,23 @@ namespace kujogfx
 		    EGL_NONE
 		};
 
-		m_surface = eglCreateWindowSurface(m_display, config, window_type, surface_attribs);
+		if (!is_headless)
+		{
+		    m_surface = eglCreateWindowSurface(m_display, config, window_type, surface_attribs);
+		}
+		else if (!is_surfaceless)
+		{
+		    EGLint pbuffer_attribs[] =
+		    {
+			EGL_WIDTH, 1,
+			EGL_HEIGHT, 1,
+			EGL_NONE
+		    };
+
+		    m_surface = eglCreatePbufferSurface(m_display, config, pbuffer_attribs);
+		}
 
-		if (m_surface == EGL_NO_SURFACE)
+		if ((m_surface == EGL_NO_SURFACE) && !is_surfaceless)
 		{
 		    kujogfxlog::error() << "Could not create EGL surface!";
 		    return false;
@@ -3124,7 +4246,13 @@ namespace kujogfx
 		unloadGL();
 		eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
 		eglDestroyContext(m_display, m_context);
-		eglDestroySurface(m_display, m_surface);
+
+		if (m_surface != EGL_NO_SURFACE)
+		{
+		    eglDestroySurface(m_display, m_surface);
+		    m_surface = EGL_NO_SURFACE;
+		}
+
 		eglTerminate(m_display);
 
 		gladLoaderUnloadEGL();
@@ -3207,7 +4335,7 @@ namespace kujogfx
 		win_handle = window_handle;
 		disp_handle = display_handle;
 
-		if (!fetchWindowRes())
+		if (!is_headless && !fetchWindowRes())
 		{
 		    return false;
 		}
@@ -3241,8 +4369,16 @@ namespace kujogfx
 		    return false;
 		}
 
+		gl_state = GLState();
+
 		glGenVertexArrays(1, &gl_vao);
 		glBindVertexArray(gl_vao);
+		gl_state.vertex_array = gl_vao;
+
+		glGenBuffers(1, &uniform_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, uniform_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, uniform_buffer_size, NULL, GL_STREAM_DRAW);
+		gl_state.uniform_buffer = uniform_buffer;
 
 		glEnable(GL_DEPTH_TEST);
 		glDepthFunc(GL_ALWAYS);
@@ -3254,9 +4390,66 @@ namespace kujogfx
 		glCullFace(GL_BACK);
 		glEnable(GL_SCISSOR_TEST);
 
+		gl_state.depth_func = GL_ALWAYS;
+		gl_state.depth_mask = GL_FALSE;
+		gl_state.is_cull_enabled = false;
+		gl_state.cull_face = GL_BACK;
+
+		if (is_headless && !createOffscreenFramebuffer())
+		{
+		    kujogfxlog::error() << "Could not create offscreen framebuffer!";
+		    return false;
+		}
+
 		return true;
 	    }
 
+	    // Stays bound for the lifetime of the context, so passes need no extra binds
+	    bool createOffscreenFramebuffer()
+	    {
+		glGenRenderbuffers(1, &offscreen_color);
+		glGenRenderbuffers(1, &offscreen_depth);
+		allocOffscreenStorage();
+
+		glGenFramebuffers(1, &offscreen_fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, offscreen_fbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreen_color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, offscreen_depth);
+
+		return (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+	    }
+
+	    void allocOffscreenStorage()
+	    {
+		glBindRenderbuffer(GL_RENDERBUFFER, offscreen_color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, window_width, window_height);
+		glBindRenderbuffer(GL_RENDERBUFFER, offscreen_depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, window_width, window_height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	    }
+
+	    void destroyOffscreenFramebuffer()
+	    {
+		if (offscreen_fbo != 0)
+		{
+		    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		    glDeleteFramebuffers(1, &offscreen_fbo);
+		    offscreen_fbo = 0;
+		}
+
+		if (offscreen_color != 0)
+		{
+		    glDeleteRenderbuffers(1, &offscreen_color);
+		    offscreen_color = 0;
+		}
+
+		if (offscreen_depth != 0)
+		{
+		    glDeleteRenderbuffers(1, &offscreen_depth);
+		    offscreen_depth = 0;
+		}
+	    }
+
 	    string glErrorToString(GLenum code)
 	    {
 		stringstream err_str;
@@ -3315,30 +4508,53 @@ namespace kujogfx
 
 		kujogfxlog::info() << "Maximum vertex attributes: " << dec << int(gl_max_vertex_attribs) << endl;
 
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &gl_int_val);
+
+		if (!checkErrors("Could not fetch uniform buffer offset alignment!"))
+		{
+		    return false;
+		}
+
+		// Offsets are aligned with a power-of-two mask
+		if ((gl_int_val > 0) && ((gl_int_val & (gl_int_val - 1)) == 0))
+		{
+		    uniform_alignment = uint32_t(gl_int_val);
+		}
+
 		return true;
 	    }
 
 	    void shutdownOpenGL()
 	    {
-		for (auto &iter : buffers)
+		for (auto &buffer : buffers)
 		{
-		    auto buffer = iter.second;
-
-		    if (glIsBuffer(buffer))
+		    if (glIsBuffer(buffer.buffer))
 		    {
-			glDeleteBuffers(1, &buffer);
+			glDeleteBuffers(1, &buffer.buffer);
 		    }
 		}
 
-		for (auto &iter : pipelines)
+		for (auto &pipeline : pipelines)
 		{
-		    auto pipeline = iter.second;
 		    if (isProgramDelete(pipeline.program))
 		    {
 			glDeleteProgram(pipeline.program);
 		    }
 		}
 
+		if (uniform_buffer != 0)
+		{
+		    glDeleteBuffers(1, &uniform_buffer);
+		    uniform_buffer = 0;
+		}
+
+		while (!vertex_arrays.empty())
+		{
+		    releaseVertexArray(vertex_arrays.begin());
+		}
+
+		destroyReadbacks();
+		destroyOffscreenFramebuffer();
 		glBindVertexArray(0);
 
 		if (gl_vao)
@@ -3361,15 +4577,24 @@ namespace kujogfx
 		return (is_delete != 0);
 	    }
 
-	    void beginPass(KujoGFXPass pass)
+	    // Querying the window every pass would be a display server
+	    // round trip on X11, so the size is fetched once at init
+	    // and afterwards only changes through resize()
+	    void resize(int width, int height)
 	    {
-		if (!fetchWindowRes())
+		window_width = width;
+		window_height = height;
+
+		if (is_headless)
 		{
-		    kujogfxlog::fatal() << "Could not fetch window resolution!";
+		    allocOffscreenStorage();
 		}
+	    }
 
-		glViewport(0, 0, window_width, -window_height);
-		glScissor(0, 0, window_width, window_height);
+	    void beginPass(const KujoGFXPass &pass)
+	    {
+		setViewport(0, 0, window_width, window_height);
+		setScissor(0, 0, window_width, window_height);
 
 		current_pass = pass;
 
@@ -3382,6 +4607,8 @@ namespace kujogfx
 		    glClearColor(color.red, color.green, color.blue, color.alpha);
 		}
 
+		// Depth clears are masked by the depth write mask
+		setDepthMask(GL_TRUE);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	    }
 
@@ -3528,22 +4755,20 @@ namespace kujogfx
 		}
 	    }
 
-	    void setPipeline(KujoGFXPipeline pipeline)
+	    void setPipeline(KujoGFXPipelineHandle handle)
 	    {
-		auto cached_pipeline = pipelines.find(pipeline.getID());
-
-		if (cached_pipeline == pipelines.end())
+		if (handle.getIndex() >= pipelines.size())
 		{
 		    kujogfxlog::fatal() << "Could not find current pipeline!";
 		}
 
-		current_pipeline = cached_pipeline->second;
+		current_pipeline = &pipelines[handle.getIndex()];
+		current_pipeline_id = handle.id;
 	    }
 
-	    void createPipeline(KujoGFXPipeline &pipeline)
+	    bool createPipeline(KujoGFXPipelineHandle handle, KujoGFXPipeline &pipeline, const KujoGFXShader &shader)
 	    {
 		GLPipeline new_pipeline;
-		auto shader = pipeline.shader;
 
 		string vert_source = (use_gles) ? shader.vert_code.glsl_es_code : shader.vert_code.glsl_code;
 		string frag_source = (use_gles) ? shader.frag_code.glsl_es_code : shader.frag_code.glsl_code;
@@ -3647,7 +4872,7 @@ namespace kujogfx
 			auto &gl_attr = new_pipeline.attribs[attr_loc];
 			assert(gl_attr.vb_index == -1);
 			gl_attr.vb_index = int8_t(attrib.buffer_index);
-			assert(gl_attr.stride > 0);
+			assert(buffer.stride > 0);
 			gl_attr.stride = uint8_t(buffer.stride);
 			gl_attr.offset = attrib.offset;
 			gl_attr.size = getSize(attrib.format);
@@ -3660,21 +4885,9 @@ namespace kujogfx
 		new_pipeline.index_type = getIndexType(pipeline.index_type);
 		new_pipeline.program = shader_program;
 
-		if (pipeline.cull_mode == CullModeNone)
-		{
-		    glDisable(GL_CULL_FACE);
-		}
-		else
-		{
-		    glEnable(GL_CULL_FACE);
-		    GLenum cull_mode = (pipeline.cull_mode == CullModeFront) ? GL_FRONT : GL_BACK;
-		    glCullFace(cull_mode);
-		}
-
-		glDepthFunc(getCompareFunc(pipeline.depth_state.compare_func));
-		glDepthMask(pipeline.depth_state.is_write_enabled);
-
-		uint32_t uniform_offs = 0;
+		new_pipeline.cull_mode = pipeline.cull_mode;
+		new_pipeline.depth_func = getCompareFunc(pipeline.depth_state.compare_func);
+		new_pipeline.depth_mask = pipeline.depth_state.is_write_enabled ? GL_TRUE : GL_FALSE;
 
 		for (size_t ub_index = 0; ub_index < uniform_size; ub_index++)
 		{
@@ -3682,11 +4895,22 @@ namespace kujogfx
 		    auto &uniform_block = uniforms.at(ub_index);
 		    auto stage = uniform_block.stage;
 
+		    // Empty blocks keep the remaining ones at their ub_slot
 		    if (stage == UniformStageInvalid)
 		    {
+			new_pipeline.uniform_blocks.push_back(gl_block);
+			continue;
+		    }
+
+		    if (initUniformBlock(new_pipeline.program, uint32_t(ub_index), uniform_block, gl_block))
+		    {
+			new_pipeline.uniform_blocks.push_back(gl_block);
 			continue;
 		    }
 
+		    // Offsets are relative to the data passed to applyUniforms()
+		    uint32_t uniform_offs = 0;
+
 		    auto glsl_uniforms = uniform_block.glsl_uniforms;
 		    size_t glsl_uniform_size = min<size_t>(16, glsl_uniforms.size());
 
@@ -3724,1205 +4948,3195 @@ namespace kujogfx
 		    new_pipeline.uniform_blocks.push_back(gl_block);
 		}
 
-		pipelines.insert(make_pair(pipeline.getID(), new_pipeline));
-		current_pipeline = new_pipeline;
-	    }
-
-	    void applyPipeline()
-	    {
-		glUseProgram(current_pipeline.program);
+		getSlot(pipelines, handle) = new_pipeline;
+		return true;
 	    }
 
-	    GLenum getTarget(KujoGFXBuffer buffer)
+	    // std140 blocks with a block name are bound to the binding point of their ub_slot
+	    bool initUniformBlock(GLuint program, uint32_t ub_slot, const KujoGFXUniformDesc &uniform_block, GLUniformBlock &gl_block)
 	    {
-		if (buffer.isIndexBuffer())
-		{
-		    return GL_ELEMENT_ARRAY_BUFFER;
-		}
-		else if (buffer.isVertexBuffer())
+		if ((uniform_block.layout != UniformLayoutStd140) || uniform_block.block_name.empty())
 		{
-		    return GL_ARRAY_BUFFER;
+		    return false;
 		}
-		else
+
+		GLuint block_index = glGetUniformBlockIndex(program, uniform_block.block_name.c_str());
+
+		if (block_index == GL_INVALID_INDEX)
 		{
-		    return (GLenum)0;
+		    kujogfxlog::warn() << "Uniform block of " << uniform_block.block_name << " was not found in provided shader.";
+		    return false;
 		}
+
+		GLint block_size = 0;
+		glGetActiveUniformBlockiv(program, block_index, GL_UNIFORM_BLOCK_DATA_SIZE, &block_size);
+		glUniformBlockBinding(program, block_index, ub_slot);
+
+		gl_block.is_ubo = true;
+		gl_block.size = max<uint32_t>(uint32_t(block_size), uint32_t(uniform_block.desc_size));
+		return true;
 	    }
 
-	    GLenum getUsage(KujoGFXBuffer)
+	    // The state setters only issue calls for values that differ
+	    // from the ones left behind by the previous pipeline
+	    void applyPipeline()
 	    {
-		return GL_STATIC_DRAW;
+		useProgram(current_pipeline->program);
+		setCullMode(current_pipeline->cull_mode);
+		setDepthFunc(current_pipeline->depth_func);
+		setDepthMask(current_pipeline->depth_mask);
 	    }
 
-	    void createBuffer(KujoGFXBuffer buffer)
+	    void useProgram(GLuint program)
 	    {
-		auto target = getTarget(buffer);
-		auto usage = getUsage(buffer);
-
-		GLuint gl_buffer;
-
-		glGenBuffers(1, &gl_buffer);
-		glBindBuffer(target, gl_buffer);
-		glBufferData(target, buffer.getSize(), NULL, usage);
-
-		auto data = buffer.getData();
-
-		if (data != NULL)
+		if (gl_state.program == program)
 		{
-		    glBufferSubData(target, 0, buffer.getSize(), data);
+		    num_filtered_calls += 1;
+		    return;
 		}
 
-		buffers.insert(make_pair(buffer.getID(), gl_buffer));
+		glUseProgram(program);
+		gl_state.program = program;
 	    }
 
-	    GLuint findBuffer(KujoGFXBuffer buffer)
+	    void bindBuffer(GLenum target, GLuint buffer)
 	    {
-		auto iter = buffers.find(buffer.getID());
+		GLuint *binding = NULL;
 
-		if (iter == buffers.end())
+		switch (target)
 		{
-		    return (GLuint)0;
+		    case GL_ARRAY_BUFFER: binding = &gl_state.array_buffer; break;
+		    case GL_UNIFORM_BUFFER: binding = &gl_state.uniform_buffer; break;
+		    case GL_COPY_WRITE_BUFFER: binding = &gl_state.copy_write_buffer; break;
+		    default: break;
 		}
 
-		return iter->second;
-	    }
-
-	    void applyBindings(KujoGFXBindings bindings)
-	    {
-		for (size_t attr = 0; attr < gl_max_vertex_attribs; attr++)
+		if ((binding != NULL) && (*binding == buffer))
 		{
-		    auto &attrib = current_pipeline.attribs[attr];
-
-		    bool is_enable_attrib = false;
-
-		    if (attrib.vb_index >= 0)
-		    {
-			auto &buffer = bindings.vertex_buffers.at(attrib.vb_index);
-
-			GLuint vert_buffer = findBuffer(buffer);
-
-			if (glIsBuffer(vert_buffer))
-			{
-			    is_enable_attrib = true;
-			}
-		    }
-
-		    if (is_enable_attrib)
-		    {
-			uint32_t buffer_offset = bindings.vertex_buffer_offsets.at(attrib.vb_index);
-			void *offset = reinterpret_cast<void*>(attrib.offset + buffer_offset);
-			glVertexAttribPointer(attr, attrib.size, attrib.type, GL_FALSE, attrib.stride, offset);
-			glEnableVertexAttribArray(attr);
-		    }
-		    else
-		    {
-			glDisableVertexAttribArray(attr);
-		    }
+		    num_filtered_calls += 1;
+		    return;
 		}
 
-		index_buffer_offset = bindings.index_buffer_offset;
-
-		GLuint index_buffer = findBuffer(bindings.index_buffer);
+		glBindBuffer(target, buffer);
 
-		if (glIsBuffer(index_buffer))
+		if (binding != NULL)
 		{
-		    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+		    *binding = buffer;
 		}
 	    }
 
-	    void applyUniforms(int ub_slot, KujoGFXData data)
+	    // glBindBufferRange() also changes the generic binding point
+	    void bindUniformRange(GLuint slot, GLuint buffer, GLintptr offset, GLsizeiptr size)
 	    {
-		assert((ub_slot >= 0) && (ub_slot < current_pipeline.uniform_blocks.size()));
+		auto &range = gl_state.uniform_ranges.at(slot);
 
-		auto &ub_block = current_pipeline.uniform_blocks.at(ub_slot);
-
-		for (size_t i = 0; i < ub_block.uniforms.size(); i++)
+		if ((range.buffer == buffer) && (range.offset == offset) && (range.size == size))
 		{
-		    auto &uniform = ub_block.uniforms.at(i);
-		    assert(uniform.type != UniformTypeInvalid);
+		    num_filtered_calls += 1;
+		    return;
+		}
 
-		    if (uniform.gl_loc == -1)
+		glBindBufferRange(GL_UNIFORM_BUFFER, slot, buffer, offset, size);
+		range.buffer = buffer;
+		range.offset = offset;
+		range.size = size;
+		gl_state.uniform_buffer = buffer;
+	    }
+
+	    // Deleting a buffer resets every binding point it was bound to,
+	    // and the name may be handed out again for a different buffer
+	    void forgetBuffer(GLuint buffer)
+	    {
+		for (auto binding : {&gl_state.array_buffer, &gl_state.uniform_buffer, &gl_state.copy_write_buffer})
+		{
+		    if (*binding == buffer)
 		    {
-			continue;
+			*binding = 0;
 		    }
+		}
 
-		    uint8_t *data_ptr = reinterpret_cast<uint8_t*>(data.getData());
-
-		    float *ptr_float = reinterpret_cast<float*>(data_ptr + uniform.offset);
-
-		    switch (uniform.type)
+		for (auto &range : gl_state.uniform_ranges)
+		{
+		    if (range.buffer == buffer)
 		    {
-			case UniformTypeInvalid: break;
-			case UniformTypeFloat4:
-			{
-			    glUniform4fv(uniform.gl_loc, uniform.count, ptr_float);
-			}
-			break;
-			default:
-			{
-			    kujogfxlog::fatal() << "Unimplemented uniform type of " << dec << int(uniform.type);
-			}
-			break;
+			range = GLUniformRange();
 		    }
 		}
 	    }
 
-	    bool compileShader(GLuint &shader, GLenum shader_type, string source, string &log_str)
+	    void bindVertexArray(GLuint vao)
 	    {
-		auto c_str = source.c_str();
+		if (gl_state.vertex_array == vao)
+		{
+		    num_filtered_calls += 1;
+		    return;
+		}
 
-		shader = glCreateShader(shader_type);
-		glShaderSource(shader, 1, &c_str, NULL);
-		glCompileShader(shader);
+		glBindVertexArray(vao);
+		gl_state.vertex_array = vao;
+	    }
 
-		int success = 0;
-		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	    uint64_t getVertexArrayHash(const GLVertexArrayKey &key)
+	    {
+		// 64-bit FNV-1a
+		uint64_t hash = 14695981039346656037ULL;
 
-		if (!success)
+		auto hash_field = [&](uint32_t field) -> void
 		{
-		    GLint log_length;
-		    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &log_length);
-
-		    vector<char> str_data(log_length, 0);
-
-		    glGetShaderInfoLog(shader, log_length, NULL, str_data.data());
+		    hash ^= field;
+		    hash *= 1099511628211ULL;
+		};
 
-		    log_str.resize(log_length, 0);
-		    copy(str_data.begin(), str_data.end(), log_str.begin());
+		hash_field(key.pipeline_id);
 
-		    return false;
+		for (size_t slot = 0; slot < max_vertex_buffer_bind_slots; slot++)
+		{
+		    hash_field(key.vertex_buffers[slot]);
+		    hash_field(key.vertex_buffer_offsets[slot]);
 		}
 
-		return true;
+		return hash;
 	    }
 
-	    void draw(KujoGFXDraw draw_cmd)
+	    // Returns the vertex array for the current pipeline and the buffers in the key,
+	    // specifying a new one if it is not cached yet
+	    GLVertexArray &getVertexArray(const GLVertexArrayKey &key)
 	    {
-		int base_element = draw_cmd.base_element;
-		int num_elements = draw_cmd.num_elements;
-		int num_instances = draw_cmd.num_instances;
+		uint64_t hash = getVertexArrayHash(key);
+		auto iter = vertex_array_map.find(hash);
 
-		bool use_instanced_draw = (num_instances > 1);
-
-		if (current_pipeline.index_type != 0)
+		if (iter != vertex_array_map.end())
 		{
-		    const int i_size = (current_pipeline.index_type == GL_UNSIGNED_SHORT) ? 2 : 4;
-		    const void* indices = reinterpret_cast<const void*>((base_element * i_size) + index_buffer_offset);
-		    if (use_instanced_draw)
+		    if (iter->second->key == key)
 		    {
-			glDrawElementsInstanced(current_pipeline.primitive_type, num_elements, current_pipeline.index_type, indices, num_instances);
-		    }
-		    else
-		    {
-			glDrawElements(current_pipeline.primitive_type, num_elements, current_pipeline.index_type, indices);
+			vertex_arrays.splice(vertex_arrays.begin(), vertex_arrays, iter->second);
+			return vertex_arrays.front();
 		    }
+
+		    // Hash collision, so the old entry makes room for the new one
+		    releaseVertexArray(iter->second);
 		}
-		else
+
+		if (vertex_arrays.size() >= max_vertex_arrays)
 		{
-		    if (use_instanced_draw)
+		    releaseVertexArray(prev(vertex_arrays.end()));
+		}
+
+		GLVertexArray vertex_array;
+		vertex_array.key = key;
+		vertex_array.hash = hash;
+		glGenVertexArrays(1, &vertex_array.vao);
+		bindVertexArray(vertex_array.vao);
+
+		for (size_t attr = 0; attr < gl_max_vertex_attribs; attr++)
+		{
+		    auto &attrib = current_pipeline->attribs[attr];
+
+		    if (attrib.vb_index < 0)
 		    {
-			glDrawArraysInstanced(current_pipeline.primitive_type, base_element, num_elements, num_instances);
+			continue;
 		    }
-		    else
+
+		    KujoGFXBufferHandle vert_handle;
+		    vert_handle.id = key.vertex_buffers.at(attrib.vb_index);
+		    GLuint vert_buffer = findBuffer(vert_handle);
+
+		    if (vert_buffer == 0)
 		    {
-			glDrawArrays(current_pipeline.primitive_type, base_element, num_elements);
+			continue;
 		    }
+
+		    uint32_t buffer_offset = key.vertex_buffer_offsets.at(attrib.vb_index);
+		    void *offset = reinterpret_cast<void*>(uintptr_t(attrib.offset + buffer_offset));
+		    bindBuffer(GL_ARRAY_BUFFER, vert_buffer);
+		    glVertexAttribPointer(GLuint(attr), attrib.size, attrib.type, GL_FALSE, attrib.stride, offset);
+		    glEnableVertexAttribArray(GLuint(attr));
 		}
+
+		vertex_arrays.push_front(vertex_array);
+		vertex_array_map[hash] = vertex_arrays.begin();
+		return vertex_arrays.front();
 	    }
 
-	    void commitFrame()
+	    void releaseVertexArray(list<GLVertexArray>::iterator iter)
 	    {
-		#if defined(KUJOGFX_PLATFORM_WINDOWS) && !defined(KUJOGFX_USE_GLES)
-		SwapBuffers(m_hdc);
-		#elif defined(KUJOGFX_PLATFORM_EMSCRIPTEN)
-		#else
-		eglSwapBuffers(m_display, m_surface);
-		#endif
+		if (gl_state.vertex_array == iter->vao)
+		{
+		    bindVertexArray(gl_vao);
+		}
+
+		glDeleteVertexArrays(1, &iter->vao);
+		vertex_array_map.erase(iter->hash);
+		vertex_arrays.erase(iter);
 	    }
 
-	    void printErrors()
+	    template<typename Pred>
+	    void releaseVertexArraysIf(Pred pred)
 	    {
-		GLenum err;
-
-		while (true)
+		for (auto iter = vertex_arrays.begin(); iter != vertex_arrays.end();)
 		{
-		    err = glGetError();
+		    auto next_iter = next(iter);
 
-		    if (err == GL_NO_ERROR)
+		    if (pred(iter->key))
 		    {
-			break;
+			releaseVertexArray(iter);
 		    }
 
-		    kujogfxlog::error() << "OpenGL error code of " << hex << int(err) << " detected" << endl;
+		    iter = next_iter;
 		}
 	    }
-    };
 
-    #if !defined(KUJOGFX_PLATFORM_EMSCRIPTEN)
-    class KujoGFX_Vulkan : public KujoGFXBackend
-    {
-	struct VulkanMemory
-	{
-	    VkDeviceMemory memory = VK_NULL_HANDLE;
-	    uint32_t offset = 0;
-	};
+	    void setCullMode(KujoGFXCullMode cull_mode)
+	    {
+		bool is_cull_enabled = (cull_mode != CullModeNone);
 
-	struct VulkanBuffer
-	{
-	    VkBuffer buffer = VK_NULL_HANDLE;
-	    VulkanMemory memory;
-	};
+		if (gl_state.is_cull_enabled == is_cull_enabled)
+		{
+		    num_filtered_calls += 1;
+		}
+		else
+		{
+		    if (is_cull_enabled)
+		    {
+			glEnable(GL_CULL_FACE);
+		    }
+		    else
+		    {
+			glDisable(GL_CULL_FACE);
+		    }
 
-	struct VulkanPipeline
-	{
-	    VkPipeline pipeline = VK_NULL_HANDLE;
-	    VkPipelineLayout layout = VK_NULL_HANDLE;
-	    VkIndexType index_type = VK_INDEX_TYPE_UINT16;
-	    bool is_index_active = false;
-	};
+		    gl_state.is_cull_enabled = is_cull_enabled;
+		}
 
-	public:
-	    KujoGFX_Vulkan()
-	    {
-		api_version = getAPIVersion();
-	    }
+		if (!is_cull_enabled)
+		{
+		    return;
+		}
 
-	    ~KujoGFX_Vulkan()
-	    {
+		GLenum cull_face = (cull_mode == CullModeFront) ? GL_FRONT : GL_BACK;
+
+		if (gl_state.cull_face == cull_face)
+		{
+		    num_filtered_calls += 1;
+		    return;
+		}
 
+		glCullFace(cull_face);
+		gl_state.cull_face = cull_face;
 	    }
 
-	    bool initBackend(void *window_handle, void *display_handle)
+	    void setDepthFunc(GLenum depth_func)
 	    {
-		if (!initVulkan(window_handle, display_handle))
+		if (gl_state.depth_func == depth_func)
 		{
-		    return false;
+		    num_filtered_calls += 1;
+		    return;
 		}
 
-		return true;
+		glDepthFunc(depth_func);
+		gl_state.depth_func = depth_func;
 	    }
 
-	    void shutdownBackend()
+	    void setDepthMask(GLboolean depth_mask)
 	    {
-		shutdownVulkan();
-	    }
+		if (gl_state.depth_mask == depth_mask)
+		{
+		    num_filtered_calls += 1;
+		    return;
+		}
 
-	    void *getContextHandle()
-	    {
-		return NULL;
+		glDepthMask(depth_mask);
+		gl_state.depth_mask = depth_mask;
 	    }
 
-	private:
-	    void *win_handle = NULL;
-	    void *disp_handle = NULL;
-	    uint32_t window_width = 0;
-	    uint32_t window_height = 0;
-
-	    static constexpr int max_frames_in_flight = 2;
-
-	    VkInstance instance = VK_NULL_HANDLE;
-	    VkSurfaceKHR surface = VK_NULL_HANDLE;
-	    VkPhysicalDevice physical_device = VK_NULL_HANDLE;
-	    VkDevice device = VK_NULL_HANDLE;
-	    VkQueue graphics_queue = VK_NULL_HANDLE;
-	    VkQueue present_queue = VK_NULL_HANDLE;
-	    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
-	    vector<VkImage> swapchain_images;
-	    vector<VkImageView> swapchain_image_views;
-	    VkImage depth_image;
-	    VkImageView depth_image_view;
-	    VulkanMemory depth_image_memory;
-	    vector<VkFramebuffer> swapchain_framebuffers;
-	    VkFormat swapchain_image_format;
-	    VkExtent2D swapchain_extent;
-	    VkRenderPass render_pass = VK_NULL_HANDLE;
-	    VkCommandPool command_pool = VK_NULL_HANDLE;
-	    vector<VkCommandBuffer> command_buffers;
-	    VkCommandBuffer command_buffer;
-	    vector<VkSemaphore> image_available_semaphores;
-	    vector<VkSemaphore> render_finished_semaphores;
-	    vector<VkFence> in_flight_fences;
-	    uint32_t graphics_queue_family = 0;
-	    uint32_t present_queue_family = 0;
-	    uint32_t api_version = 0;
-	    uint32_t current_frame = 0;
-	    uint32_t image_index = 0;
-
-	    unordered_map<uint32_t, VulkanPipeline> pipelines;
-	    VulkanPipeline current_pipeline;
-
-	    unordered_map<uint32_t, VulkanBuffer> buffers;
-
-	    KujoGFXPass current_pass;
-
-	    bool has_khr_maintenance_1 = false;
-
-	    uint32_t getAPIVersion()
+	    void setViewport(GLint x, GLint y, GLint width, GLint height)
 	    {
-		auto fn_vkEnumerateInstanceVersion = PFN_vkEnumerateInstanceVersion(vkGetInstanceProcAddr(NULL, "vkEnumerateInstanceVersion"));
+		array<GLint, 4> viewport = {x, y, width, height};
 
-		if (fn_vkEnumerateInstanceVersion != NULL)
+		if (gl_state.viewport == viewport)
 		{
-		    uint32_t instance_version = 0;
-		    fn_vkEnumerateInstanceVersion(&instance_version);
-
-		    if (instance_version >= VK_API_VERSION_1_1)
-		    {
-			kujogfxlog::debug() << "Using Vulkan 1.1";
-			return VK_API_VERSION_1_1;
-		    }
+		    num_filtered_calls += 1;
+		    return;
 		}
 
-		kujogfxlog::debug() << "Falling back to Vulkan 1.0";
-		return VK_API_VERSION_1_0;
+		glViewport(x, y, width, height);
+		gl_state.viewport = viewport;
 	    }
 
-	    VkBool32 convertBoolVk(bool value)
+	    void setScissor(GLint x, GLint y, GLint width, GLint height)
 	    {
-		if (value)
+		array<GLint, 4> scissor = {x, y, width, height};
+
+		if (gl_state.scissor == scissor)
 		{
-		    return VK_TRUE;
+		    num_filtered_calls += 1;
+		    return;
 		}
 
-		return VK_FALSE;
+		glScissor(x, y, width, height);
+		gl_state.scissor = scissor;
 	    }
 
-	    bool assertVk(bool cond, bool is_shutdown = true)
+	    GLenum getTarget(const KujoGFXBuffer &buffer)
 	    {
-		if (cond)
+		if (buffer.isIndexBuffer())
 		{
-		    return false;
+		    return GL_ELEMENT_ARRAY_BUFFER;
 		}
-
-		if (is_shutdown)
+		else if (buffer.isVertexBuffer())
 		{
-		    shutdownVulkan();
+		    return GL_ARRAY_BUFFER;
+		}
+		else
+		{
+		    return (GLenum)0;
 		}
-
-		return true;
 	    }
 
-	    bool hasFailed(VkResult err, bool is_shutdown = true)
+	    GLenum getUsage(const KujoGFXBuffer &buffer)
 	    {
-		return assertVk((err == VK_SUCCESS), is_shutdown);
-	    }
+		switch (buffer.getUsage())
+		{
+		    case BufferUsageDynamic: return GL_DYNAMIC_DRAW; break;
+		    case BufferUsageStream: return GL_STREAM_DRAW; break;
+		    default: return GL_STATIC_DRAW; break;
+		}
+	    }
 
-	    bool initVulkan(void *window_handle, void *display_handle)
+	    void createBuffer(KujoGFXBufferHandle handle, const KujoGFXBuffer &buffer)
 	    {
-		win_handle = window_handle;
-		disp_handle = display_handle;
+		auto target = getTarget(buffer);
+		auto usage = getUsage(buffer);
 
-		if (assertVk(createInstance()))
-		{
-		    return false;
-		}
+		GLBuffer gl_buffer;
+		gl_buffer.usage = usage;
+		gl_buffer.size = buffer.getBufferSize();
 
-		if (assertVk(createSurface()))
+		// Neither GL 3.3 nor GLES 3.0 can draw from a buffer,
+		// so drawIndirect() reads the arguments on the CPU
+		if (buffer.isIndirectBuffer())
 		{
-		    return false;
-		}
+		    gl_buffer.indirect_data.resize(gl_buffer.size, 0);
 
-		if (assertVk(pickPhysicalDevice()))
-		{
-		    return false;
-		}
+		    if (buffer.getData() != NULL)
+		    {
+			memcpy(gl_buffer.indirect_data.data(), buffer.getData(), buffer.getSize());
+		    }
 
-		if (assertVk(checkSwapchainSupport()))
-		{
-		    return false;
+		    getSlot(buffers, handle) = gl_buffer;
+		    return;
 		}
 
-		if (assertVk(findQueueFamilies()))
+		if (target == GL_ELEMENT_ARRAY_BUFFER)
 		{
-		    return false;
+		    bindVertexArray(gl_vao);
 		}
 
-		if (assertVk(createLogicalDevice()))
-		{
-		    return false;
-		}
+		glGenBuffers(1, &gl_buffer.buffer);
+		bindBuffer(target, gl_buffer.buffer);
+		glBufferData(target, gl_buffer.size, NULL, usage);
 
-		if (assertVk(createSwapchain()))
-		{
-		    return false;
-		}
+		auto data = buffer.getData();
 
-		if (assertVk(createCommandQueues()))
+		if (data != NULL)
 		{
-		    return false;
+		    glBufferSubData(target, 0, buffer.getSize(), data);
 		}
 
-		if (assertVk(createSyncObjects()))
+		getSlot(buffers, handle) = gl_buffer;
+	    }
+
+	    GLuint findBuffer(KujoGFXBufferHandle handle)
+	    {
+		if (!handle.isValid() || (handle.getIndex() >= buffers.size()))
 		{
-		    return false;
+		    return (GLuint)0;
 		}
 
-		return true;
+		return buffers[handle.getIndex()].buffer;
 	    }
 
-	    void shutdownVulkan()
+	    // The driver keeps deleted objects alive until pending commands
+	    // that reference them have completed, so deletion can happen right away
+	    void destroyBuffer(KujoGFXBufferHandle handle)
 	    {
-		vkDeviceWaitIdle(device);
+		GLuint buffer = findBuffer(handle);
 
-		for (auto &semaphore : image_available_semaphores)
+		if (buffer != 0)
 		{
-		    if (semaphore != VK_NULL_HANDLE)
+		    releaseVertexArraysIf([&](const GLVertexArrayKey &key) -> bool
 		    {
-			vkDestroySemaphore(device, semaphore, NULL);
-			semaphore = VK_NULL_HANDLE;
-		    }
-		}
+			return (find(key.vertex_buffers.begin(), key.vertex_buffers.end(), handle.id) != key.vertex_buffers.end());
+		    });
 
-		for (auto &semaphore : render_finished_semaphores)
-		{
-		    if (semaphore != VK_NULL_HANDLE)
+		    // Vertex arrays still holding the index buffer rebind on next use
+		    for (auto &vertex_array : vertex_arrays)
 		    {
-			vkDestroySemaphore(device, semaphore, NULL);
-			semaphore = VK_NULL_HANDLE;
+			if (vertex_array.element_buffer_id == handle.id)
+			{
+			    vertex_array.element_buffer_id = 0;
+			}
 		    }
-		}
 
-		for (auto &fence : in_flight_fences)
+		    forgetBuffer(buffer);
+		    glDeleteBuffers(1, &buffer);
+		    buffers[handle.getIndex()] = GLBuffer();
+		}
+		else if (findIndirectBuffer(handle) != NULL)
 		{
-		    if (fence != VK_NULL_HANDLE)
-		    {
-			vkDestroyFence(device, fence, NULL);
-			fence = VK_NULL_HANDLE;
-		    }
+		    buffers[handle.getIndex()] = GLBuffer();
 		}
+	    }
 
-		if (command_pool != VK_NULL_HANDLE)
+	    GLBuffer *findIndirectBuffer(KujoGFXBufferHandle handle)
+	    {
+		if (!handle.isValid() || (handle.getIndex() >= buffers.size()))
 		{
-		    vkDestroyCommandPool(device, command_pool, NULL);
-		    command_pool = VK_NULL_HANDLE;
+		    return NULL;
 		}
 
-		for (auto &iter : buffers)
-		{
-		    auto buffer = iter.second;
+		auto &gl_buffer = buffers[handle.getIndex()];
+		return gl_buffer.indirect_data.empty() ? NULL : &gl_buffer;
+	    }
 
-		    if (buffer.buffer != VK_NULL_HANDLE)
-		    {
-			vkDestroyBuffer(device, buffer.buffer, NULL);
-			buffer.buffer = VK_NULL_HANDLE;
-		    }
+	    void updateBuffer(KujoGFXBufferHandle handle, const KujoGFXData &data)
+	    {
+		writeBuffer(handle, 0, data, true);
+	    }
 
-		    if (buffer.memory.memory != VK_NULL_HANDLE)
-		    {
-			vkFreeMemory(device, buffer.memory.memory, NULL);
-			buffer.memory.memory = VK_NULL_HANDLE;
-		    }
-		}
+	    void appendBuffer(KujoGFXBufferHandle handle, uint32_t offset, const KujoGFXData &data)
+	    {
+		writeBuffer(handle, offset, data, (offset == 0));
+	    }
 
-		buffers.clear();
+	    // Orphaning the buffer makes the driver hand out fresh storage instead of
+	    // waiting for draws that still read from the old one. Writes after that
+	    // never overlap within a frame, so they can skip synchronization entirely.
+	    // GL_COPY_WRITE_BUFFER is used so that the vertex array state is left untouched,
+	    // and it stays bound afterwards since nothing else reads from it
+	    void writeBuffer(KujoGFXBufferHandle handle, uint32_t offset, const KujoGFXData &data, bool is_orphan)
+	    {
+		auto indirect_buffer = findIndirectBuffer(handle);
 
-		for (auto &iter : pipelines)
+		if (indirect_buffer != NULL)
 		{
-		    auto pipeline = iter.second;
+		    memcpy((indirect_buffer->indirect_data.data() + offset), data.getData(), data.getSize());
+		    return;
+		}
 
-		    if (pipeline.pipeline != VK_NULL_HANDLE)
-		    {
-			vkDestroyPipeline(device, pipeline.pipeline, NULL);
-			pipeline.pipeline = VK_NULL_HANDLE;
-		    }
+		GLuint buffer = findBuffer(handle);
 
-		    if (pipeline.layout != VK_NULL_HANDLE)
-		    {
-			vkDestroyPipelineLayout(device, pipeline.layout, NULL);
-			pipeline.layout = VK_NULL_HANDLE;
-		    }
+		if ((buffer == 0) || (data.getSize() == 0))
+		{
+		    return;
 		}
 
-		pipelines.clear();
-
-		cleanupSwapchain();
+		auto &gl_buffer = buffers[handle.getIndex()];
+		bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
 
-		if (device != VK_NULL_HANDLE)
+		if (is_orphan)
 		{
-		    vkDestroyDevice(device, NULL);
-		    device = VK_NULL_HANDLE;
+		    glBufferData(GL_COPY_WRITE_BUFFER, gl_buffer.size, NULL, gl_buffer.usage);
 		}
 
-		if (surface != VK_NULL_HANDLE)
+		#if defined(KUJOGFX_PLATFORM_EMSCRIPTEN)
+		// WebGL has no buffer mapping
+		glBufferSubData(GL_COPY_WRITE_BUFFER, offset, data.getSize(), data.getData());
+		#else
+		GLbitfield access = (GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		void *mem_data = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, data.getSize(), access);
+
+		if (mem_data != NULL)
 		{
-		    vkDestroySurfaceKHR(instance, surface, NULL);
-		    surface = VK_NULL_HANDLE;
+		    memcpy(mem_data, data.getData(), data.getSize());
+		    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
 		}
-
-		if (instance != VK_NULL_HANDLE)
+		else
 		{
-		    vkDestroyInstance(instance, NULL);
-		    instance = VK_NULL_HANDLE;
+		    kujogfxlog::error() << "Could not map buffer data!";
 		}
+		#endif
 	    }
 
-	    void cleanupSwapchain()
+	    void destroyPipeline(KujoGFXPipelineHandle handle)
 	    {
-		if (depth_image_view != VK_NULL_HANDLE)
+		if (handle.getIndex() >= pipelines.size())
 		{
-		    vkDestroyImageView(device, depth_image_view, NULL);
-		    depth_image_view = VK_NULL_HANDLE;
+		    return;
 		}
 
-		if (depth_image != VK_NULL_HANDLE)
+		auto &pipeline = pipelines[handle.getIndex()];
+
+		if (current_pipeline == &pipeline)
 		{
-		    vkDestroyImage(device, depth_image, NULL);
-		    depth_image = VK_NULL_HANDLE;
+		    current_pipeline = NULL;
 		}
 
-		if (depth_image_memory.memory != VK_NULL_HANDLE)
+		if (gl_state.program == pipeline.program)
 		{
-		    vkFreeMemory(device, depth_image_memory.memory, NULL);
-		    depth_image_memory.memory = VK_NULL_HANDLE;
+		    gl_state.program = 0;
 		}
 
-		for (auto &image_view : swapchain_image_views)
+		releaseVertexArraysIf([&](const GLVertexArrayKey &key) -> bool
 		{
-		    if (image_view != VK_NULL_HANDLE)
-		    {
-			vkDestroyImageView(device, image_view, NULL);
-			image_view = VK_NULL_HANDLE;
-		    }
-		}
+		    return (key.pipeline_id == handle.id);
+		});
 
-		if (swapchain != VK_NULL_HANDLE)
+		if (glIsProgram(pipeline.program))
 		{
-		    vkDestroySwapchainKHR(device, swapchain, NULL);
-		    swapchain = VK_NULL_HANDLE;
+		    glDeleteProgram(pipeline.program);
 		}
+
+		pipeline = GLPipeline();
 	    }
 
-	    void recreateSwapchain()
+	    void applyBindings(const KujoGFXBindings &bindings)
 	    {
-		vkDeviceWaitIdle(device);
-		cleanupSwapchain();
+		// Only the slots read by the pipeline take part in the key,
+		// so unrelated bindings don't create extra vertex arrays
+		GLVertexArrayKey key;
+		key.pipeline_id = current_pipeline_id;
 
-		if (assertVk(fetchWindowRes()))
+		for (size_t attr = 0; attr < gl_max_vertex_attribs; attr++)
 		{
-		    kujogfxlog::fatal() << "Could not fetch window resolution!";
-		}
+		    int vb_index = current_pipeline->attribs[attr].vb_index;
 
-		if (assertVk(createSwapchain()))
-		{
-		    kujogfxlog::fatal() << "Could not recreate swapchain!";
+		    if (vb_index >= 0)
+		    {
+			key.vertex_buffers[vb_index] = bindings.vertex_buffers.at(vb_index).id;
+			key.vertex_buffer_offsets[vb_index] = bindings.vertex_buffer_offsets.at(vb_index);
+		    }
 		}
+
+		current_vertex_array_key = key;
+		current_index_buffer = bindings.index_buffer;
+		index_buffer_offset = bindings.index_buffer_offset;
+		bindCurrentVertexArray(key);
 	    }
 
-	    uint32_t findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties)
+	    void bindCurrentVertexArray(const GLVertexArrayKey &key)
 	    {
-		VkPhysicalDeviceMemoryProperties mem_properties;
-		vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_properties);
+		auto &vertex_array = getVertexArray(key);
+		bindVertexArray(vertex_array.vao);
 
-		for (uint32_t i = 0; i < mem_properties.memoryTypeCount; i++)
+		GLuint index_buffer = findBuffer(current_index_buffer);
+
+		if (index_buffer != 0)
 		{
-		    if ((type_filter & (1 << i)) && ((mem_properties.memoryTypes[i].propertyFlags & properties) == properties))
+		    if (vertex_array.element_buffer_id == current_index_buffer.id)
+		    {
+			num_filtered_calls += 1;
+		    }
+		    else
 		    {
-			return i;
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+			vertex_array.element_buffer_id = current_index_buffer.id;
 		    }
 		}
-
-		assertVk(false);
-		kujogfxlog::fatal() << "Could not find suitable memory type!";
-		return 0;
 	    }
 
-	    VkResult allocateMemoryVk(VkMemoryRequirements requirements, VkMemoryPropertyFlags properties, VkDeviceMemory &memory, uint32_t &offset)
+	    // GLES 3.0 has no base vertices, so the draw goes through a vertex array
+	    // whose attributes start base_vertex vertices further into their buffers
+	    void drawWithShiftedVertices(const KujoGFXDraw &draw_cmd, const void *indices)
 	    {
-		VkMemoryAllocateInfo alloc_info = {};
-		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		alloc_info.allocationSize = requirements.size;
-		alloc_info.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+		GLVertexArrayKey key = current_vertex_array_key;
+		array<bool, max_vertex_buffer_bind_slots> is_shifted = {};
+
+		for (size_t attr = 0; attr < gl_max_vertex_attribs; attr++)
+		{
+		    auto &attrib = current_pipeline->attribs[attr];
+
+		    if ((attrib.vb_index < 0) || is_shifted.at(attrib.vb_index))
+		    {
+			continue;
+		    }
 
-		VkResult err = vkAllocateMemory(device, &alloc_info, NULL, &memory);
+		    int64_t offset = (int64_t(key.vertex_buffer_offsets.at(attrib.vb_index)) + (int64_t(draw_cmd.base_vertex) * attrib.stride));
 
-		if (hasFailed(err, false))
+		    if ((offset < 0) || (offset > INT32_MAX))
+		    {
+			kujogfxlog::error() << "Could not draw with a base vertex outside of the vertex buffer!";
+			return;
+		    }
+
+		    key.vertex_buffer_offsets.at(attrib.vb_index) = uint32_t(offset);
+		    is_shifted.at(attrib.vb_index) = true;
+		}
+
+		bindCurrentVertexArray(key);
+
+		if (draw_cmd.num_instances > 1)
 		{
-		    return err;
+		    glDrawElementsInstanced(current_pipeline->primitive_type, draw_cmd.num_elements, current_pipeline->index_type, indices, draw_cmd.num_instances);
+		}
+		else
+		{
+		    glDrawElements(current_pipeline->primitive_type, draw_cmd.num_elements, current_pipeline->index_type, indices);
 		}
 
-		offset = 0;
-		return VK_SUCCESS;
+		bindCurrentVertexArray(current_vertex_array_key);
 	    }
 
-	    VkResult createBufferVk(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer &buffer, VkDeviceMemory &buffer_memory, uint32_t &offset)
+	    void applyUniforms(int ub_slot, const KujoGFXData &data)
 	    {
-		VkBufferCreateInfo buffer_info = {};
-		buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		buffer_info.size = size;
-		buffer_info.usage = usage;
-		buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		assert((ub_slot >= 0) && (ub_slot < current_pipeline->uniform_blocks.size()));
 
-		VkResult err = vkCreateBuffer(device, &buffer_info, NULL, &buffer);
+		auto &ub_block = current_pipeline->uniform_blocks.at(ub_slot);
 
-		if (hasFailed(err, false))
+		if (ub_block.is_ubo)
 		{
-		    kujogfxlog::error() << "Could not create buffer!";
-		    return err;
+		    applyUniformBuffer(ub_slot, ub_block, data);
+		    return;
 		}
 
-		VkMemoryRequirements mem_requirements;
-		vkGetBufferMemoryRequirements(device, buffer, &mem_requirements);
-
-		err = allocateMemoryVk(mem_requirements, properties, buffer_memory, offset);
-
-		if (hasFailed(err, false))
+		for (size_t i = 0; i < ub_block.uniforms.size(); i++)
 		{
-		    kujogfxlog::error() << "Could not allocate buffer memory!";
-		    return err;
-		}
+		    auto &uniform = ub_block.uniforms.at(i);
+		    assert(uniform.type != UniformTypeInvalid);
+
+		    if (uniform.gl_loc == -1)
+		    {
+			continue;
+		    }
 
-		vkBindBufferMemory(device, buffer, buffer_memory, 0);
+		    const uint8_t *data_ptr = reinterpret_cast<const uint8_t*>(data.getData());
 
-		return VK_SUCCESS;
-	    }
+		    const float *ptr_float = reinterpret_cast<const float*>(data_ptr + uniform.offset);
 
-	    VkResult createBufferVk(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VulkanBuffer &buffer)
-	    {
-		return createBufferVk(size, usage, properties, buffer.buffer, buffer.memory.memory, buffer.memory.offset);
+		    switch (uniform.type)
+		    {
+			case UniformTypeInvalid: break;
+			case UniformTypeFloat4:
+			{
+			    glUniform4fv(uniform.gl_loc, uniform.count, ptr_float);
+			}
+			break;
+			default:
+			{
+			    kujogfxlog::fatal() << "Unimplemented uniform type of " << dec << int(uniform.type);
+			}
+			break;
+		    }
+		}
 	    }
 
-	    VkResult copyBufferVk(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size)
+	    // A block upload is a single copy into the uniform buffer and a single range bind.
+	    // Like writeBuffer(), the writes never overlap between orphans, so they skip synchronization
+	    void applyUniformBuffer(int ub_slot, const GLUniformBlock &ub_block, const KujoGFXData &data)
 	    {
-		VkCommandBufferAllocateInfo alloc_info = {};
-		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		alloc_info.commandPool = command_pool;
-		alloc_info.commandBufferCount = 1;
-
-		VkCommandBuffer cmd_buffer;
-		VkResult err = vkAllocateCommandBuffers(device, &alloc_info, &cmd_buffer);
-
-		if (hasFailed(err, false))
+		if (data.getSize() > ub_block.size)
 		{
-		    return err;
+		    kujogfxlog::error() << "Could not apply uniforms larger than their block!";
+		    return;
 		}
 
-		VkCommandBufferBeginInfo begin_info = {};
-		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-		vkBeginCommandBuffer(cmd_buffer, &begin_info);
-
-		VkBufferCopy copy_region = {};
-		copy_region.size = size;
-		vkCmdCopyBuffer(cmd_buffer, src_buffer, dst_buffer, 1, &copy_region);
+		uint32_t offset = kujogfxutil::alignU32(uniform_buffer_pos, uniform_alignment);
+		bindBuffer(GL_UNIFORM_BUFFER, uniform_buffer);
 
-		vkEndCommandBuffer(cmd_buffer);
+		if ((uniform_buffer_pos == 0) || ((offset + ub_block.size) > uniform_buffer_size))
+		{
+		    glBufferData(GL_UNIFORM_BUFFER, uniform_buffer_size, NULL, GL_STREAM_DRAW);
+		    offset = 0;
+		}
 
-		VkSubmitInfo submit_info = {};
-		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submit_info.commandBufferCount = 1;
-		submit_info.pCommandBuffers = &cmd_buffer;
+		#if defined(KUJOGFX_PLATFORM_EMSCRIPTEN)
+		glBufferSubData(GL_UNIFORM_BUFFER, offset, data.getSize(), data.getData());
+		#else
+		GLbitfield access = (GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		void *mem_data = glMapBufferRange(GL_UNIFORM_BUFFER, offset, data.getSize(), access);
 
-		vkQueueSubmit(graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-		vkQueueWaitIdle(graphics_queue);
+		if (mem_data != NULL)
+		{
+		    memcpy(mem_data, data.getData(), data.getSize());
+		    glUnmapBuffer(GL_UNIFORM_BUFFER);
+		}
+		else
+		{
+		    kujogfxlog::error() << "Could not map uniform buffer!";
+		}
+		#endif
 
-		vkFreeCommandBuffers(device, command_pool, 1, &cmd_buffer);
-		return VK_SUCCESS;
+		bindUniformRange(GLuint(ub_slot), uniform_buffer, offset, ub_block.size);
+		uniform_buffer_pos = (offset + ub_block.size);
 	    }
 
-	    VkResult copyBufferVk(VulkanBuffer src_buffer, VulkanBuffer dst_buffer, VkDeviceSize size)
+	    bool compileShader(GLuint &shader, GLenum shader_type, string source, string &log_str)
 	    {
-		return copyBufferVk(src_buffer.buffer, dst_buffer.buffer, size);
-	    }
+		auto c_str = source.c_str();
 
-	    VkResult createImageVk(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage &image, VkDeviceMemory &image_memory, uint32_t &image_offset)
-	    {
-		VkImageCreateInfo image_info = {};
-		image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-		image_info.imageType = VK_IMAGE_TYPE_2D;
-		image_info.extent.width = width;
-		image_info.extent.height = height;
-		image_info.extent.depth = 1;
-		image_info.mipLevels = 1;
-		image_info.arrayLayers = 1;
-		image_info.format = format;
-		image_info.tiling = tiling;
-		image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		image_info.usage = usage;
-		image_info.samples = VK_SAMPLE_COUNT_1_BIT;
-		image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		shader = glCreateShader(shader_type);
+		glShaderSource(shader, 1, &c_str, NULL);
+		glCompileShader(shader);
 
-		VkResult err = vkCreateImage(device, &image_info, NULL, &image);
+		int success = 0;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
 
-		if (hasFailed(err, false))
+		if (!success)
 		{
-		    kujogfxlog::error() << "Could not create image!";
-		    return err;
-		}
+		    GLint log_length;
+		    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &log_length);
 
-		VkMemoryRequirements mem_requirements;
-		vkGetImageMemoryRequirements(device, image, &mem_requirements);
+		    vector<char> str_data(log_length, 0);
 
-		err = allocateMemoryVk(mem_requirements, properties, image_memory, image_offset);
+		    glGetShaderInfoLog(shader, log_length, NULL, str_data.data());
 
-		if (hasFailed(err, false))
-		{
-		    kujogfxlog::error() << "Could not allocate image memory!";
-		    return err;
+		    log_str.resize(log_length, 0);
+		    copy(str_data.begin(), str_data.end(), log_str.begin());
+
+		    return false;
 		}
 
-		vkBindImageMemory(device, image, image_memory, image_offset);
-		return VK_SUCCESS;
+		return true;
 	    }
 
-	    VkResult createImageVk(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage &image, VulkanMemory &memory)
+	    // Base instances only offset per-instance attributes in GL,
+	    // and all attributes are per-vertex, so they can be ignored
+	    void draw(const KujoGFXDraw &draw_cmd)
 	    {
-		return createImageVk(width, height, format, tiling, usage, properties, image, memory.memory, memory.offset);
-	    }
+		int base_element = draw_cmd.base_element;
+		int num_elements = draw_cmd.num_elements;
+		int num_instances = draw_cmd.num_instances;
+		int base_vertex = draw_cmd.base_vertex;
 
-	    VkResult createImageViewVk(VkImage image, VkFormat format, VkImageAspectFlags aspect_flags, VkImageView &image_view)
-	    {
-		VkImageViewCreateInfo view_info = {};
-		view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		view_info.image = image;
-		view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		view_info.format = format;
-		view_info.subresourceRange.aspectMask = aspect_flags;
-		view_info.subresourceRange.baseMipLevel = 0;
-		view_info.subresourceRange.levelCount = 1;
-		view_info.subresourceRange.baseArrayLayer = 0;
-		view_info.subresourceRange.layerCount = 1;
+		bool use_instanced_draw = (num_instances > 1);
 
-		VkResult err = vkCreateImageView(device, &view_info, NULL, &image_view);
+		if (current_pipeline->index_type != 0)
+		{
+		    const int i_size = (current_pipeline->index_type == GL_UNSIGNED_SHORT) ? 2 : 4;
+		    const void* indices = reinterpret_cast<const void*>((base_element * i_size) + index_buffer_offset);
 
-		if (hasFailed(err, false))
+		    if (base_vertex != 0)
+		    {
+			#if defined(KUJOGFX_PLATFORM_EMSCRIPTEN) || defined(KUJOGFX_PLATFORM_ANDROID) || defined(KUJOGFX_USE_GLES)
+			drawWithShiftedVertices(draw_cmd, indices);
+			#else
+			if (use_instanced_draw)
+			{
+			    glDrawElementsInstancedBaseVertex(current_pipeline->primitive_type, num_elements, current_pipeline->index_type, indices, num_instances, base_vertex);
+			}
+			else
+			{
+			    glDrawElementsBaseVertex(current_pipeline->primitive_type, num_elements, current_pipeline->index_type, indices, base_vertex);
+			}
+			#endif
+		    }
+		    else if (use_instanced_draw)
+		    {
+			glDrawElementsInstanced(current_pipeline->primitive_type, num_elements, current_pipeline->index_type, indices, num_instances);
+		    }
+		    else
+		    {
+			glDrawElements(current_pipeline->primitive_type, num_elements, current_pipeline->index_type, indices);
+		    }
+		}
+		else
 		{
-		    kujogfxlog::error() << "Could not create image view!";
-		    return err;
+		    if (use_instanced_draw)
+		    {
+			glDrawArraysInstanced(current_pipeline->primitive_type, base_element, num_elements, num_instances);
+		    }
+		    else
+		    {
+			glDrawArrays(current_pipeline->primitive_type, base_element, num_elements);
+		    }
 		}
-
-		return VK_SUCCESS;
 	    }
 
-	    VkAttachmentLoadOp convertLoadOp(KujoGFXLoadOp load_op)
+	    // Desktop GL can issue non-instanced draws in one call
+	    void multiDraw(const KujoGFXDraw *draws, size_t num_draws)
 	    {
-		switch (load_op)
+		bool use_multi_draw = !use_gles;
+
+		for (size_t index = 0; index < num_draws; index++)
 		{
-		    case LoadOpLoad: return VK_ATTACHMENT_LOAD_OP_LOAD; break;
-		    case LoadOpClear: return VK_ATTACHMENT_LOAD_OP_CLEAR; break;
-		    default: return VK_ATTACHMENT_LOAD_OP_DONT_CARE; break;
+		    if (draws[index].num_instances > 1)
+		    {
+			use_multi_draw = false;
+		    }
 		}
-	    }
 
-	    VkAttachmentStoreOp convertStoreOp(KujoGFXStoreOp store_op)
-	    {
-		switch (store_op)
+		if (!use_multi_draw)
 		{
-		    case StoreOpStore: return VK_ATTACHMENT_STORE_OP_STORE; break;
-		    default: return VK_ATTACHMENT_STORE_OP_DONT_CARE; break;
+		    KujoGFXBackend::multiDraw(draws, num_draws);
+		    return;
 		}
-	    }
 
-	    VkClearColorValue convertClearColor(KujoGFXColor color)
-	    {
-		return {{color.red, color.green, color.blue, color.alpha}};
-	    }
+		#if defined(KUJOGFX_PLATFORM_EMSCRIPTEN) || defined(KUJOGFX_PLATFORM_ANDROID) || defined(KUJOGFX_USE_GLES)
+		#else
+		const int i_size = (current_pipeline->index_type == GL_UNSIGNED_SHORT) ? 2 : 4;
+		multi_draw_firsts.clear();
+		multi_draw_counts.clear();
+		multi_draw_indices.clear();
+		multi_draw_base_vertices.clear();
 
-	    bool createRenderPass()
-	    {
-		VkAttachmentDescription color_attachment = {};
-		color_attachment.format = swapchain_image_format;
-		color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		color_attachment.loadOp = convertLoadOp(current_pass.action.color_attach.load_op);
-		color_attachment.storeOp = convertStoreOp(current_pass.action.color_attach.store_op);
-		color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		// Some drivers drop the whole call if it contains empty draws.
+		// Like in draw(), instance counts below 1 still draw once
+		for (size_t index = 0; index < num_draws; index++)
+		{
+		    if (draws[index].num_elements <= 0)
+		    {
+			continue;
+		    }
 
-		VkAttachmentDescription depth_attachment = {};
-		depth_attachment.format = findDepthFormat();
-		depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		depth_attachment.loadOp = convertLoadOp(current_pass.action.depth_attach.load_op);
-		depth_attachment.storeOp = convertStoreOp(current_pass.action.depth_attach.store_op);
-		depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-		depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		    multi_draw_counts.push_back(draws[index].num_elements);
+		    multi_draw_firsts.push_back(draws[index].base_element);
+		    multi_draw_indices.push_back(reinterpret_cast<const void*>((draws[index].base_element * i_size) + index_buffer_offset));
+		    multi_draw_base_vertices.push_back(draws[index].base_vertex);
+		}
 
-		VkAttachmentReference color_attachment_ref = {};
-		color_attachment_ref.attachment = 0;
-		color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		if (multi_draw_counts.empty())
+		{
+		    return;
+		}
 
-		VkAttachmentReference depth_attachment_ref = {};
-		depth_attachment_ref.attachment = 1;
-		depth_attachment_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		if (current_pipeline->index_type != 0)
+		{
+		    glMultiDrawElementsBaseVertex(current_pipeline->primitive_type, multi_draw_counts.data(), current_pipeline->index_type, multi_draw_indices.data(), GLsizei(multi_draw_counts.size()), multi_draw_base_vertices.data());
+		}
+		else
+		{
+		    glMultiDrawArrays(current_pipeline->primitive_type, multi_draw_firsts.data(), multi_draw_counts.data(), GLsizei(multi_draw_counts.size()));
+		}
+		#endif
+	    }
 
-		VkSubpassDescription subpass = {};
-		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-		subpass.colorAttachmentCount = 1;
-		subpass.pColorAttachments = &color_attachment_ref;
-		subpass.pDepthStencilAttachment = &depth_attachment_ref;
+	    // Indirect buffers have no GL object, so the draws are issued one by one
+	    bool drawIndirect(KujoGFXBufferHandle handle, uint32_t offset, uint32_t num_draws, uint32_t stride)
+	    {
+		auto indirect_buffer = findIndirectBuffer(handle);
 
-		VkSubpassDependency dependency = {};
-		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-		dependency.dstSubpass = 0;
-		dependency.srcStageMask = (VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT);
-		dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-		dependency.dstStageMask = (VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT);
-		dependency.dstAccessMask = (VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+		if (indirect_buffer == NULL)
+		{
+		    return false;
+		}
 
-		vector<VkAttachmentDescription> attachments = {
-		    color_attachment,
-		    depth_attachment
-		};
+		const uint8_t *args_data = (indirect_buffer->indirect_data.data() + offset);
 
-		VkRenderPassCreateInfo render_pass_info = {};
-		render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		render_pass_info.attachmentCount = uint32_t(attachments.size());
-		render_pass_info.pAttachments = attachments.data();
-		render_pass_info.subpassCount = 1;
-		render_pass_info.pSubpasses = &subpass;
-		render_pass_info.dependencyCount = 1;
-		render_pass_info.pDependencies = &dependency;
+		for (uint32_t index = 0; index < num_draws; index++, args_data += stride)
+		{
+		    KujoGFXDraw draw_cmd;
 
-		VkResult err = vkCreateRenderPass(device, &render_pass_info, NULL, &render_pass);
+		    if (current_pipeline->index_type != 0)
+		    {
+			KujoGFXDrawIndexedIndirectArgs args;
+			memcpy(&args, args_data, sizeof(args));
+			draw_cmd = KujoGFXDraw(int(args.base_element), int(args.num_elements), int(args.num_instances), args.base_vertex, int(args.base_instance));
+		    }
+		    else
+		    {
+			KujoGFXDrawIndirectArgs args;
+			memcpy(&args, args_data, sizeof(args));
+			draw_cmd = KujoGFXDraw(int(args.base_element), int(args.num_elements), int(args.num_instances), 0, int(args.base_instance));
+		    }
 
-		if (hasFailed(err, false))
-		{
-		    kujogfxlog::error() << "Could not create render pass!";
-		    return false;
+		    if ((draw_cmd.num_elements != 0) && (draw_cmd.num_instances != 0))
+		    {
+			draw(draw_cmd);
+		    }
 		}
 
 		return true;
 	    }
 
-	    bool createFramebuffers()
+	    void fillFrameStats(KujoGFXFrameStats &stats)
 	    {
-		swapchain_framebuffers.resize(swapchain_image_views.size());
+		stats.num_filtered_calls = num_filtered_calls;
+		num_filtered_calls = 0;
+	    }
 
-		for (size_t i = 0; i < swapchain_image_views.size(); i++)
-		{
-		    vector<VkImageView> attachments = {
-			swapchain_image_views[i],
-			depth_image_view
-		    };
+	    // glReadPixels() into a bound pack buffer returns right away, and the copy
+	    // is only mapped once its fence has signaled, usually a frame or two later
+	    bool readPixels(KujoGFXReadCallback callback)
+	    {
+		#if defined(KUJOGFX_PLATFORM_EMSCRIPTEN)
+		// WebGL has no buffer mapping
+		(void)callback;
+		kujogfxlog::error() << "Pixel readback is unimplemented on WebGL";
+		return false;
+		#else
+		GLReadback readback = allocReadback(GLsizeiptr(window_width) * window_height * 4);
+		readback.callback = callback;
+		readback.width = window_width;
+		readback.height = window_height;
 
-		    VkFramebufferCreateInfo framebuffer_info = {};
-		    framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		    framebuffer_info.renderPass = render_pass;
-		    framebuffer_info.attachmentCount = uint32_t(attachments.size());
-		    framebuffer_info.pAttachments = attachments.data();
-		    framebuffer_info.width = swapchain_extent.width;
-		    framebuffer_info.height = swapchain_extent.height;
-		    framebuffer_info.layers = 1;
+		bindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		glReadPixels(0, 0, window_width, window_height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
-		    VkResult err = vkCreateFramebuffer(device, &framebuffer_info, NULL, &swapchain_framebuffers[i]);
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		pending_readbacks.push_back(readback);
+		return true;
+		#endif
+	    }
 
-		    if (hasFailed(err, false))
+	    GLReadback allocReadback(GLsizeiptr size)
+	    {
+		for (auto iter = free_readbacks.begin(); iter != free_readbacks.end(); iter++)
+		{
+		    if (iter->size >= size)
 		    {
-			kujogfxlog::error() << "Could not create framebuffers!";
-			return false;
+			GLReadback readback = *iter;
+			free_readbacks.erase(iter);
+			return readback;
 		    }
 		}
 
-		return true;
+		// The remaining buffers are too small for the current target size
+		destroyReadbacks(free_readbacks);
+
+		GLReadback readback;
+		readback.size = size;
+		glGenBuffers(1, &readback.buffer);
+		bindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		return readback;
 	    }
 
-	    void beginPass(KujoGFXPass pass)
+	    // Delivers finished readbacks in the order they were started
+	    void pollReadbacks()
 	    {
-		current_pass = pass;
-
-		if (assertVk(createRenderPass()))
+		#if !defined(KUJOGFX_PLATFORM_EMSCRIPTEN)
+		while (!pending_readbacks.empty())
 		{
-		    kujogfxlog::fatal() << "Could not start render pass!";
-		    return;
-		}
+		    auto &readback = pending_readbacks.front();
+		    GLenum status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
 
-		vkWaitForFences(device, 1, &in_flight_fences[current_frame], VK_TRUE, UINT64_MAX);
-		vkResetFences(device, 1, &in_flight_fences[current_frame]);
+		    if ((status != GL_ALREADY_SIGNALED) && (status != GL_CONDITION_SATISFIED))
+		    {
+			break;
+		    }
 
-		VkResult err = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, image_available_semaphores[current_frame], VK_NULL_HANDLE, &image_index);
+		    glDeleteSync(readback.fence);
+		    readback.fence = NULL;
 
-		if (err == VK_ERROR_OUT_OF_DATE_KHR)
-		{
-		    recreateSwapchain();
-		    return;
-		}
-		else if ((err != VK_SUCCESS) && (err != VK_SUBOPTIMAL_KHR))
-		{
-		    kujogfxlog::fatal() << "Could not acquire swapchain images!";
-		    return;
+		    GLsizeiptr size = (GLsizeiptr(readback.width) * readback.height * 4);
+		    bindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		    void *mem_data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+
+		    if (mem_data != NULL)
+		    {
+			KujoGFXPixels pixels;
+			pixels.data = reinterpret_cast<const uint8_t*>(mem_data);
+			pixels.width = readback.width;
+			pixels.height = readback.height;
+			pixels.row_pitch = uint32_t(readback.width * 4);
+			pixels.format = PixelFormatRGBA8;
+			pixels.is_bottom_up = true;
+			readback.callback(pixels);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		    }
+		    else
+		    {
+			kujogfxlog::error() << "Could not map readback buffer!";
+		    }
+
+		    bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		    readback.callback = nullptr;
+		    free_readbacks.push_back(readback);
+		    pending_readbacks.pop_front();
 		}
+		#endif
+	    }
 
-		if (assertVk(createFramebuffers()))
+	    template<typename T>
+	    void destroyReadbacks(T &readbacks)
+	    {
+		for (auto &readback : readbacks)
 		{
-		    kujogfxlog::fatal() << "Could not start render pass!";
-		    return;
-		}
+		    if (readback.fence != NULL)
+		    {
+			glDeleteSync(readback.fence);
+		    }
 
-		command_buffer = command_buffers[current_frame];
+		    glDeleteBuffers(1, &readback.buffer);
+		}
 
-		vkResetCommandBuffer(command_buffer, 0);
+		readbacks.clear();
+	    }
 
-		VkCommandBufferBeginInfo begin_info = {};
-		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		begin_info.flags = 0;
-		begin_info.pInheritanceInfo = NULL;
+	    // Readbacks still in flight are dropped without calling back
+	    void destroyReadbacks()
+	    {
+		destroyReadbacks(pending_readbacks);
+		destroyReadbacks(free_readbacks);
+	    }
 
-		err = vkBeginCommandBuffer(command_buffer, &begin_info);
+	    void commitFrame()
+	    {
+		// The next frame starts by orphaning the uniform buffer
+		uniform_buffer_pos = 0;
+		pollReadbacks();
 
-		if (hasFailed(err))
+		if (is_headless)
 		{
-		    kujogfxlog::fatal() << "Could not begin command buffer!";
+		    // Nothing to present, but the frame still has to be submitted
+		    glFlush();
 		    return;
 		}
 
-		array<VkClearValue, 2> clear_values;
-		clear_values[0].color = convertClearColor(current_pass.action.color_attach.color);
-		clear_values[1].depthStencil = {current_pass.action.depth_attach.clear_val, 0};
-
-		VkRenderPassBeginInfo render_pass_info = {};
-		render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		render_pass_info.pNext = NULL;
-		render_pass_info.renderPass = render_pass;
-		render_pass_info.renderArea.offset = {0, 0};
-		render_pass_info.renderArea.extent = swapchain_extent;
-		render_pass_info.framebuffer = swapchain_framebuffers[image_index];
-		render_pass_info.clearValueCount = uint32_t(clear_values.size());
-		render_pass_info.pClearValues = clear_values.data();
-
-		vkCmdBeginRenderPass(command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+		#if defined(KUJOGFX_PLATFORM_WINDOWS) && !defined(KUJOGFX_USE_GLES)
+		SwapBuffers(m_hdc);
+		#elif defined(KUJOGFX_PLATFORM_EMSCRIPTEN)
+		#else
+		eglSwapBuffers(m_display, m_surface);
+		#endif
 	    }
 
-	    void endPass()
+	    void printErrors()
 	    {
-		vkCmdEndRenderPass(command_buffer);
-		VkResult err = vkEndCommandBuffer(command_buffer);
+		GLenum err;
 
-		if (hasFailed(err))
+		while (true)
 		{
-		    kujogfxlog::fatal() << "Could not begin command buffer!";
-		    return;
+		    err = glGetError();
+
+		    if (err == GL_NO_ERROR)
+		    {
+			break;
+		    }
+
+		    kujogfxlog::error() << "OpenGL error code of " << hex << int(err) << " detected" << endl;
 		}
+	    }
+    };
 
-		VkSubmitInfo submit_info = {};
-		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    #if !defined(KUJOGFX_PLATFORM_EMSCRIPTEN)
+    // Block-based device memory allocator
+    // Resources are sub-allocated from large blocks, one list of blocks per memory type,
+    // instead of calling vkAllocateMemory once per resource.
+    // Buffers and images are kept in separate heaps, so that bufferImageGranularity
+    // never has to be taken into account. Allocation sizes are rounded up to size classes,
+    // which makes freed ranges much more likely to fit later allocations
+    class KujoGFXVulkanAllocator
+    {
+	struct FreeRange
+	{
+	    VkDeviceSize offset = 0;
+	    VkDeviceSize size = 0;
+	};
 
-		VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		submit_info.waitSemaphoreCount = 1;
-		submit_info.pWaitSemaphores = &image_available_semaphores[current_frame];
-		submit_info.pWaitDstStageMask = &wait_stage;
-		submit_info.commandBufferCount = 1;
-		submit_info.pCommandBuffers = &command_buffer;
-		submit_info.signalSemaphoreCount = 1;
-		submit_info.pSignalSemaphores = &render_finished_semaphores[current_frame];
+	struct MemoryBlock
+	{
+	    VkDeviceMemory memory = VK_NULL_HANDLE;
+	    VkDeviceSize size = 0;
+	    uint8_t *mapped = NULL;
+	    // Sorted by offset, with adjacent ranges always merged
+	    vector<FreeRange> free_ranges;
+	    size_t num_allocations = 0;
+	    bool is_dedicated = false;
+	};
 
-		err = vkQueueSubmit(graphics_queue, 1, &submit_info, in_flight_fences[current_frame]);
+	public:
+	    struct Allocation
+	    {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		// Host-visible blocks are persistently mapped
+		uint8_t *mapped = NULL;
+		uint32_t heap_index = 0;
+	    };
 
-		if (hasFailed(err))
-		{
-		    kujogfxlog::fatal() << "Could not submit draw commands!";
-		    return;
-		}
+	    static constexpr VkDeviceSize max_block_size = (64 << 20);
+	    static constexpr VkDeviceSize min_size_class = 256;
+	    static constexpr VkDeviceSize large_size_class = (64 << 10);
 
-		VkPresentInfoKHR present_info = {};
-		present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-		present_info.waitSemaphoreCount = 1;
-		present_info.pWaitSemaphores = &render_finished_semaphores[current_frame];
-		present_info.swapchainCount = 1;
-		present_info.pSwapchains = &swapchain;
-		present_info.pImageIndices = &image_index;
-		present_info.pResults = NULL;
+	    KujoGFXVulkanAllocator()
+	    {
 
-		err = vkQueuePresentKHR(present_queue, &present_info);
+	    }
 
-		if ((err == VK_ERROR_OUT_OF_DATE_KHR) || (err == VK_SUBOPTIMAL_KHR))
-		{
-		    recreateSwapchain();
-		}
-		else if (err != VK_SUCCESS)
+	    void init(VkPhysicalDevice physical_device, VkDevice device_handle)
+	    {
+		device = device_handle;
+		vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_properties);
+	    }
+
+	    void shutdown()
+	    {
+		for (auto &heap : heaps)
 		{
-		    kujogfxlog::fatal() << "Could not render swapchain image!";
-		}
+		    for (auto &block : heap)
+		    {
+			freeBlock(block);
+		    }
 
-		current_frame = ((current_frame + 1) % max_frames_in_flight);
+		    heap.clear();
+		}
 	    }
 
-	    VkShaderModule createShaderModule(vector<uint32_t> &code)
+	    VkResult allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool is_image, Allocation &allocation)
 	    {
-		VkShaderModuleCreateInfo create_info = {};
-		create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		create_info.codeSize = (code.size() * sizeof(uint32_t));
-		create_info.pCode = code.data();
-
-		VkShaderModule shader_module;
-		VkResult err = vkCreateShaderModule(device, &create_info, NULL, &shader_module);
+		uint32_t memory_type = 0;
 
-		if (hasFailed(err))
+		if (!findMemoryType(requirements.memoryTypeBits, properties, memory_type))
 		{
-		    kujogfxlog::fatal() << "Could not create shader module!";
+		    kujogfxlog::error() << "Could not find suitable memory type!";
+		    return VK_ERROR_FEATURE_NOT_PRESENT;
 		}
 
-		return shader_module;
-	    }
+		uint32_t heap_index = ((memory_type * 2) + (is_image ? 1 : 0));
+		auto &heap = heaps.at(heap_index);
 
-	    VkPrimitiveTopology getTopology(KujoGFXPrimitiveType type)
-	    {
-		switch (type)
+		VkDeviceSize alignment = max<VkDeviceSize>(requirements.alignment, 1);
+		VkDeviceSize size = getSizeClass(requirements.size);
+		VkDeviceSize block_size = getBlockSize(memory_type);
+
+		allocation.heap_index = heap_index;
+
+		// Large resources get a block of their own
+		if (size > (block_size / 2))
 		{
-		    case PrimitiveTriangles: return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST; break;
-		    default:
+		    MemoryBlock block;
+		    block.is_dedicated = true;
+
+		    VkResult err = allocateBlock(memory_type, requirements.size, block);
+
+		    if (err != VK_SUCCESS)
 		    {
-			assertVk(false);
-			kujogfxlog::fatal() << "Unrecognized primitive type of " << dec << int(type);
-			return (VkPrimitiveTopology)0;
+			return err;
 		    }
-		    break;
+
+		    block.num_allocations = 1;
+		    heap.push_back(block);
+
+		    allocation.memory = block.memory;
+		    allocation.offset = 0;
+		    allocation.size = requirements.size;
+		    allocation.mapped = block.mapped;
+		    return VK_SUCCESS;
 		}
-	    }
 
-	    VkCullModeFlags getCullMode(KujoGFXCullMode mode)
-	    {
-		switch (mode)
+		for (auto &block : heap)
 		{
-		    case CullModeNone: return VK_CULL_MODE_NONE; break;
-		    case CullModeFront: return VK_CULL_MODE_FRONT_BIT; break;
-		    case CullModeBack: return VK_CULL_MODE_BACK_BIT; break;
-		    default:
+		    if (allocateFromBlock(block, size, alignment, allocation))
 		    {
-			assertVk(false);
-			kujogfxlog::fatal() << "Unrecognized cull mode of " << dec << int(mode);
-			return (VkCullModeFlags)0;
+			return VK_SUCCESS;
 		    }
-		    break;
 		}
+
+		MemoryBlock block;
+		VkResult err = allocateBlock(memory_type, block_size, block);
+
+		if (err != VK_SUCCESS)
+		{
+		    return err;
+		}
+
+		FreeRange range;
+		range.size = block_size;
+		block.free_ranges.push_back(range);
+
+		heap.push_back(block);
+		allocateFromBlock(heap.back(), size, alignment, allocation);
+		return VK_SUCCESS;
 	    }
 
-	    VkFormat getFormat(KujoGFXVertexFormat format)
+	    void free(Allocation &allocation)
 	    {
-		switch (format)
+		if (allocation.memory == VK_NULL_HANDLE)
 		{
-		    case VertexFormatFloat2: return VK_FORMAT_R32G32_SFLOAT; break;
-		    case VertexFormatFloat3: return VK_FORMAT_R32G32B32_SFLOAT; break;
-		    case VertexFormatFloat4: return VK_FORMAT_R32G32B32A32_SFLOAT; break;
-		    case VertexFormatInvalid: return VK_FORMAT_UNDEFINED; break;
-		    default:
+		    return;
+		}
+
+		auto &heap = heaps.at(allocation.heap_index);
+
+		auto block_iter = find_if(heap.begin(), heap.end(), [&](const MemoryBlock &block) -> bool {
+		    return (block.memory == allocation.memory);
+		});
+
+		if (block_iter == heap.end())
+		{
+		    kujogfxlog::error() << "Could not find memory block of allocation!";
+		    return;
+		}
+
+		auto &block = *block_iter;
+		block.num_allocations -= 1;
+
+		if (!block.is_dedicated)
+		{
+		    FreeRange range;
+		    range.offset = allocation.offset;
+		    range.size = allocation.size;
+		    insertFreeRange(block, range);
+		}
+
+		// Empty blocks are returned to the driver, except for the last regular
+		// block of a heap, which is kept around to avoid reallocating it over and over
+		if (block.num_allocations == 0)
+		{
+		    size_t num_regular_blocks = count_if(heap.begin(), heap.end(), [](const MemoryBlock &heap_block) -> bool {
+			return !heap_block.is_dedicated;
+		    });
+
+		    if (block.is_dedicated || (num_regular_blocks > 1))
 		    {
-			assertVk(false);
-			kujogfxlog::fatal() << "Unrecognized vertex format of " << dec << int(format);
-			return VK_FORMAT_UNDEFINED;
+			freeBlock(block);
+			heap.erase(block_iter);
 		    }
-		    break;
 		}
+
+		allocation = Allocation();
 	    }
 
-	    VkIndexType getIndexType(KujoGFXIndexType type)
+	    KujoGFXMemoryStats getStats() const
 	    {
-		switch (type)
+		KujoGFXMemoryStats stats;
+
+		for (auto &heap : heaps)
 		{
-		    case IndexTypeNone: return VK_INDEX_TYPE_UINT16; break;
-		    case IndexTypeUint16: return VK_INDEX_TYPE_UINT16; break;
-		    case IndexTypeUint32: return VK_INDEX_TYPE_UINT32; break;
-		    default:
+		    for (auto &block : heap)
 		    {
-			assertVk(false);
-			kujogfxlog::fatal() << "Unrecognized index type of " << dec << int(type);
-			return (VkIndexType)0;
+			stats.num_blocks += 1;
+			stats.num_allocations += block.num_allocations;
+			stats.bytes_reserved += block.size;
+
+			VkDeviceSize bytes_free = 0;
+
+			for (auto &range : block.free_ranges)
+			{
+			    bytes_free += range.size;
+			    stats.num_free_ranges += 1;
+			    stats.largest_free_range = max<size_t>(stats.largest_free_range, range.size);
+			}
+
+			stats.bytes_free += bytes_free;
+			stats.bytes_used += (block.size - bytes_free);
 		    }
-		    break;
 		}
+
+		return stats;
 	    }
 
-	    VkCompareOp getCompareOp(KujoGFXCompareFunc func)
+	private:
+	    VkDevice device = VK_NULL_HANDLE;
+	    VkPhysicalDeviceMemoryProperties mem_properties = {};
+	    array<vector<MemoryBlock>, (VK_MAX_MEMORY_TYPES * 2)> heaps;
+
+	    bool findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties, uint32_t &memory_type)
 	    {
-		switch (func)
+		for (uint32_t i = 0; i < mem_properties.memoryTypeCount; i++)
 		{
-		    case CompareFuncNever: return VK_COMPARE_OP_NEVER; break;
-		    case CompareFuncLessEqual: return VK_COMPARE_OP_LESS_OR_EQUAL; break;
-		    case CompareFuncAlways: return VK_COMPARE_OP_ALWAYS; break;
-		    default:
+		    if ((type_filter & (1 << i)) && ((mem_properties.memoryTypes[i].propertyFlags & properties) == properties))
 		    {
-			assertVk(false);
-			kujogfxlog::fatal() << "Unrecognized compare func of " << dec << int(func);
-			return (VkCompareOp)0;
+			memory_type = i;
+			return true;
 		    }
-		    break;
 		}
+
+		return false;
 	    }
 
-	    vector<KujoGFXUniformDesc> getUniforms(KujoGFXPipeline pipeline)
+	    // Small heaps (i.e. the 256 MiB host-visible device-local heap on some GPUs)
+	    // get smaller blocks, so that a few blocks don't exhaust them
+	    VkDeviceSize getBlockSize(uint32_t memory_type)
 	    {
-		auto uniforms = pipeline.shader.uniforms;
-		size_t uniform_size = min<size_t>(max_uniform_block_bind_slots, uniforms.size());
-		return vector<KujoGFXUniformDesc>(uniforms.begin(), (uniforms.begin() + uniform_size));
+		auto heap_size = mem_properties.memoryHeaps[mem_properties.memoryTypes[memory_type].heapIndex].size;
+		return max<VkDeviceSize>(min<VkDeviceSize>(max_block_size, (heap_size / 8)), large_size_class);
 	    }
 
-	    void setPipeline(KujoGFXPipeline pipeline)
+	    // Powers of two for small allocations, multiples of large_size_class above that
+	    static VkDeviceSize getSizeClass(VkDeviceSize size)
 	    {
-		auto cached_pipeline = pipelines.find(pipeline.getID());
+		if (size > large_size_class)
+		{
+		    return alignUp(size, large_size_class);
+		}
+
+		VkDeviceSize size_class = min_size_class;
 
-		if (assertVk(cached_pipeline != pipelines.end()))
+		while (size_class < size)
 		{
-		    kujogfxlog::fatal() << "Could not find current pipeline!";
-		    return;
+		    size_class <<= 1;
 		}
 
-		current_pipeline = cached_pipeline->second;
+		return size_class;
 	    }
 
-	    void createPipeline(KujoGFXPipeline &pipeline)
+	    static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
 	    {
-		VulkanPipeline new_pipeline;
-		auto shader = pipeline.shader;
-		auto locations = shader.locations.spirv_locations;
-		auto uniforms = getUniforms(pipeline);
-
-		// Create shader modules
-		VkShaderModule vert_module = createShaderModule(shader.vert_code.spv_code);
-		VkShaderModule frag_module = createShaderModule(shader.frag_code.spv_code);
-
-		VkPipelineShaderStageCreateInfo vert_stage_info = {};
-		vert_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		vert_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-		vert_stage_info.module = vert_module;
-		vert_stage_info.pName = shader.vert_code.entry_name.c_str();
-
-		VkPipelineShaderStageCreateInfo frag_stage_info = {};
-		frag_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		frag_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		frag_stage_info.module = frag_module;
-		frag_stage_info.pName = shader.frag_code.entry_name.c_str();
-
-		vector<VkPipelineShaderStageCreateInfo> shader_stages = {
-		    vert_stage_info,
-		    frag_stage_info
-		};
-
-		// Set up dynamic states
-		vector<VkDynamicState> dynamic_states = {
-		    VK_DYNAMIC_STATE_VIEWPORT,
-		    VK_DYNAMIC_STATE_SCISSOR
-		};
+		return (((value + alignment - 1) / alignment) * alignment);
+	    }
 
-		VkPipelineDynamicStateCreateInfo dynamic_state = {};
-		dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-		dynamic_state.dynamicStateCount = uint32_t(dynamic_states.size());
-		dynamic_state.pDynamicStates = dynamic_states.data();
+	    VkResult allocateBlock(uint32_t memory_type, VkDeviceSize size, MemoryBlock &block)
+	    {
+		VkMemoryAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc_info.allocationSize = size;
+		alloc_info.memoryTypeIndex = memory_type;
 
-		// Set up vertex input descriptions
-		vector<VkVertexInputBindingDescription> vertex_bindings;
-		vector<VkVertexInputAttributeDescription> vertex_attribs;
+		VkResult err = vkAllocateMemory(device, &alloc_info, NULL, &block.memory);
 
-		for (size_t i = 0; i < max_vertex_buffer_bind_slots; i++)
+		if (err != VK_SUCCESS)
 		{
-		    if (pipeline.layout.vertex_buffer_layout_active[i])
-		    {
-			VkVertexInputBindingDescription description;
-			description.binding = i;
-			description.stride = pipeline.layout.buffers[i].stride;
-			description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-			vertex_bindings.push_back(description);
-		    }
+		    kujogfxlog::error() << "Could not allocate memory block!";
+		    return err;
 		}
 
-		for (size_t attr_index = 0; attr_index < max_vertex_attribs; attr_index++)
+		block.size = size;
+
+		if (mem_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
 		{
-		    auto attrib = pipeline.layout.attribs[attr_index];
+		    void *mem_data = NULL;
+		    err = vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, &mem_data);
 
-		    if (attrib.format == VertexFormatInvalid)
+		    if (err != VK_SUCCESS)
 		    {
-			break;
+			kujogfxlog::error() << "Could not map memory block!";
+			vkFreeMemory(device, block.memory, NULL);
+			block.memory = VK_NULL_HANDLE;
+			return err;
+		    }
+
+		    block.mapped = reinterpret_cast<uint8_t*>(mem_data);
+		}
+
+		return VK_SUCCESS;
+	    }
+
+	    void freeBlock(MemoryBlock &block)
+	    {
+		if (block.memory != VK_NULL_HANDLE)
+		{
+		    // Freeing the memory implicitly unmaps it
+		    vkFreeMemory(device, block.memory, NULL);
+		    block.memory = VK_NULL_HANDLE;
+		    block.mapped = NULL;
+		}
+	    }
+
+	    // First fit, with any space skipped for alignment kept as a free range
+	    bool allocateFromBlock(MemoryBlock &block, VkDeviceSize size, VkDeviceSize alignment, Allocation &allocation)
+	    {
+		if (block.is_dedicated)
+		{
+		    return false;
+		}
+
+		for (size_t i = 0; i < block.free_ranges.size(); i++)
+		{
+		    auto range = block.free_ranges[i];
+		    VkDeviceSize offset = alignUp(range.offset, alignment);
+		    VkDeviceSize padding = (offset - range.offset);
+
+		    if ((padding + size) > range.size)
+		    {
+			continue;
+		    }
+
+		    FreeRange front_range;
+		    front_range.offset = range.offset;
+		    front_range.size = padding;
+
+		    FreeRange back_range;
+		    back_range.offset = (offset + size);
+		    back_range.size = (range.size - padding - size);
+
+		    block.free_ranges.erase(block.free_ranges.begin() + i);
+
+		    if (back_range.size != 0)
+		    {
+			block.free_ranges.insert((block.free_ranges.begin() + i), back_range);
+		    }
+
+		    if (front_range.size != 0)
+		    {
+			block.free_ranges.insert((block.free_ranges.begin() + i), front_range);
+		    }
+
+		    block.num_allocations += 1;
+
+		    allocation.memory = block.memory;
+		    allocation.offset = offset;
+		    allocation.size = size;
+		    allocation.mapped = (block.mapped != NULL) ? (block.mapped + offset) : NULL;
+		    return true;
+		}
+
+		return false;
+	    }
+
+	    void insertFreeRange(MemoryBlock &block, FreeRange range)
+	    {
+		auto &ranges = block.free_ranges;
+
+		auto iter = lower_bound(ranges.begin(), ranges.end(), range, [](const FreeRange &lhs, const FreeRange &rhs) -> bool {
+		    return (lhs.offset < rhs.offset);
+		});
+
+		iter = ranges.insert(iter, range);
+
+		// Merge with the following range
+		auto next = (iter + 1);
+
+		if ((next != ranges.end()) && ((iter->offset + iter->size) == next->offset))
+		{
+		    iter->size += next->size;
+		    ranges.erase(next);
+		}
+
+		// Merge with the preceding range
+		if (iter != ranges.begin())
+		{
+		    auto prev = (iter - 1);
+
+		    if ((prev->offset + prev->size) == iter->offset)
+		    {
+			prev->size += iter->size;
+			ranges.erase(iter);
+		    }
+		}
+	    }
+    };
+
+    class KujoGFX_Vulkan : public KujoGFXBackend
+    {
+	using VulkanMemory = KujoGFXVulkanAllocator::Allocation;
+
+	struct VulkanBuffer
+	{
+	    VkBuffer buffer = VK_NULL_HANDLE;
+	    VulkanMemory memory;
+	    // Dynamic and stream buffers are persistently mapped and split
+	    // into regions, only one of which is bound at a time
+	    uint8_t *mapped = NULL;
+	    VkDeviceSize region_size = 0;
+	    uint32_t num_regions = 1;
+	    uint32_t active_region = 0;
+	    uint64_t write_frame = UINT64_MAX;
+	};
+
+	struct VulkanPipeline
+	{
+	    VkPipeline pipeline = VK_NULL_HANDLE;
+	    VkPipelineLayout layout = VK_NULL_HANDLE;
+	    VkIndexType index_type = VK_INDEX_TYPE_UINT16;
+	    bool is_index_active = false;
+	    // Every uniform block is a dynamic uniform buffer pointing into the uniform ring,
+	    // so the descriptor set is written once and only its offsets change per draw
+	    VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
+	    VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+	    // Indexed by ub_slot. Dynamic offsets are ordered by binding,
+	    // so each block also stores the index of its offset
+	    uint32_t num_uniform_blocks = 0;
+	    uint32_t num_dynamic_offsets = 0;
+	    array<uint32_t, max_uniform_block_bind_slots> ub_sizes = {};
+	    array<uint32_t, max_uniform_block_bind_slots> ub_offset_indices = {};
+	};
+
+	// Destroyed resources are kept alive until the frame
+	// they were destroyed in has finished executing on the GPU
+	struct VulkanDeferredDelete
+	{
+	    uint64_t frame_number = 0;
+	    VulkanBuffer buffer;
+	    VulkanPipeline pipeline;
+	};
+
+	struct VulkanReadback
+	{
+	    VulkanBuffer buffer;
+	    VkDeviceSize size = 0;
+	    KujoGFXReadCallback callback;
+	    // Frame slot whose fence signals the end of the copy
+	    uint32_t frame_slot = 0;
+	    uint32_t width = 0;
+	    uint32_t height = 0;
+	};
+
+	// Uploads are recorded into batches and submitted together once per frame.
+	// Each batch stages its data in its own chunk of the staging ring,
+	// which is reused once the batch's fence has signaled
+	struct VulkanUploadBatch
+	{
+	    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+	    VkFence fence = VK_NULL_HANDLE;
+	    VkDeviceSize chunk_offset = 0;
+	    VkDeviceSize chunk_used = 0;
+	    // Staging buffers for uploads too large to fit into a chunk
+	    vector<VulkanBuffer> large_buffers;
+	    bool is_recording = false;
+	    bool is_pending = false;
+	};
+
+	public:
+	    KujoGFX_Vulkan()
+	    {
+		api_version = getAPIVersion();
+	    }
+
+	    ~KujoGFX_Vulkan()
+	    {
+
+	    }
+
+	    bool initBackend(void *window_handle, void *display_handle)
+	    {
+		if (!initVulkan(window_handle, display_handle))
+		{
+		    return false;
+		}
+
+		return true;
+	    }
+
+	    void shutdownBackend()
+	    {
+		shutdownVulkan();
+	    }
+
+	    bool setHeadless(int width, int height)
+	    {
+		is_headless = true;
+		window_width = uint32_t(width);
+		window_height = uint32_t(height);
+		return true;
+	    }
+
+	    void *getContextHandle()
+	    {
+		return NULL;
+	    }
+
+	private:
+	    void *win_handle = NULL;
+	    void *disp_handle = NULL;
+	    uint32_t window_width = 0;
+	    uint32_t window_height = 0;
+
+	    // Headless frames render into offscreen images, one per frame slot,
+	    // which stand in for the swapchain images. No surface is created
+	    bool is_headless = false;
+	    vector<VulkanMemory> offscreen_image_memory;
+
+	    // Set through setFrameLatency() before initialization
+	    static constexpr uint32_t max_frame_latency = 4;
+	    uint32_t max_frames_in_flight = 2;
+
+	    // A region stays readable for the rest of the frame it is replaced in,
+	    // and writes for the next frame may be replayed before its fence is waited on,
+	    // so two extra regions are needed for a write to never touch memory in use
+	    uint32_t num_buffer_regions = (max_frames_in_flight + 2);
+
+	    // Batches are submitted at the end of every frame, so with one more batch
+	    // than frames in flight, a batch is free again by the time it's reused
+	    uint32_t num_upload_batches = (max_frames_in_flight + 1);
+	    static constexpr VkDeviceSize upload_chunk_size = (8 << 20);
+
+	    // Size of each frame's region of the uniform ring
+	    static constexpr VkDeviceSize uniform_ring_size = (4 << 20);
+	    static constexpr uint32_t max_descriptor_sets = 1024;
+
+	    VkInstance instance = VK_NULL_HANDLE;
+	    VkSurfaceKHR surface = VK_NULL_HANDLE;
+	    VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+	    VkDevice device = VK_NULL_HANDLE;
+	    VkQueue graphics_queue = VK_NULL_HANDLE;
+	    VkQueue present_queue = VK_NULL_HANDLE;
+	    VkQueue transfer_queue = VK_NULL_HANDLE;
+	    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+	    vector<VkImage> swapchain_images;
+	    vector<VkImageView> swapchain_image_views;
+	    VkImage depth_image;
+	    VkImageView depth_image_view;
+	    VulkanMemory depth_image_memory;
+	    VkFormat depth_image_format = VK_FORMAT_UNDEFINED;
+	    // Layouts the images were left in by the last pass. New images are undefined,
+	    // which passes that load them have to transition away from first
+	    vector<VkImageLayout> swapchain_image_layouts;
+	    VkImageLayout depth_image_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	    // Created once per swapchain image against the compatible render pass,
+	    // which lets them be used with any render pass from the cache
+	    vector<VkFramebuffer> swapchain_framebuffers;
+	    VkFormat swapchain_image_format;
+	    VkExtent2D swapchain_extent;
+	    // Render passes are cached by a hash of their formats and load/store ops,
+	    // and only rebuilt along with the swapchain
+	    unordered_map<uint64_t, VkRenderPass> render_passes;
+	    VkRenderPass render_pass = VK_NULL_HANDLE;
+	    VkRenderPass compatible_render_pass = VK_NULL_HANDLE;
+	    VkCommandPool command_pool = VK_NULL_HANDLE;
+	    vector<VkCommandBuffer> command_buffers;
+	    VkCommandBuffer command_buffer;
+	    vector<VkSemaphore> image_available_semaphores;
+	    vector<VkSemaphore> render_finished_semaphores;
+	    vector<VkFence> in_flight_fences;
+	    uint32_t graphics_queue_family = 0;
+	    uint32_t present_queue_family = 0;
+	    uint32_t transfer_queue_family = 0;
+	    bool has_transfer_queue = false;
+	    uint32_t api_version = 0;
+	    uint32_t current_frame = 0;
+	    uint32_t image_index = 0;
+	    // Number of frames submitted so far
+	    uint64_t frame_number = 0;
+	    // A frame starts recording on its first pass and is submitted by commitFrame()
+	    bool is_frame_active = false;
+	    bool is_pass_active = false;
+	    bool is_resize_pending = false;
+	    // Frame pacing stats of the current frame
+	    uint32_t num_frames_in_flight = 0;
+	    double fence_wait_ms = 0.0;
+
+	    vector<VulkanPipeline> pipelines;
+	    VulkanPipeline *current_pipeline = NULL;
+
+	    vector<VulkanBuffer> buffers;
+
+	    vector<VulkanDeferredDelete> deferred_deletes;
+
+	    VulkanBuffer staging_ring;
+	    VkCommandPool upload_command_pool = VK_NULL_HANDLE;
+	    vector<VulkanUploadBatch> upload_batches;
+	    uint32_t upload_index = 0;
+	    // Signaled by the last upload submission of a frame when uploads
+	    // run on the transfer queue, and waited on by that frame's submission
+	    vector<VkSemaphore> upload_finished_semaphores;
+	    bool has_unsignaled_uploads = false;
+
+	    // Readbacks waiting on their frame, oldest first,
+	    // and the staging buffers of finished ones, kept for reuse
+	    list<VulkanReadback> pending_readbacks;
+	    vector<VulkanReadback> free_readbacks;
+	    bool is_swapchain_readable = false;
+
+	    // Optional device features used by drawIndirect()
+	    bool has_multi_draw_indirect = false;
+	    bool has_draw_indirect_first_instance = false;
+	    // Without drawIndirectFirstInstance, indirect draws are issued from the CPU,
+	    // which needs a copy of the immutable indirect buffers
+	    vector<vector<uint8_t>> indirect_shadows;
+
+	    // Uniform data of a frame is bump-allocated from the ring region of its frame slot,
+	    // which is only reused once the slot's fence has signaled
+	    VulkanBuffer uniform_ring;
+	    VkDeviceSize uniform_ring_pos = 0;
+	    VkDeviceSize uniform_ring_end = 0;
+	    VkDeviceSize uniform_alignment = 256;
+	    VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
+	    array<uint32_t, max_uniform_block_bind_slots> ub_offsets = {};
+
+	    KujoGFXVulkanAllocator allocator;
+
+	    KujoGFXPass current_pass;
+
+	    bool has_khr_maintenance_1 = false;
+
+	    uint32_t getAPIVersion()
+	    {
+		auto fn_vkEnumerateInstanceVersion = PFN_vkEnumerateInstanceVersion(vkGetInstanceProcAddr(NULL, "vkEnumerateInstanceVersion"));
+
+		if (fn_vkEnumerateInstanceVersion != NULL)
+		{
+		    uint32_t instance_version = 0;
+		    fn_vkEnumerateInstanceVersion(&instance_version);
+
+		    if (instance_version >= VK_API_VERSION_1_1)
+		    {
+			kujogfxlog::debug() << "Using Vulkan 1.1";
+			return VK_API_VERSION_1_1;
+		    }
+		}
+
+		kujogfxlog::debug() << "Falling back to Vulkan 1.0";
+		return VK_API_VERSION_1_0;
+	    }
+
+	    VkBool32 convertBoolVk(bool value)
+	    {
+		if (value)
+		{
+		    return VK_TRUE;
+		}
+
+		return VK_FALSE;
+	    }
+
+	    bool assertVk(bool cond, bool is_shutdown = true)
+	    {
+		if (cond)
+		{
+		    return false;
+		}
+
+		if (is_shutdown)
+		{
+		    shutdownVulkan();
+		}
+
+		return true;
+	    }
+
+	    bool hasFailed(VkResult err, bool is_shutdown = true)
+	    {
+		return assertVk((err == VK_SUCCESS), is_shutdown);
+	    }
+
+	    bool initVulkan(void *window_handle, void *display_handle)
+	    {
+		win_handle = window_handle;
+		disp_handle = display_handle;
+
+		if (assertVk(createInstance()))
+		{
+		    return false;
+		}
+
+		if (!is_headless && assertVk(createSurface()))
+		{
+		    return false;
+		}
+
+		if (assertVk(pickPhysicalDevice()))
+		{
+		    return false;
+		}
+
+		if (!is_headless && assertVk(checkSwapchainSupport()))
+		{
+		    return false;
+		}
+
+		if (assertVk(findQueueFamilies()))
+		{
+		    return false;
+		}
+
+		if (assertVk(createLogicalDevice()))
+		{
+		    return false;
+		}
+
+		allocator.init(physical_device, device);
+
+		if (assertVk(createSwapchain()))
+		{
+		    return false;
+		}
+
+		if (assertVk(createCompatibleRenderPass()))
+		{
+		    return false;
+		}
+
+		if (assertVk(createFramebuffers()))
+		{
+		    return false;
+		}
+
+		if (assertVk(createCommandQueues()))
+		{
+		    return false;
+		}
+
+		if (assertVk(createSyncObjects()))
+		{
+		    return false;
+		}
+
+		if (assertVk(createUploadObjects()))
+		{
+		    return false;
+		}
+
+		if (assertVk(createUniformObjects()))
+		{
+		    return false;
+		}
+
+		return true;
+	    }
+
+	    void shutdownVulkan()
+	    {
+		vkDeviceWaitIdle(device);
+
+		for (auto &semaphore : image_available_semaphores)
+		{
+		    if (semaphore != VK_NULL_HANDLE)
+		    {
+			vkDestroySemaphore(device, semaphore, NULL);
+			semaphore = VK_NULL_HANDLE;
+		    }
+		}
+
+		for (auto &semaphore : render_finished_semaphores)
+		{
+		    if (semaphore != VK_NULL_HANDLE)
+		    {
+			vkDestroySemaphore(device, semaphore, NULL);
+			semaphore = VK_NULL_HANDLE;
+		    }
+		}
+
+		for (auto &fence : in_flight_fences)
+		{
+		    if (fence != VK_NULL_HANDLE)
+		    {
+			vkDestroyFence(device, fence, NULL);
+			fence = VK_NULL_HANDLE;
+		    }
+		}
+
+		if (command_pool != VK_NULL_HANDLE)
+		{
+		    vkDestroyCommandPool(device, command_pool, NULL);
+		    command_pool = VK_NULL_HANDLE;
+		}
+
+		destroyUploadObjects();
+		destroyReadbacks();
+		flushDeferredDeletes(true);
+
+		for (auto &buffer : buffers)
+		{
+		    releaseBuffer(buffer);
+		}
+
+		buffers.clear();
+
+		for (auto &pipeline : pipelines)
+		{
+		    releasePipeline(pipeline);
+		}
+
+		pipelines.clear();
+		destroyUniformObjects();
+
+		if (compatible_render_pass != VK_NULL_HANDLE)
+		{
+		    vkDestroyRenderPass(device, compatible_render_pass, NULL);
+		    compatible_render_pass = VK_NULL_HANDLE;
+		}
+
+		cleanupSwapchain();
+		allocator.shutdown();
+
+		if (device != VK_NULL_HANDLE)
+		{
+		    vkDestroyDevice(device, NULL);
+		    device = VK_NULL_HANDLE;
+		}
+
+		if (surface != VK_NULL_HANDLE)
+		{
+		    vkDestroySurfaceKHR(instance, surface, NULL);
+		    surface = VK_NULL_HANDLE;
+		}
+
+		if (instance != VK_NULL_HANDLE)
+		{
+		    vkDestroyInstance(instance, NULL);
+		    instance = VK_NULL_HANDLE;
+		}
+	    }
+
+	    void releaseBuffer(VulkanBuffer &buffer)
+	    {
+		if (buffer.buffer != VK_NULL_HANDLE)
+		{
+		    vkDestroyBuffer(device, buffer.buffer, NULL);
+		    buffer.buffer = VK_NULL_HANDLE;
+		}
+
+		allocator.free(buffer.memory);
+		buffer.mapped = NULL;
+	    }
+
+	    void releasePipeline(VulkanPipeline &pipeline)
+	    {
+		if (pipeline.pipeline != VK_NULL_HANDLE)
+		{
+		    vkDestroyPipeline(device, pipeline.pipeline, NULL);
+		    pipeline.pipeline = VK_NULL_HANDLE;
+		}
+
+		if (pipeline.layout != VK_NULL_HANDLE)
+		{
+		    vkDestroyPipelineLayout(device, pipeline.layout, NULL);
+		    pipeline.layout = VK_NULL_HANDLE;
+		}
+
+		if (pipeline.descriptor_set != VK_NULL_HANDLE)
+		{
+		    vkFreeDescriptorSets(device, descriptor_pool, 1, &pipeline.descriptor_set);
+		    pipeline.descriptor_set = VK_NULL_HANDLE;
+		}
+
+		if (pipeline.set_layout != VK_NULL_HANDLE)
+		{
+		    vkDestroyDescriptorSetLayout(device, pipeline.set_layout, NULL);
+		    pipeline.set_layout = VK_NULL_HANDLE;
+		}
+	    }
+
+	    // Releases every deferred resource whose frame has completed.
+	    // Must be called after waiting on the fence of the current frame
+	    void flushDeferredDeletes(bool is_forced)
+	    {
+		size_t num_pending = 0;
+
+		for (auto &deferred : deferred_deletes)
+		{
+		    if (is_forced || ((deferred.frame_number + max_frames_in_flight) <= frame_number))
+		    {
+			releaseBuffer(deferred.buffer);
+			releasePipeline(deferred.pipeline);
+		    }
+		    else
+		    {
+			deferred_deletes[num_pending++] = deferred;
+		    }
+		}
+
+		deferred_deletes.resize(num_pending);
+	    }
+
+	    void cleanupSwapchain()
+	    {
+		for (auto &framebuffer : swapchain_framebuffers)
+		{
+		    if (framebuffer != VK_NULL_HANDLE)
+		    {
+			vkDestroyFramebuffer(device, framebuffer, NULL);
+			framebuffer = VK_NULL_HANDLE;
+		    }
+		}
+
+		swapchain_framebuffers.clear();
+
+		for (auto &cached : render_passes)
+		{
+		    vkDestroyRenderPass(device, cached.second, NULL);
+		}
+
+		render_passes.clear();
+		render_pass = VK_NULL_HANDLE;
+
+		if (depth_image_view != VK_NULL_HANDLE)
+		{
+		    vkDestroyImageView(device, depth_image_view, NULL);
+		    depth_image_view = VK_NULL_HANDLE;
+		}
+
+		if (depth_image != VK_NULL_HANDLE)
+		{
+		    vkDestroyImage(device, depth_image, NULL);
+		    depth_image = VK_NULL_HANDLE;
+		}
+
+		allocator.free(depth_image_memory);
+
+		for (auto &image_view : swapchain_image_views)
+		{
+		    if (image_view != VK_NULL_HANDLE)
+		    {
+			vkDestroyImageView(device, image_view, NULL);
+			image_view = VK_NULL_HANDLE;
+		    }
+		}
+
+		if (is_headless)
+		{
+		    for (size_t i = 0; i < swapchain_images.size(); i++)
+		    {
+			if (swapchain_images[i] != VK_NULL_HANDLE)
+			{
+			    vkDestroyImage(device, swapchain_images[i], NULL);
+			}
+
+			allocator.free(offscreen_image_memory[i]);
+		    }
+
+		    swapchain_images.clear();
+		    offscreen_image_memory.clear();
+		}
+
+		if (swapchain != VK_NULL_HANDLE)
+		{
+		    vkDestroySwapchainKHR(device, swapchain, NULL);
+		    swapchain = VK_NULL_HANDLE;
+		}
+	    }
+
+	    void recreateSwapchain()
+	    {
+		vkDeviceWaitIdle(device);
+		cleanupSwapchain();
+
+		if (!is_headless && assertVk(fetchWindowRes()))
+		{
+		    kujogfxlog::fatal() << "Could not fetch window resolution!";
+		}
+
+		if (assertVk(createSwapchain()))
+		{
+		    kujogfxlog::fatal() << "Could not recreate swapchain!";
+		}
+
+		if (assertVk(createFramebuffers()))
+		{
+		    kujogfxlog::fatal() << "Could not recreate framebuffers!";
+		}
+	    }
+
+	    VkResult allocateMemoryVk(VkMemoryRequirements requirements, VkMemoryPropertyFlags properties, bool is_image, VulkanMemory &memory)
+	    {
+		VkResult err = allocator.allocate(requirements, properties, is_image, memory);
+
+		if (hasFailed(err, false))
+		{
+		    return err;
+		}
+
+		return VK_SUCCESS;
+	    }
+
+	    VkResult createBufferVk(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer &buffer, VulkanMemory &buffer_memory)
+	    {
+		VkBufferCreateInfo buffer_info = {};
+		buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		buffer_info.size = size;
+		buffer_info.usage = usage;
+		buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		array<uint32_t, 2> queue_families = {{graphics_queue_family, transfer_queue_family}};
+
+		// Buffers written by the transfer queue are shared with it,
+		// instead of transferring ownership after every upload
+		if (has_transfer_queue && (usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT))
+		{
+		    buffer_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		    buffer_info.queueFamilyIndexCount = uint32_t(queue_families.size());
+		    buffer_info.pQueueFamilyIndices = queue_families.data();
+		}
+
+		VkResult err = vkCreateBuffer(device, &buffer_info, NULL, &buffer);
+
+		if (hasFailed(err, false))
+		{
+		    kujogfxlog::error() << "Could not create buffer!";
+		    return err;
+		}
+
+		VkMemoryRequirements mem_requirements;
+		vkGetBufferMemoryRequirements(device, buffer, &mem_requirements);
+
+		err = allocateMemoryVk(mem_requirements, properties, false, buffer_memory);
+
+		if (hasFailed(err, false))
+		{
+		    kujogfxlog::error() << "Could not allocate buffer memory!";
+		    return err;
+		}
+
+		vkBindBufferMemory(device, buffer, buffer_memory.memory, buffer_memory.offset);
+
+		return VK_SUCCESS;
+	    }
+
+	    VkResult createBufferVk(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VulkanBuffer &buffer)
+	    {
+		return createBufferVk(size, usage, properties, buffer.buffer, buffer.memory);
+	    }
+
+	    // Waits for a submitted batch to finish and reclaims its staging memory.
+	    // Batches are reused in order, so this only blocks when uploads outpace the GPU
+	    void completeUploadBatch(VulkanUploadBatch &batch)
+	    {
+		vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+		vkResetFences(device, 1, &batch.fence);
+
+		for (auto &large_buffer : batch.large_buffers)
+		{
+		    releaseBuffer(large_buffer);
+		}
+
+		batch.large_buffers.clear();
+		batch.chunk_used = 0;
+		batch.is_pending = false;
+	    }
+
+	    VulkanUploadBatch &beginUploadBatch()
+	    {
+		auto &batch = upload_batches[upload_index];
+
+		if (batch.is_recording)
+		{
+		    return batch;
+		}
+
+		if (batch.is_pending)
+		{
+		    completeUploadBatch(batch);
+		}
+
+		vkResetCommandBuffer(batch.command_buffer, 0);
+
+		VkCommandBufferBeginInfo begin_info = {};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		VkResult err = vkBeginCommandBuffer(batch.command_buffer, &begin_info);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::fatal() << "Could not begin upload command buffer!";
+		}
+
+		batch.is_recording = true;
+		return batch;
+	    }
+
+	    // Copies the data into the staging ring and records the copy into the current batch.
+	    // Nothing is submitted here, so no CPU wait is needed on the GPU
+	    void uploadBuffer(VkBuffer dst_buffer, const void *data, VkDeviceSize size)
+	    {
+		VulkanUploadBatch *batch = &beginUploadBatch();
+		VkDeviceSize offset = ((batch->chunk_used + 15) & ~VkDeviceSize(15));
+
+		VkBufferCopy copy_region = {};
+		copy_region.size = size;
+
+		VkBuffer src_buffer = staging_ring.buffer;
+
+		if (size > upload_chunk_size)
+		{
+		    VulkanBuffer large_buffer;
+		    VkResult err = createBufferVk(size,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+			large_buffer);
+
+		    if (hasFailed(err))
+		    {
+			kujogfxlog::fatal() << "Could not create staging buffer!";
+			return;
+		    }
+
+		    memcpy(large_buffer.memory.mapped, data, size);
+		    batch->large_buffers.push_back(large_buffer);
+		    src_buffer = large_buffer.buffer;
+		}
+		else
+		{
+		    // Submit early and move on to the next chunk once this one is full
+		    if ((offset + size) > upload_chunk_size)
+		    {
+			submitUploadBatch(VK_NULL_HANDLE);
+			batch = &beginUploadBatch();
+			offset = 0;
+		    }
+
+		    copy_region.srcOffset = (batch->chunk_offset + offset);
+		    memcpy((staging_ring.memory.mapped + copy_region.srcOffset), data, size);
+		    batch->chunk_used = (offset + size);
+		}
+
+		vkCmdCopyBuffer(batch->command_buffer, src_buffer, dst_buffer, 1, &copy_region);
+	    }
+
+	    void submitUploadBatch(VkSemaphore signal_semaphore)
+	    {
+		auto &batch = upload_batches[upload_index];
+
+		if (!has_transfer_queue)
+		{
+		    // Later submissions on the same queue only see the copies through a barrier
+		    VkMemoryBarrier barrier = {};
+		    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		    barrier.dstAccessMask = (VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+
+		    vkCmdPipelineBarrier(batch.command_buffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			(VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT),
+			0, 1, &barrier, 0, NULL, 0, NULL);
+		}
+
+		VkResult err = vkEndCommandBuffer(batch.command_buffer);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::fatal() << "Could not end upload command buffer!";
+		    return;
+		}
+
+		VkSubmitInfo submit_info = {};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &batch.command_buffer;
+
+		if (signal_semaphore != VK_NULL_HANDLE)
+		{
+		    submit_info.signalSemaphoreCount = 1;
+		    submit_info.pSignalSemaphores = &signal_semaphore;
+		}
+
+		err = vkQueueSubmit(transfer_queue, 1, &submit_info, batch.fence);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::fatal() << "Could not submit upload commands!";
+		    return;
+		}
+
+		has_unsignaled_uploads = (signal_semaphore == VK_NULL_HANDLE);
+		batch.is_recording = false;
+		batch.is_pending = true;
+		upload_index = ((upload_index + 1) % num_upload_batches);
+	    }
+
+	    // Submits everything uploaded since the last frame.
+	    // Returns the semaphore the frame's submission has to wait on,
+	    // which is only needed when the uploads run on the transfer queue
+	    VkSemaphore flushUploads()
+	    {
+		bool is_recording = upload_batches[upload_index].is_recording;
+		VkSemaphore signal_semaphore = VK_NULL_HANDLE;
+
+		if (has_transfer_queue && (is_recording || has_unsignaled_uploads))
+		{
+		    signal_semaphore = upload_finished_semaphores[current_frame];
+		}
+
+		if (is_recording)
+		{
+		    submitUploadBatch(signal_semaphore);
+		}
+		else if (signal_semaphore != VK_NULL_HANDLE)
+		{
+		    // Everything was already submitted early, so just signal
+		    // after the earlier submissions on the transfer queue
+		    VkSubmitInfo submit_info = {};
+		    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		    submit_info.signalSemaphoreCount = 1;
+		    submit_info.pSignalSemaphores = &signal_semaphore;
+
+		    VkResult err = vkQueueSubmit(transfer_queue, 1, &submit_info, VK_NULL_HANDLE);
+
+		    if (hasFailed(err))
+		    {
+			kujogfxlog::fatal() << "Could not submit upload commands!";
+		    }
+		}
+
+		has_unsignaled_uploads = false;
+		return signal_semaphore;
+	    }
+
+	    VkResult createImageVk(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage &image, VulkanMemory &image_memory)
+	    {
+		VkImageCreateInfo image_info = {};
+		image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		image_info.imageType = VK_IMAGE_TYPE_2D;
+		image_info.extent.width = width;
+		image_info.extent.height = height;
+		image_info.extent.depth = 1;
+		image_info.mipLevels = 1;
+		image_info.arrayLayers = 1;
+		image_info.format = format;
+		image_info.tiling = tiling;
+		image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		image_info.usage = usage;
+		image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+		image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		VkResult err = vkCreateImage(device, &image_info, NULL, &image);
+
+		if (hasFailed(err, false))
+		{
+		    kujogfxlog::error() << "Could not create image!";
+		    return err;
+		}
+
+		VkMemoryRequirements mem_requirements;
+		vkGetImageMemoryRequirements(device, image, &mem_requirements);
+
+		err = allocateMemoryVk(mem_requirements, properties, true, image_memory);
+
+		if (hasFailed(err, false))
+		{
+		    kujogfxlog::error() << "Could not allocate image memory!";
+		    return err;
+		}
+
+		vkBindImageMemory(device, image, image_memory.memory, image_memory.offset);
+		return VK_SUCCESS;
+	    }
+
+	    VkResult createImageViewVk(VkImage image, VkFormat format, VkImageAspectFlags aspect_flags, VkImageView &image_view)
+	    {
+		VkImageViewCreateInfo view_info = {};
+		view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		view_info.image = image;
+		view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		view_info.format = format;
+		view_info.subresourceRange.aspectMask = aspect_flags;
+		view_info.subresourceRange.baseMipLevel = 0;
+		view_info.subresourceRange.levelCount = 1;
+		view_info.subresourceRange.baseArrayLayer = 0;
+		view_info.subresourceRange.layerCount = 1;
+
+		VkResult err = vkCreateImageView(device, &view_info, NULL, &image_view);
+
+		if (hasFailed(err, false))
+		{
+		    kujogfxlog::error() << "Could not create image view!";
+		    return err;
+		}
+
+		return VK_SUCCESS;
+	    }
+
+	    VkAttachmentLoadOp convertLoadOp(KujoGFXLoadOp load_op)
+	    {
+		switch (load_op)
+		{
+		    case LoadOpLoad: return VK_ATTACHMENT_LOAD_OP_LOAD; break;
+		    case LoadOpClear: return VK_ATTACHMENT_LOAD_OP_CLEAR; break;
+		    default: return VK_ATTACHMENT_LOAD_OP_DONT_CARE; break;
+		}
+	    }
+
+	    VkAttachmentStoreOp convertStoreOp(KujoGFXStoreOp store_op)
+	    {
+		switch (store_op)
+		{
+		    case StoreOpStore: return VK_ATTACHMENT_STORE_OP_STORE; break;
+		    default: return VK_ATTACHMENT_STORE_OP_DONT_CARE; break;
+		}
+	    }
+
+	    VkClearColorValue convertClearColor(KujoGFXColor color)
+	    {
+		return {{color.red, color.green, color.blue, color.alpha}};
+	    }
+
+	    bool createRenderPass(const KujoGFXPass &pass, VkRenderPass &out_render_pass)
+	    {
+		VkAttachmentDescription color_attachment = {};
+		color_attachment.format = swapchain_image_format;
+		color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		color_attachment.loadOp = convertLoadOp(pass.action.color_attach.load_op);
+		color_attachment.storeOp = convertStoreOp(pass.action.color_attach.store_op);
+		color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		color_attachment.finalLayout = getColorLayout();
+
+		// Loading passes expect the image left behind by an earlier pass.
+		// Images no pass has written yet are transitioned by prepareImageLayouts()
+		if (color_attachment.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD)
+		{
+		    color_attachment.initialLayout = color_attachment.finalLayout;
+		}
+		else
+		{
+		    color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		}
+
+		VkAttachmentDescription depth_attachment = {};
+		depth_attachment.format = depth_image_format;
+		depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		depth_attachment.loadOp = convertLoadOp(pass.action.depth_attach.load_op);
+		depth_attachment.storeOp = convertStoreOp(pass.action.depth_attach.store_op);
+		depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		if (depth_attachment.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD)
+		{
+		    depth_attachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		}
+		else
+		{
+		    depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		}
+
+		VkAttachmentReference color_attachment_ref = {};
+		color_attachment_ref.attachment = 0;
+		color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentReference depth_attachment_ref = {};
+		depth_attachment_ref.attachment = 1;
+		depth_attachment_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkSubpassDescription subpass = {};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = 1;
+		subpass.pColorAttachments = &color_attachment_ref;
+		subpass.pDepthStencilAttachment = &depth_attachment_ref;
+
+		VkSubpassDependency dependency = {};
+		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependency.dstSubpass = 0;
+		dependency.srcStageMask = (VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT);
+		dependency.srcAccessMask = (VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+		dependency.dstStageMask = (VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT);
+		dependency.dstAccessMask = (VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+		vector<VkAttachmentDescription> attachments = {
+		    color_attachment,
+		    depth_attachment
+		};
+
+		VkRenderPassCreateInfo render_pass_info = {};
+		render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		render_pass_info.attachmentCount = uint32_t(attachments.size());
+		render_pass_info.pAttachments = attachments.data();
+		render_pass_info.subpassCount = 1;
+		render_pass_info.pSubpasses = &subpass;
+		render_pass_info.dependencyCount = 1;
+		render_pass_info.pDependencies = &dependency;
+
+		VkResult err = vkCreateRenderPass(device, &render_pass_info, NULL, &out_render_pass);
+
+		if (hasFailed(err, false))
+		{
+		    kujogfxlog::error() << "Could not create render pass!";
+		    return false;
+		}
+
+		return true;
+	    }
+
+	    // Pipelines are created outside of passes against this render pass.
+	    // Render pass compatibility only depends on the attachment formats,
+	    // so the result can be used with any pass started by beginPass()
+	    bool createCompatibleRenderPass()
+	    {
+		return createRenderPass(KujoGFXPass(), compatible_render_pass);
+	    }
+
+	    uint64_t getRenderPassHash(const KujoGFXPass &pass)
+	    {
+		array<uint32_t, 6> fields = {{
+		    uint32_t(swapchain_image_format),
+		    uint32_t(depth_image_format),
+		    uint32_t(convertLoadOp(pass.action.color_attach.load_op)),
+		    uint32_t(convertStoreOp(pass.action.color_attach.store_op)),
+		    uint32_t(convertLoadOp(pass.action.depth_attach.load_op)),
+		    uint32_t(convertStoreOp(pass.action.depth_attach.store_op))
+		}};
+
+		// 64-bit FNV-1a
+		uint64_t hash = 14695981039346656037ULL;
+
+		for (auto field : fields)
+		{
+		    hash ^= field;
+		    hash *= 1099511628211ULL;
+		}
+
+		return hash;
+	    }
+
+	    VkRenderPass getRenderPass(const KujoGFXPass &pass)
+	    {
+		uint64_t hash = getRenderPassHash(pass);
+		auto iter = render_passes.find(hash);
+
+		if (iter != render_passes.end())
+		{
+		    return iter->second;
+		}
+
+		VkRenderPass new_render_pass = VK_NULL_HANDLE;
+
+		if (!createRenderPass(pass, new_render_pass))
+		{
+		    return VK_NULL_HANDLE;
+		}
+
+		render_passes[hash] = new_render_pass;
+		return new_render_pass;
+	    }
+
+	    bool createFramebuffers()
+	    {
+		swapchain_framebuffers.resize(swapchain_image_views.size());
+
+		for (size_t i = 0; i < swapchain_image_views.size(); i++)
+		{
+		    vector<VkImageView> attachments = {
+			swapchain_image_views[i],
+			depth_image_view
+		    };
+
+		    VkFramebufferCreateInfo framebuffer_info = {};
+		    framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		    framebuffer_info.renderPass = compatible_render_pass;
+		    framebuffer_info.attachmentCount = uint32_t(attachments.size());
+		    framebuffer_info.pAttachments = attachments.data();
+		    framebuffer_info.width = swapchain_extent.width;
+		    framebuffer_info.height = swapchain_extent.height;
+		    framebuffer_info.layers = 1;
+
+		    VkResult err = vkCreateFramebuffer(device, &framebuffer_info, NULL, &swapchain_framebuffers[i]);
+
+		    if (hasFailed(err, false))
+		    {
+			kujogfxlog::error() << "Could not create framebuffers!";
+			return false;
+		    }
+		}
+
+		return true;
+	    }
+
+	    // The swapchain is recreated at the start of the next frame,
+	    // since the current one may still be recording into it
+	    void resize(int width, int height)
+	    {
+		if ((uint32_t(width) != window_width) || (uint32_t(height) != window_height))
+		{
+		    is_resize_pending = true;
+		}
+
+		// Offscreen images take their size from here instead of a window
+		if (is_headless)
+		{
+		    window_width = uint32_t(width);
+		    window_height = uint32_t(height);
+		}
+	    }
+
+	    void setFrameLatency(uint32_t num_frames)
+	    {
+		max_frames_in_flight = clamp<uint32_t>(num_frames, 1, max_frame_latency);
+		num_buffer_regions = (max_frames_in_flight + 2);
+		num_upload_batches = (max_frames_in_flight + 1);
+	    }
+
+	    void fillFrameStats(KujoGFXFrameStats &stats)
+	    {
+		stats.num_frames_in_flight = num_frames_in_flight;
+		stats.fence_wait_ms = fence_wait_ms;
+		fence_wait_ms = 0.0;
+	    }
+
+	    // Starts recording a frame on its first pass.
+	    // The CPU only blocks here if it has gotten max_frames_in_flight frames
+	    // ahead of the GPU, since the slot's fence has to signal before
+	    // its command buffer and the resources it used can be recycled
+	    bool beginFrame()
+	    {
+		num_frames_in_flight = 0;
+
+		for (auto &fence : in_flight_fences)
+		{
+		    if (vkGetFenceStatus(device, fence) == VK_NOT_READY)
+		    {
+			num_frames_in_flight += 1;
+		    }
+		}
+
+		auto wait_start = chrono::steady_clock::now();
+		vkWaitForFences(device, 1, &in_flight_fences[current_frame], VK_TRUE, UINT64_MAX);
+		fence_wait_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - wait_start).count();
+
+		flushDeferredDeletes(false);
+		pollReadbacks();
+
+		if (is_resize_pending)
+		{
+		    is_resize_pending = false;
+		    recreateSwapchain();
+		}
+
+		VkResult err = VK_SUCCESS;
+
+		// Each frame slot owns its offscreen image, which is free once its fence has signaled
+		if (is_headless)
+		{
+		    image_index = current_frame;
+		}
+		else
+		{
+		    err = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, image_available_semaphores[current_frame], VK_NULL_HANDLE, &image_index);
+		}
+
+		if (err == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+		    recreateSwapchain();
+		    err = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, image_available_semaphores[current_frame], VK_NULL_HANDLE, &image_index);
+		}
+
+		// The frame is skipped, e.g. while the window is minimized
+		if ((err != VK_SUCCESS) && (err != VK_SUBOPTIMAL_KHR))
+		{
+		    return false;
+		}
+
+		// Only reset once a submission is guaranteed to signal it again
+		vkResetFences(device, 1, &in_flight_fences[current_frame]);
+
+		uniform_ring_pos = (current_frame * uniform_ring_size);
+		uniform_ring_end = (uniform_ring_pos + uniform_ring_size);
+
+		command_buffer = command_buffers[current_frame];
+
+		vkResetCommandBuffer(command_buffer, 0);
+
+		VkCommandBufferBeginInfo begin_info = {};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		begin_info.pInheritanceInfo = NULL;
+
+		err = vkBeginCommandBuffer(command_buffer, &begin_info);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::fatal() << "Could not begin command buffer!";
+		    return false;
+		}
+
+		is_frame_active = true;
+		return true;
+	    }
+
+	    // All passes of a frame are recorded into the same command buffer,
+	    // which is submitted and presented by commitFrame()
+	    void beginPass(const KujoGFXPass &pass)
+	    {
+		current_pass = pass;
+		is_pass_active = false;
+
+		if (!is_frame_active && !beginFrame())
+		{
+		    return;
+		}
+
+		render_pass = getRenderPass(current_pass);
+
+		if (assertVk(render_pass != VK_NULL_HANDLE))
+		{
+		    kujogfxlog::fatal() << "Could not start render pass!";
+		    return;
+		}
+
+		beginRenderPass();
+		is_pass_active = true;
+	    }
+
+	    void beginRenderPass()
+	    {
+		array<VkClearValue, 2> clear_values;
+		clear_values[0].color = convertClearColor(current_pass.action.color_attach.color);
+		clear_values[1].depthStencil = {current_pass.action.depth_attach.clear_val, 0};
+
+		VkRenderPassBeginInfo render_pass_info = {};
+		render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		render_pass_info.pNext = NULL;
+		render_pass_info.renderPass = render_pass;
+		render_pass_info.renderArea.offset = {0, 0};
+		render_pass_info.renderArea.extent = swapchain_extent;
+		render_pass_info.framebuffer = swapchain_framebuffers[image_index];
+		render_pass_info.clearValueCount = uint32_t(clear_values.size());
+		render_pass_info.pClearValues = clear_values.data();
+
+		prepareImageLayouts();
+		vkCmdBeginRenderPass(command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+	    }
+
+	    // The present layout needs VK_KHR_swapchain, which headless devices don't enable.
+	    // Offscreen images are left ready to be copied out instead
+	    VkImageLayout getColorLayout()
+	    {
+		return is_headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	    }
+
+	    // Moves images that are still undefined into the initial layouts
+	    // of a pass that loads them. Their contents stay undefined
+	    void prepareImageLayouts()
+	    {
+		array<VkImageMemoryBarrier, 2> barriers;
+		uint32_t num_barriers = 0;
+
+		VkImageMemoryBarrier image_barrier = {};
+		image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		image_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		image_barrier.subresourceRange.levelCount = 1;
+		image_barrier.subresourceRange.layerCount = 1;
+
+		bool is_color_loaded = (current_pass.action.color_attach.load_op == LoadOpLoad);
+		bool is_depth_loaded = (current_pass.action.depth_attach.load_op == LoadOpLoad);
+
+		if (is_color_loaded && (swapchain_image_layouts.at(image_index) == VK_IMAGE_LAYOUT_UNDEFINED))
+		{
+		    image_barrier.newLayout = getColorLayout();
+		    image_barrier.image = swapchain_images[image_index];
+		    image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		    barriers[num_barriers++] = image_barrier;
+		}
+
+		if (is_depth_loaded && (depth_image_layout == VK_IMAGE_LAYOUT_UNDEFINED))
+		{
+		    image_barrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		    image_barrier.image = depth_image;
+		    image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+		    if (hasStencilComponent(depth_image_format))
+		    {
+			image_barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+		    }
+
+		    barriers[num_barriers++] = image_barrier;
+		}
+
+		if (num_barriers > 0)
+		{
+		    VkPipelineStageFlags dst_stages = (VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT);
+		    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dst_stages, 0, 0, NULL, 0, NULL, num_barriers, barriers.data());
+		}
+
+		// Every pass leaves both images in their final layouts
+		swapchain_image_layouts.at(image_index) = getColorLayout();
+		depth_image_layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	    }
+
+	    void endPass()
+	    {
+		if (!is_pass_active)
+		{
+		    return;
+		}
+
+		vkCmdEndRenderPass(command_buffer);
+		is_pass_active = false;
+	    }
+
+	    // The copy is recorded into the frame's command buffer, and handed to the
+	    // callback at the start of the first frame that finds the frame's fence signaled.
+	    // This never blocks, and takes at most max_frames_in_flight frames
+	    bool readPixels(KujoGFXReadCallback callback)
+	    {
+		if (!is_frame_active || is_pass_active)
+		{
+		    kujogfxlog::error() << "Pixels can only be read between the passes of a frame!";
+		    return false;
+		}
+
+		if (!is_headless && !is_swapchain_readable)
+		{
+		    kujogfxlog::error() << "Swapchain images can not be copied from!";
+		    return false;
+		}
+
+		VulkanReadback readback;
+
+		if (!allocReadback((VkDeviceSize(swapchain_extent.width) * swapchain_extent.height * 4), readback))
+		{
+		    return false;
+		}
+
+		readback.callback = callback;
+		readback.frame_slot = current_frame;
+		readback.width = swapchain_extent.width;
+		readback.height = swapchain_extent.height;
+
+		VkImageLayout layout = getColorLayout();
+
+		VkImageMemoryBarrier image_barrier = {};
+		image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		image_barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		image_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		image_barrier.oldLayout = swapchain_image_layouts.at(image_index);
+		image_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		image_barrier.image = swapchain_images[image_index];
+		image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		image_barrier.subresourceRange.levelCount = 1;
+		image_barrier.subresourceRange.layerCount = 1;
+
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &image_barrier);
+
+		VkBufferImageCopy region = {};
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent = {swapchain_extent.width, swapchain_extent.height, 1};
+
+		vkCmdCopyImageToBuffer(command_buffer, swapchain_images[image_index], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.buffer.buffer, 1, &region);
+
+		// The image goes back to its layout for later passes and presentation,
+		// and the copied data is made visible to the host
+		image_barrier.srcAccessMask = 0;
+		image_barrier.dstAccessMask = (VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+		image_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		image_barrier.newLayout = layout;
+
+		VkBufferMemoryBarrier buffer_barrier = {};
+		buffer_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		buffer_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		buffer_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		buffer_barrier.buffer = readback.buffer.buffer;
+		buffer_barrier.offset = 0;
+		buffer_barrier.size = VK_WHOLE_SIZE;
+
+		VkPipelineStageFlags dst_stages = (VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_HOST_BIT);
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stages, 0, 0, NULL, 1, &buffer_barrier, 1, &image_barrier);
+		swapchain_image_layouts.at(image_index) = layout;
+
+		pending_readbacks.push_back(readback);
+		return true;
+	    }
+
+	    bool allocReadback(VkDeviceSize size, VulkanReadback &readback)
+	    {
+		for (auto iter = free_readbacks.begin(); iter != free_readbacks.end(); iter++)
+		{
+		    if (iter->size >= size)
+		    {
+			readback = *iter;
+			free_readbacks.erase(iter);
+			return true;
+		    }
+		}
+
+		// The remaining buffers are too small for the current target size
+		for (auto &free_readback : free_readbacks)
+		{
+		    releaseBuffer(free_readback.buffer);
+		}
+
+		free_readbacks.clear();
+
+		VkResult err = createBufferVk(size,
+		    VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		    (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+		    readback.buffer);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::error() << "Could not create readback buffer!";
+		    return false;
+		}
+
+		readback.size = size;
+		return true;
+	    }
+
+	    // Delivers finished readbacks in the order they were started.
+	    // Must be called before the current frame's fence is reset
+	    void pollReadbacks()
+	    {
+		while (!pending_readbacks.empty())
+		{
+		    auto &readback = pending_readbacks.front();
+
+		    if (vkGetFenceStatus(device, in_flight_fences[readback.frame_slot]) != VK_SUCCESS)
+		    {
+			break;
+		    }
+
+		    KujoGFXPixels pixels;
+		    pixels.data = readback.buffer.memory.mapped;
+		    pixels.width = int(readback.width);
+		    pixels.height = int(readback.height);
+		    pixels.row_pitch = (readback.width * 4);
+		    pixels.format = (swapchain_image_format == VK_FORMAT_B8G8R8A8_UNORM) ? PixelFormatBGRA8 : PixelFormatRGBA8;
+		    readback.callback(pixels);
+
+		    readback.callback = nullptr;
+		    free_readbacks.push_back(readback);
+		    pending_readbacks.pop_front();
+		}
+	    }
+
+	    // Readbacks still in flight are dropped without calling back
+	    void destroyReadbacks()
+	    {
+		for (auto &readback : pending_readbacks)
+		{
+		    releaseBuffer(readback.buffer);
+		}
+
+		for (auto &readback : free_readbacks)
+		{
+		    releaseBuffer(readback.buffer);
+		}
+
+		pending_readbacks.clear();
+		free_readbacks.clear();
+	    }
+
+	    // Submits the frame without waiting for it, and moves on to the next frame slot
+	    void commitFrame()
+	    {
+		if (!is_frame_active)
+		{
+		    return;
+		}
+
+		is_frame_active = false;
+
+		VkResult err = vkEndCommandBuffer(command_buffer);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::fatal() << "Could not end command buffer!";
+		    return;
+		}
+
+		// Pending uploads go out in one submission ahead of the frame
+		VkSemaphore upload_semaphore = flushUploads();
+
+		array<VkSemaphore, 2> wait_semaphores = {};
+		array<VkPipelineStageFlags, 2> wait_stages = {};
+		uint32_t num_wait_semaphores = 0;
+
+		if (!is_headless)
+		{
+		    wait_semaphores[num_wait_semaphores] = image_available_semaphores[current_frame];
+		    wait_stages[num_wait_semaphores++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		}
+
+		if (upload_semaphore != VK_NULL_HANDLE)
+		{
+		    // Indirect arguments are read before vertex input
+		    wait_semaphores[num_wait_semaphores] = upload_semaphore;
+		    wait_stages[num_wait_semaphores++] = (VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+		}
+
+		VkSubmitInfo submit_info = {};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+		submit_info.waitSemaphoreCount = num_wait_semaphores;
+		submit_info.pWaitSemaphores = wait_semaphores.data();
+		submit_info.pWaitDstStageMask = wait_stages.data();
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &command_buffer;
+		submit_info.signalSemaphoreCount = is_headless ? 0 : 1;
+		submit_info.pSignalSemaphores = &render_finished_semaphores[current_frame];
+
+		err = vkQueueSubmit(graphics_queue, 1, &submit_info, in_flight_fences[current_frame]);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::fatal() << "Could not submit draw commands!";
+		    return;
+		}
+
+		if (!is_headless)
+		{
+		    presentFrame();
+		}
+
+		current_frame = ((current_frame + 1) % max_frames_in_flight);
+		frame_number += 1;
+	    }
+
+	    void presentFrame()
+	    {
+		VkPresentInfoKHR present_info = {};
+		present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		present_info.waitSemaphoreCount = 1;
+		present_info.pWaitSemaphores = &render_finished_semaphores[current_frame];
+		present_info.swapchainCount = 1;
+		present_info.pSwapchains = &swapchain;
+		present_info.pImageIndices = &image_index;
+		present_info.pResults = NULL;
+
+		VkResult err = vkQueuePresentKHR(present_queue, &present_info);
+
+		if ((err == VK_ERROR_OUT_OF_DATE_KHR) || (err == VK_SUBOPTIMAL_KHR))
+		{
+		    recreateSwapchain();
+		}
+		else if (err != VK_SUCCESS)
+		{
+		    kujogfxlog::fatal() << "Could not render swapchain image!";
+		}
+	    }
+
+	    VkShaderModule createShaderModule(const vector<uint32_t> &code)
+	    {
+		VkShaderModuleCreateInfo create_info = {};
+		create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		create_info.codeSize = (code.size() * sizeof(uint32_t));
+		create_info.pCode = code.data();
+
+		VkShaderModule shader_module;
+		VkResult err = vkCreateShaderModule(device, &create_info, NULL, &shader_module);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::fatal() << "Could not create shader module!";
+		}
+
+		return shader_module;
+	    }
+
+	    VkPrimitiveTopology getTopology(KujoGFXPrimitiveType type)
+	    {
+		switch (type)
+		{
+		    case PrimitiveTriangles: return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST; break;
+		    default:
+		    {
+			assertVk(false);
+			kujogfxlog::fatal() << "Unrecognized primitive type of " << dec << int(type);
+			return (VkPrimitiveTopology)0;
+		    }
+		    break;
+		}
+	    }
+
+	    VkCullModeFlags getCullMode(KujoGFXCullMode mode)
+	    {
+		switch (mode)
+		{
+		    case CullModeNone: return VK_CULL_MODE_NONE; break;
+		    case CullModeFront: return VK_CULL_MODE_FRONT_BIT; break;
+		    case CullModeBack: return VK_CULL_MODE_BACK_BIT; break;
+		    default:
+		    {
+			assertVk(false);
+			kujogfxlog::fatal() << "Unrecognized cull mode of " << dec << int(mode);
+			return (VkCullModeFlags)0;
+		    }
+		    break;
+		}
+	    }
+
+	    VkFormat getFormat(KujoGFXVertexFormat format)
+	    {
+		switch (format)
+		{
+		    case VertexFormatFloat2: return VK_FORMAT_R32G32_SFLOAT; break;
+		    case VertexFormatFloat3: return VK_FORMAT_R32G32B32_SFLOAT; break;
+		    case VertexFormatFloat4: return VK_FORMAT_R32G32B32A32_SFLOAT; break;
+		    case VertexFormatInvalid: return VK_FORMAT_UNDEFINED; break;
+		    default:
+		    {
+			assertVk(false);
+			kujogfxlog::fatal() << "Unrecognized vertex format of " << dec << int(format);
+			return VK_FORMAT_UNDEFINED;
+		    }
+		    break;
+		}
+	    }
+
+	    VkIndexType getIndexType(KujoGFXIndexType type)
+	    {
+		switch (type)
+		{
+		    case IndexTypeNone: return VK_INDEX_TYPE_UINT16; break;
+		    case IndexTypeUint16: return VK_INDEX_TYPE_UINT16; break;
+		    case IndexTypeUint32: return VK_INDEX_TYPE_UINT32; break;
+		    default:
+		    {
+			assertVk(false);
+			kujogfxlog::fatal() << "Unrecognized index type of " << dec << int(type);
+			return (VkIndexType)0;
+		    }
+		    break;
+		}
+	    }
+
+	    VkCompareOp getCompareOp(KujoGFXCompareFunc func)
+	    {
+		switch (func)
+		{
+		    case CompareFuncNever: return VK_COMPARE_OP_NEVER; break;
+		    case CompareFuncLessEqual: return VK_COMPARE_OP_LESS_OR_EQUAL; break;
+		    case CompareFuncAlways: return VK_COMPARE_OP_ALWAYS; break;
+		    default:
+		    {
+			assertVk(false);
+			kujogfxlog::fatal() << "Unrecognized compare func of " << dec << int(func);
+			return (VkCompareOp)0;
+		    }
+		    break;
+		}
+	    }
+
+	    vector<KujoGFXUniformDesc> getUniforms(const KujoGFXShader &shader)
+	    {
+		auto &uniforms = shader.uniforms;
+		size_t uniform_size = min<size_t>(max_uniform_block_bind_slots, uniforms.size());
+		return vector<KujoGFXUniformDesc>(uniforms.begin(), (uniforms.begin() + uniform_size));
+	    }
+
+	    void setPipeline(KujoGFXPipelineHandle handle)
+	    {
+		if (assertVk(handle.getIndex() < pipelines.size()))
+		{
+		    kujogfxlog::fatal() << "Could not find current pipeline!";
+		    return;
+		}
+
+		current_pipeline = &pipelines[handle.getIndex()];
+	    }
+
+	    bool createPipeline(KujoGFXPipelineHandle handle, KujoGFXPipeline &pipeline, const KujoGFXShader &shader)
+	    {
+		VulkanPipeline new_pipeline;
+		auto locations = shader.locations.spirv_locations;
+		auto uniforms = getUniforms(shader);
+
+		// Create shader modules
+		VkShaderModule vert_module = createShaderModule(shader.vert_code.spv_code);
+		VkShaderModule frag_module = createShaderModule(shader.frag_code.spv_code);
+
+		VkPipelineShaderStageCreateInfo vert_stage_info = {};
+		vert_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		vert_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
+		vert_stage_info.module = vert_module;
+		vert_stage_info.pName = shader.vert_code.entry_name.c_str();
+
+		VkPipelineShaderStageCreateInfo frag_stage_info = {};
+		frag_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		frag_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		frag_stage_info.module = frag_module;
+		frag_stage_info.pName = shader.frag_code.entry_name.c_str();
+
+		vector<VkPipelineShaderStageCreateInfo> shader_stages = {
+		    vert_stage_info,
+		    frag_stage_info
+		};
+
+		// Set up dynamic states
+		vector<VkDynamicState> dynamic_states = {
+		    VK_DYNAMIC_STATE_VIEWPORT,
+		    VK_DYNAMIC_STATE_SCISSOR
+		};
+
+		VkPipelineDynamicStateCreateInfo dynamic_state = {};
+		dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamic_state.dynamicStateCount = uint32_t(dynamic_states.size());
+		dynamic_state.pDynamicStates = dynamic_states.data();
+
+		// Set up vertex input descriptions
+		vector<VkVertexInputBindingDescription> vertex_bindings;
+		vector<VkVertexInputAttributeDescription> vertex_attribs;
+
+		for (size_t i = 0; i < max_vertex_buffer_bind_slots; i++)
+		{
+		    if (pipeline.layout.vertex_buffer_layout_active[i])
+		    {
+			VkVertexInputBindingDescription description;
+			description.binding = i;
+			description.stride = pipeline.layout.buffers[i].stride;
+			description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+			vertex_bindings.push_back(description);
+		    }
+		}
+
+		for (size_t attr_index = 0; attr_index < max_vertex_attribs; attr_index++)
+		{
+		    auto attrib = pipeline.layout.attribs[attr_index];
+
+		    if (attrib.format == VertexFormatInvalid)
+		    {
+			break;
 		    }
 
 		    VkVertexInputAttributeDescription description;
@@ -4931,385 +8145,1669 @@ namespace kujogfx
 		    description.format = getFormat(attrib.format);
 		    description.offset = attrib.offset;
 
-		    vertex_attribs.push_back(description);
+		    vertex_attribs.push_back(description);
+		}
+
+		VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
+		vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		vertex_input_info.vertexBindingDescriptionCount = uint32_t(vertex_bindings.size());
+		vertex_input_info.pVertexBindingDescriptions = vertex_bindings.data();
+		vertex_input_info.vertexAttributeDescriptionCount = uint32_t(vertex_attribs.size());
+		vertex_input_info.pVertexAttributeDescriptions = vertex_attribs.data();
+
+		VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
+		input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		input_assembly.topology = getTopology(pipeline.primitive_type);
+		input_assembly.primitiveRestartEnable = VK_FALSE;
+
+		VkPipelineViewportStateCreateInfo viewport_state = {};
+		viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewport_state.viewportCount = 1;
+		viewport_state.scissorCount = 1;
+
+		VkPipelineRasterizationStateCreateInfo raster_state = {};
+		raster_state.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		raster_state.depthClampEnable = VK_FALSE;
+		raster_state.rasterizerDiscardEnable = VK_FALSE;
+		raster_state.polygonMode = VK_POLYGON_MODE_FILL;
+		raster_state.lineWidth = 1.0f;
+		raster_state.cullMode = getCullMode(pipeline.cull_mode);
+		raster_state.frontFace = VK_FRONT_FACE_CLOCKWISE;
+		raster_state.depthBiasEnable = VK_FALSE;
+		raster_state.depthBiasConstantFactor = 0.f;
+		raster_state.depthBiasClamp = 0.f;
+		raster_state.depthBiasSlopeFactor = 0.f;
+
+		VkPipelineMultisampleStateCreateInfo multisample_state = {};
+		multisample_state.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisample_state.sampleShadingEnable = VK_FALSE;
+		multisample_state.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+		multisample_state.minSampleShading = 1.0f;
+		multisample_state.pSampleMask = NULL;
+		multisample_state.alphaToCoverageEnable = VK_FALSE;
+		multisample_state.alphaToOneEnable = VK_FALSE;
+
+		VkPipelineColorBlendAttachmentState color_blend_attachment = {};
+		color_blend_attachment.colorWriteMask = (VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT);
+		color_blend_attachment.blendEnable = VK_FALSE;
+		color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+		color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+		color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+		VkPipelineColorBlendStateCreateInfo color_blend_state = {};
+		color_blend_state.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		color_blend_state.logicOpEnable = VK_FALSE;
+		color_blend_state.attachmentCount = 1;
+		color_blend_state.pAttachments = &color_blend_attachment;
+
+		VkPipelineDepthStencilStateCreateInfo depth_stencil_state = {};
+		depth_stencil_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		depth_stencil_state.depthTestEnable = VK_TRUE;
+		depth_stencil_state.depthWriteEnable = convertBoolVk(pipeline.depth_state.is_write_enabled);
+		depth_stencil_state.depthCompareOp = getCompareOp(pipeline.depth_state.compare_func);
+		depth_stencil_state.depthBoundsTestEnable = VK_FALSE;
+		depth_stencil_state.stencilTestEnable = VK_FALSE;
+
+		if (!createUniformLayout(uniforms, new_pipeline))
+		{
+		    kujogfxlog::error() << "Could not create uniform layout!";
+
+		    if (new_pipeline.set_layout != VK_NULL_HANDLE)
+		    {
+			vkDestroyDescriptorSetLayout(device, new_pipeline.set_layout, NULL);
+		    }
+
+		    vkDestroyShaderModule(device, vert_module, NULL);
+		    vkDestroyShaderModule(device, frag_module, NULL);
+		    return false;
+		}
+
+		VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+		pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+
+		if (new_pipeline.set_layout != VK_NULL_HANDLE)
+		{
+		    pipeline_layout_info.setLayoutCount = 1;
+		    pipeline_layout_info.pSetLayouts = &new_pipeline.set_layout;
+		}
+
+		VkResult err = vkCreatePipelineLayout(device, &pipeline_layout_info, NULL, &new_pipeline.layout);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::fatal() << "Could not create pipeline layout!";
+		}
+
+		VkGraphicsPipelineCreateInfo pipeline_info = {};
+		pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipeline_info.stageCount = 2;
+		pipeline_info.pStages = shader_stages.data();
+		pipeline_info.pVertexInputState = &vertex_input_info;
+		pipeline_info.pInputAssemblyState = &input_assembly;
+		pipeline_info.pViewportState = &viewport_state;
+		pipeline_info.pRasterizationState = &raster_state;
+		pipeline_info.pMultisampleState = &multisample_state;
+		pipeline_info.pColorBlendState = &color_blend_state;
+		pipeline_info.pDepthStencilState = &depth_stencil_state;
+		pipeline_info.pDynamicState = &dynamic_state;
+		pipeline_info.layout = new_pipeline.layout;
+		pipeline_info.renderPass = compatible_render_pass;
+		pipeline_info.subpass = 0;
+
+		err = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, NULL, &new_pipeline.pipeline);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::fatal() << "Could not create graphics pipeline!";
+		}
+
+		new_pipeline.index_type = getIndexType(pipeline.index_type);
+
+		// Hack to determine if index buffer is active (because Vulkan doesn't have native support for a 'no indices provided' type
+		// (at least, not without out-of-scope extensions))
+		new_pipeline.is_index_active = (pipeline.index_type != IndexTypeNone);
+
+		vkDestroyShaderModule(device, vert_module, NULL);
+		vkDestroyShaderModule(device, frag_module, NULL);
+
+		getSlot(pipelines, handle) = new_pipeline;
+		return true;
+	    }
+
+	    void applyPipeline()
+	    {
+		VkViewport viewport = {};
+		viewport.x = 0.f;
+		viewport.y = static_cast<float>(swapchain_extent.height);
+		viewport.width = static_cast<float>(swapchain_extent.width);
+		viewport.height = -static_cast<float>(swapchain_extent.height);
+		viewport.minDepth = 0.f;
+		viewport.maxDepth = 1.f;
+
+		VkRect2D scissor = {};
+		scissor.offset = {0, 0};
+		scissor.extent = swapchain_extent;
+
+		if (!is_pass_active)
+		{
+		    return;
+		}
+
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, current_pipeline->pipeline);
+		vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+		vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+		// Keep the set bound even before any uniforms are applied
+		ub_offsets.fill(0);
+		bindUniforms();
+	    }
+
+	    // Derives a descriptor set layout from the shader's uniform blocks,
+	    // with one dynamic uniform buffer per block at its desc_binding
+	    bool createUniformLayout(const vector<KujoGFXUniformDesc> &uniforms, VulkanPipeline &pipeline)
+	    {
+		vector<VkDescriptorSetLayoutBinding> layout_bindings;
+		vector<VkDescriptorBufferInfo> buffer_infos;
+
+		pipeline.num_uniform_blocks = uint32_t(uniforms.size());
+
+		for (size_t ub_index = 0; ub_index < uniforms.size(); ub_index++)
+		{
+		    auto &uniform_block = uniforms.at(ub_index);
+
+		    if ((uniform_block.stage == UniformStageInvalid) || (uniform_block.desc_size == 0))
+		    {
+			continue;
+		    }
+
+		    for (auto &layout_binding : layout_bindings)
+		    {
+			if (layout_binding.binding == uniform_block.desc_binding)
+			{
+			    kujogfxlog::error() << "Uniform blocks can not share binding " << dec << uniform_block.desc_binding;
+			    return false;
+			}
+		    }
+
+		    VkDescriptorSetLayoutBinding layout_binding = {};
+		    layout_binding.binding = uniform_block.desc_binding;
+		    layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		    layout_binding.descriptorCount = 1;
+		    layout_binding.stageFlags = (uniform_block.stage == UniformStageVertex) ? VK_SHADER_STAGE_VERTEX_BIT : VK_SHADER_STAGE_FRAGMENT_BIT;
+		    layout_bindings.push_back(layout_binding);
+
+		    VkDescriptorBufferInfo buffer_info = {};
+		    buffer_info.buffer = uniform_ring.buffer;
+		    buffer_info.offset = 0;
+		    buffer_info.range = uniform_block.desc_size;
+		    buffer_infos.push_back(buffer_info);
+
+		    pipeline.ub_sizes[ub_index] = uint32_t(uniform_block.desc_size);
+		}
+
+		if (layout_bindings.empty())
+		{
+		    return true;
+		}
+
+		pipeline.num_dynamic_offsets = uint32_t(layout_bindings.size());
+
+		for (size_t ub_index = 0; ub_index < uniforms.size(); ub_index++)
+		{
+		    if (pipeline.ub_sizes[ub_index] == 0)
+		    {
+			continue;
+		    }
+
+		    uint32_t offset_index = 0;
+
+		    for (auto &layout_binding : layout_bindings)
+		    {
+			if (layout_binding.binding < uniforms.at(ub_index).desc_binding)
+			{
+			    offset_index += 1;
+			}
+		    }
+
+		    pipeline.ub_offset_indices[ub_index] = offset_index;
+		}
+
+		VkDescriptorSetLayoutCreateInfo layout_info = {};
+		layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layout_info.bindingCount = uint32_t(layout_bindings.size());
+		layout_info.pBindings = layout_bindings.data();
+
+		VkResult err = vkCreateDescriptorSetLayout(device, &layout_info, NULL, &pipeline.set_layout);
+
+		if (hasFailed(err, false))
+		{
+		    kujogfxlog::error() << "Could not create descriptor set layout!";
+		    return false;
+		}
+
+		VkDescriptorSetAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		alloc_info.descriptorPool = descriptor_pool;
+		alloc_info.descriptorSetCount = 1;
+		alloc_info.pSetLayouts = &pipeline.set_layout;
+
+		err = vkAllocateDescriptorSets(device, &alloc_info, &pipeline.descriptor_set);
+
+		if (hasFailed(err, false))
+		{
+		    kujogfxlog::error() << "Could not allocate descriptor set!";
+		    return false;
+		}
+
+		vector<VkWriteDescriptorSet> writes(layout_bindings.size());
+
+		for (size_t i = 0; i < writes.size(); i++)
+		{
+		    writes[i] = {};
+		    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		    writes[i].dstSet = pipeline.descriptor_set;
+		    writes[i].dstBinding = layout_bindings[i].binding;
+		    writes[i].descriptorCount = 1;
+		    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		    writes[i].pBufferInfo = &buffer_infos[i];
+		}
+
+		vkUpdateDescriptorSets(device, uint32_t(writes.size()), writes.data(), 0, NULL);
+		return true;
+	    }
+
+	    void bindUniforms()
+	    {
+		if (current_pipeline->descriptor_set == VK_NULL_HANDLE)
+		{
+		    return;
+		}
+
+		vkCmdBindDescriptorSets(command_buffer,
+		    VK_PIPELINE_BIND_POINT_GRAPHICS,
+		    current_pipeline->layout,
+		    0, 1, &current_pipeline->descriptor_set,
+		    current_pipeline->num_dynamic_offsets, ub_offsets.data());
+	    }
+
+	    VkBufferUsageFlags getUsage(const KujoGFXBuffer &buffer)
+	    {
+		VkBufferUsageFlags flags = 0;
+
+		if (buffer.isIndexBuffer())
+		{
+		    flags |= VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+		}
+		else if (buffer.isVertexBuffer())
+		{
+		    flags |= VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+		}
+		else if (buffer.isIndirectBuffer())
+		{
+		    flags |= VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+		}
+
+		return flags;
+	    }
+
+	    void createBuffer(KujoGFXBufferHandle handle, const KujoGFXBuffer &buffer)
+	    {
+		if (buffer.getUsage() != BufferUsageImmutable)
+		{
+		    createDynamicBuffer(handle, buffer);
+		    return;
+		}
+
+		VulkanBuffer main_buffer;
+		VkResult err = createBufferVk(buffer.getSize(),
+		    (VK_BUFFER_USAGE_TRANSFER_DST_BIT | getUsage(buffer)),
+		    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		    main_buffer);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::fatal() << "Could not create main buffer!";
+		}
+
+		uploadBuffer(main_buffer.buffer, buffer.getData(), buffer.getSize());
+
+		if (buffer.isIndirectBuffer() && !has_draw_indirect_first_instance)
+		{
+		    auto &shadow = getSlot(indirect_shadows, handle);
+		    shadow.assign(buffer.getBufferSize(), 0);
+		    memcpy(shadow.data(), buffer.getData(), buffer.getSize());
+		}
+
+		getSlot(buffers, handle) = main_buffer;
+	    }
+
+	    void createDynamicBuffer(KujoGFXBufferHandle handle, const KujoGFXBuffer &buffer)
+	    {
+		VulkanBuffer dyn_buffer;
+		dyn_buffer.region_size = ((buffer.getBufferSize() + 15) & ~VkDeviceSize(15));
+		dyn_buffer.num_regions = num_buffer_regions;
+
+		VkResult err = createBufferVk((dyn_buffer.region_size * dyn_buffer.num_regions),
+		    getUsage(buffer),
+		    (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+		    dyn_buffer);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::fatal() << "Could not create dynamic buffer!";
+		}
+
+		// Host-visible memory is persistently mapped by the allocator
+		dyn_buffer.mapped = dyn_buffer.memory.mapped;
+
+		if (buffer.getData() != NULL)
+		{
+		    memcpy(dyn_buffer.mapped, buffer.getData(), buffer.getSize());
+		}
+
+		getSlot(buffers, handle) = dyn_buffer;
+	    }
+
+	    VulkanBuffer findBuffer(KujoGFXBufferHandle handle)
+	    {
+		if (!handle.isValid() || (handle.getIndex() >= buffers.size()))
+		{
+		    return VulkanBuffer();
+		}
+
+		return buffers[handle.getIndex()];
+	    }
+
+	    VkDeviceSize getRegionOffset(const VulkanBuffer &buffer)
+	    {
+		return (buffer.active_region * buffer.region_size);
+	    }
+
+	    KujoGFXMemoryStats getMemoryStats()
+	    {
+		return allocator.getStats();
+	    }
+
+	    void updateBuffer(KujoGFXBufferHandle handle, const KujoGFXData &data)
+	    {
+		writeBuffer(handle, 0, data);
+	    }
+
+	    void appendBuffer(KujoGFXBufferHandle handle, uint32_t offset, const KujoGFXData &data)
+	    {
+		writeBuffer(handle, offset, data);
+	    }
+
+	    // The first write of every frame moves on to the next region,
+	    // which the GPU is guaranteed to be done with (see num_buffer_regions)
+	    void writeBuffer(KujoGFXBufferHandle handle, uint32_t offset, const KujoGFXData &data)
+	    {
+		if (!handle.isValid() || (handle.getIndex() >= buffers.size()))
+		{
+		    return;
+		}
+
+		auto &buffer = buffers[handle.getIndex()];
+
+		if (buffer.mapped == NULL)
+		{
+		    return;
+		}
+
+		if (buffer.write_frame != frame_number)
+		{
+		    buffer.active_region = ((buffer.active_region + 1) % buffer.num_regions);
+		    buffer.write_frame = frame_number;
+		}
+
+		memcpy((buffer.mapped + getRegionOffset(buffer) + offset), data.getData(), data.getSize());
+	    }
+
+	    void destroyBuffer(KujoGFXBufferHandle handle)
+	    {
+		auto buffer = findBuffer(handle);
+
+		if (buffer.buffer != VK_NULL_HANDLE)
+		{
+		    VulkanDeferredDelete deferred;
+		    deferred.frame_number = frame_number;
+		    deferred.buffer = buffer;
+		    deferred_deletes.push_back(deferred);
+		    buffers[handle.getIndex()] = VulkanBuffer();
+		}
+
+		if (handle.getIndex() < indirect_shadows.size())
+		{
+		    indirect_shadows[handle.getIndex()].clear();
+		}
+	    }
+
+	    void destroyPipeline(KujoGFXPipelineHandle handle)
+	    {
+		if (handle.getIndex() >= pipelines.size())
+		{
+		    return;
+		}
+
+		auto &pipeline = pipelines[handle.getIndex()];
+
+		if (current_pipeline == &pipeline)
+		{
+		    current_pipeline = NULL;
+		}
+
+		VulkanDeferredDelete deferred;
+		deferred.frame_number = frame_number;
+		deferred.pipeline = pipeline;
+		deferred_deletes.push_back(deferred);
+		pipeline = VulkanPipeline();
+	    }
+
+	    void applyBindings(const KujoGFXBindings &bindings)
+	    {
+		if (!is_pass_active)
+		{
+		    return;
+		}
+
+		array<VkBuffer, max_vertex_buffer_bind_slots> vertex_buffers;
+		array<VkDeviceSize, max_vertex_buffer_bind_slots> vertex_offsets;
+		uint32_t num_vertex_buffers = 0;
+
+		for (size_t index = 0; index < bindings.vertex_buffers.size(); index++)
+		{
+		    auto buffer = findBuffer(bindings.vertex_buffers.at(index));
+
+		    if (buffer.buffer != VK_NULL_HANDLE)
+		    {
+			vertex_buffers[num_vertex_buffers] = buffer.buffer;
+			vertex_offsets[num_vertex_buffers] = (getRegionOffset(buffer) + bindings.vertex_buffer_offsets.at(index));
+			num_vertex_buffers += 1;
+		    }
+		}
+
+		vkCmdBindVertexBuffers(command_buffer, 0, num_vertex_buffers, vertex_buffers.data(), vertex_offsets.data());
+
+		auto index_buffer = findBuffer(bindings.index_buffer);
+
+		if (index_buffer.buffer != VK_NULL_HANDLE)
+		{
+		    vkCmdBindIndexBuffer(command_buffer, index_buffer.buffer, (getRegionOffset(index_buffer) + bindings.index_buffer_offset), current_pipeline->index_type);
+		}
+	    }
+
+	    // Copies the data into the frame's region of the uniform ring,
+	    // and points the block's dynamic offset at it
+	    void applyUniforms(int ub_slot, const KujoGFXData &data)
+	    {
+		if (!is_pass_active)
+		{
+		    return;
+		}
+
+		if ((ub_slot < 0) || (uint32_t(ub_slot) >= current_pipeline->num_uniform_blocks) || (current_pipeline->ub_sizes[ub_slot] == 0))
+		{
+		    kujogfxlog::error() << "Could not apply uniforms to invalid slot of " << dec << ub_slot;
+		    return;
+		}
+
+		uint32_t ub_size = current_pipeline->ub_sizes[ub_slot];
+
+		if (data.getSize() > ub_size)
+		{
+		    kujogfxlog::error() << "Could not apply uniforms larger than their block!";
+		    return;
+		}
+
+		VkDeviceSize offset = ((uniform_ring_pos + (uniform_alignment - 1)) & ~(uniform_alignment - 1));
+
+		if ((offset + ub_size) > uniform_ring_end)
+		{
+		    kujogfxlog::error() << "Uniform ring overflow!";
+		    return;
+		}
+
+		memcpy((uniform_ring.memory.mapped + offset), data.getData(), data.getSize());
+		uniform_ring_pos = (offset + ub_size);
+
+		ub_offsets[current_pipeline->ub_offset_indices[ub_slot]] = uint32_t(offset);
+		bindUniforms();
+	    }
+
+	    void draw(const KujoGFXDraw &draw)
+	    {
+		int base_element = draw.base_element;
+		int num_elements = draw.num_elements;
+		int num_instances = draw.num_instances;
+
+		if (!is_pass_active)
+		{
+		    return;
+		}
+
+		if (current_pipeline->is_index_active)
+		{
+		    vkCmdDrawIndexed(command_buffer, num_elements, num_instances, base_element, draw.base_vertex, draw.base_instance);
+		}
+		else
+		{
+		    vkCmdDraw(command_buffer, num_elements, num_instances, base_element, draw.base_instance);
+		}
+	    }
+
+	    // The arguments are read by the GPU, unless non-zero base instances
+	    // can't be, in which case they're read here and drawn one by one
+	    bool drawIndirect(KujoGFXBufferHandle handle, uint32_t offset, uint32_t num_draws, uint32_t stride)
+	    {
+		if (!is_pass_active)
+		{
+		    return true;
+		}
+
+		auto buffer = findBuffer(handle);
+
+		if (buffer.buffer == VK_NULL_HANDLE)
+		{
+		    return false;
+		}
+
+		if (!has_draw_indirect_first_instance)
+		{
+		    return drawIndirectFromHost(handle, buffer, offset, num_draws, stride);
+		}
+
+		VkDeviceSize args_offset = (getRegionOffset(buffer) + offset);
+
+		// Without multiDrawIndirect, the draw count has to be 0 or 1
+		uint32_t num_calls = has_multi_draw_indirect ? 1 : num_draws;
+		uint32_t draws_per_call = has_multi_draw_indirect ? num_draws : 1;
+
+		for (uint32_t index = 0; index < num_calls; index++)
+		{
+		    if (current_pipeline->is_index_active)
+		    {
+			vkCmdDrawIndexedIndirect(command_buffer, buffer.buffer, args_offset, draws_per_call, stride);
+		    }
+		    else
+		    {
+			vkCmdDrawIndirect(command_buffer, buffer.buffer, args_offset, draws_per_call, stride);
+		    }
+
+		    args_offset += stride;
+		}
+
+		return true;
+	    }
+
+	    bool drawIndirectFromHost(KujoGFXBufferHandle handle, const VulkanBuffer &buffer, uint32_t offset, uint32_t num_draws, uint32_t stride)
+	    {
+		const uint8_t *args_data = NULL;
+
+		if (buffer.mapped != NULL)
+		{
+		    args_data = (buffer.mapped + getRegionOffset(buffer) + offset);
+		}
+		else if ((handle.getIndex() < indirect_shadows.size()) && !indirect_shadows[handle.getIndex()].empty())
+		{
+		    args_data = (indirect_shadows[handle.getIndex()].data() + offset);
+		}
+		else
+		{
+		    return false;
+		}
+
+		for (uint32_t index = 0; index < num_draws; index++, args_data += stride)
+		{
+		    KujoGFXDraw draw_call;
+
+		    if (current_pipeline->is_index_active)
+		    {
+			KujoGFXDrawIndexedIndirectArgs args;
+			memcpy(&args, args_data, sizeof(args));
+			draw_call = KujoGFXDraw(int(args.base_element), int(args.num_elements), int(args.num_instances), args.base_vertex, int(args.base_instance));
+		    }
+		    else
+		    {
+			KujoGFXDrawIndirectArgs args;
+			memcpy(&args, args_data, sizeof(args));
+			draw_call = KujoGFXDraw(int(args.base_element), int(args.num_elements), int(args.num_instances), 0, int(args.base_instance));
+		    }
+
+		    if ((draw_call.num_elements != 0) && (draw_call.num_instances != 0))
+		    {
+			draw(draw_call);
+		    }
+		}
+
+		return true;
+	    }
+
+	    vector<const char*> getDesiredExtensions()
+	    {
+		vector<const char*> desired_extensions = {
+		    "VK_EXT_debug_report",
+		    "VK_EXT_debug_utils",
+		    #if defined(KUJOGFX_PLATFORM_WINDOWS)
+		    VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
+		    #elif defined(KUJOGFX_PLATFORM_LINUX) || defined(KUJOGFX_PLATFORM_BSD)
+		    #if defined(KUJOGFX_IS_WAYLAND)
+		    VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME,
+		    #elif defined(KUJOGFX_IS_X11)
+		    VK_KHR_XLIB_SURFACE_EXTENSION_NAME,
+		    #endif
+		    #elif defined(KUJOGFX_PLATFORM_MACOS)
+		    VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME,
+		    VK_MVK_MACOS_SURFACE_EXTENSION_NAME,
+		    #else
+		    #error "Vulkan extension collection is unimplemented for this platform"
+		    #endif
+		    VK_KHR_SURFACE_EXTENSION_NAME
+		};
+
+		if (api_version < VK_API_VERSION_1_1)
+		{
+		    desired_extensions.push_back(VK_KHR_MAINTENANCE1_EXTENSION_NAME);
+		}
+
+		return desired_extensions;
+	    }
+
+	    vector<const char*> getDesiredLayers()
+	    {
+		vector<const char*> desired_layers = {
+		    "VK_LAYER_KHRONOS_validation"
+		};
+
+		return desired_layers;
+	    }
+
+	    bool getExtensions(vector<const char*> &extensions)
+	    {
+		uint32_t ext_count = 0;
+		VkResult err = vkEnumerateInstanceExtensionProperties(NULL, &ext_count, NULL);
+
+		if (err != VK_SUCCESS)
+		{
+		    kujogfxlog::error() << "Could not fetch extension properties count!";
+		    return false;
+		}
+
+		vector<VkExtensionProperties> ext_properties(ext_count);
+
+		err = vkEnumerateInstanceExtensionProperties(NULL, &ext_count, ext_properties.data());
+
+		if (err != VK_SUCCESS)
+		{
+		    kujogfxlog::error() << "Could not fetch extension properties!";
+		    return false;
+		}
+
+		vector<const char*> desired_extensions = getDesiredExtensions();
+
+		for (const auto &property : ext_properties)
+		{
+		    string ext_name = property.extensionName;
+
+		    for (const auto &ext : desired_extensions)
+		    {
+			if (ext_name == ext)
+			{
+			    extensions.push_back(ext);
+			    break;
+			}
+		    }
+		}
+
+		return true;
+	    }
+
+	    bool getLayers(vector<const char*> &layers)
+	    {
+		uint32_t layer_count = 0;
+		VkResult err = vkEnumerateInstanceLayerProperties(&layer_count, NULL);
+
+		if (err != VK_SUCCESS)
+		{
+		    kujogfxlog::error() << "Could not fetch layer properties count!";
+		    return false;
+		}
+
+		vector<VkLayerProperties> layer_properties(layer_count);
+		err = vkEnumerateInstanceLayerProperties(&layer_count, layer_properties.data());
+
+		if (err != VK_SUCCESS)
+		{
+		    kujogfxlog::error() << "Could not fetch layer properties!";
+		    return false;
+		}
+
+		vector<const char*> desired_layers = getDesiredLayers();
+
+		for (const auto &property : layer_properties)
+		{
+		    string layer_name = property.layerName;
+
+		    for (const auto &layer : desired_layers)
+		    {
+			if (layer_name == layer)
+			{
+			    layers.push_back(layer);
+			    break;
+			}
+		    }
+		}
+
+		return true;
+	    }
+
+	    bool createInstance()
+	    {
+		VkApplicationInfo app_info = {};
+		app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+		app_info.pApplicationName = "KujoGFX-Vulkan";
+		app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+		app_info.pEngineName = "KujoGFX-Vulkan";
+		app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+		app_info.apiVersion = api_version;
+
+		vector<const char*> extensions;
+
+		if (!getExtensions(extensions))
+		{
+		    return false;
+		}
+
+		vector<const char*> layers;
+
+		if (!getLayers(layers))
+		{
+		    return false;
+		}
+
+		stringstream ext_str;
+		ext_str << "Available extensions: " << endl;
+
+		for (const auto &extension : extensions)
+		{
+		    ext_str << "\t" << extension << endl;
+		}
+
+		kujogfxlog::debug() << ext_str.str();
+
+		stringstream layer_str;
+		layer_str << "Available layers: " << endl;
+
+		for (const auto &layer : layers)
+		{
+		    layer_str << "\t" << layer << endl;
+		}
+
+		kujogfxlog::debug() << layer_str.str();
+
+		VkInstanceCreateInfo create_info = {};
+		create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+		create_info.pApplicationInfo = &app_info;
+
+		#if defined(KUJOGFX_PLATFORM_MACOS)
+		create_info.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
+		#endif
+
+		create_info.enabledExtensionCount = uint32_t(extensions.size());
+		create_info.ppEnabledExtensionNames = extensions.data();
+
+		create_info.enabledLayerCount = uint32_t(layers.size());
+		create_info.ppEnabledLayerNames = layers.data();
+
+		VkResult err = vkCreateInstance(&create_info, NULL, &instance);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::error() << "Could not create instance!";
+		    return false;
+		}
+
+		return true;
+	    }
+
+
+	    bool fetchWindowRes()
+	    {
+		#if defined(KUJOGFX_PLATFORM_WINDOWS)
+		HWND handle = reinterpret_cast<HWND>(win_handle);
+
+		RECT win_rect;
+
+		if (!GetWindowRect(handle, &win_rect))
+		{
+		    return false;
+		}
+
+		window_width = (win_rect.right - win_rect.left);
+		window_height = (win_rect.bottom - win_rect.top);
+		#elif defined(KUJOGFX_PLATFORM_LINUX)
+		#if defined(KUJOGFX_IS_X11)
+		Display *dpy = reinterpret_cast<Display*>(disp_handle);
+		Window win = reinterpret_cast<Window>(win_handle);
+
+		XWindowAttributes attrib;
+		XGetWindowAttributes(dpy, win, &attrib);
+
+		window_width = attrib.width;
+		window_height = attrib.height;
+		#else
+		#error "Vulkan window resolution fetch is unimplemented on Wayland"
+		#endif
+		#else
+		#error "Vulkan window resolution fetch is unimplemented for this platform"
+		#endif
+		return true;
+	    }
+
+	    bool createSurface()
+	    {
+		if (assertVk(fetchWindowRes()))
+		{
+		    kujogfxlog::error() << "Could not fetch window resolution!";
+		    return false;
+		}
+
+		VkResult err = VK_SUCCESS;
+
+		#if defined(KUJOGFX_PLATFORM_WINDOWS)
+		HWND handle = reinterpret_cast<HWND>(win_handle);
+
+		HINSTANCE hInstance = GetModuleHandle(NULL);
+
+		VkWin32SurfaceCreateInfoKHR win32_create_info;
+		win32_create_info.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+		win32_create_info.pNext = NULL;
+		win32_create_info.flags = 0;
+		win32_create_info.hinstance = hInstance;
+		win32_create_info.hwnd = handle;
+
+		err = vkCreateWin32SurfaceKHR(instance, &win32_create_info, NULL, &surface);
+
+		#elif defined(KUJOGFX_PLATFORM_LINUX)
+		#if defined(KUJOGFX_IS_X11)
+		Display *dpy = reinterpret_cast<Display*>(disp_handle);
+		Window win = reinterpret_cast<Window>(win_handle);
+
+		VkXlibSurfaceCreateInfoKHR xlib_create_info;
+		xlib_create_info.sType = VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR;
+		xlib_create_info.pNext = NULL;
+		xlib_create_info.flags = 0;
+		xlib_create_info.dpy = dpy;
+		xlib_create_info.window = win;
+
+		err = vkCreateXlibSurfaceKHR(instance, &xlib_create_info, NULL, &surface);
+
+		#else
+		#error "Vulkan surface creation is unimplemented on Wayland"
+		#endif
+		#else
+		#error "Vulkan surface creation is unimplemented for this platform"
+		#endif
+
+		if (hasFailed(err))
+		{
+		    cout << "Could not create surface!" << endl;
+		    return false;
+		}
+
+		return true;
+	    }
+
+	    int rateDeviceSuitability(VkPhysicalDevice device)
+	    {
+		VkPhysicalDeviceProperties device_properties;
+		vkGetPhysicalDeviceProperties(device, &device_properties);
+
+		int score = 0;
+
+		// Discrete GPUs have a significant performance advantage
+		if (device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+		{
+		    score += 1000;
+		}
+
+		// Maximum possible size of textures affects image quality
+		score += device_properties.limits.maxImageDimension2D;
+		return score;
+	    }
+
+	    bool pickPhysicalDevice()
+	    {
+		uint32_t device_count = 0;
+		VkResult err = vkEnumeratePhysicalDevices(instance, &device_count, NULL);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::error() << "Could not fetch number of physical devices!";
+		    return false;
+		}
+
+		if (assertVk(device_count != 0))
+		{
+		    kujogfxlog::error() << "Could not find any GPUs with Vulkan support!";
+		    return false;
+		}
+
+		vector<VkPhysicalDevice> devices(device_count);
+		err = vkEnumeratePhysicalDevices(instance, &device_count, devices.data());
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::error() << "Could not fetch physical devices!";
+		    return false;
+		}
+
+		multimap<int, VkPhysicalDevice> candidates;
+
+		for (const auto &device : devices)
+		{
+		    int score = rateDeviceSuitability(device);
+		    candidates.insert(make_pair(score, device));
+		}
+
+		if (candidates.rbegin()->first > 0)
+		{
+		    physical_device = candidates.rbegin()->second;
+		}
+		else
+		{
+		    kujogfxlog::error() << "Could not find suitable physical device!";
+		    assertVk(false);
+		    return false;
+		}
+
+		return true;
+	    }
+
+	    bool checkSwapchainSupport()
+	    {
+		uint32_t ext_count = 0;
+		VkResult err = vkEnumerateDeviceExtensionProperties(physical_device, NULL, &ext_count, NULL);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::error() << "Could not fetch physical device extension properties count!";
+		    return false;
+		}
+
+		if (assertVk(ext_count != 0))
+		{
+		    kujogfxlog::error() << "Physical device does not support any extensions!";
+		    return false;
+		}
+
+		vector<VkExtensionProperties> ext_properties(ext_count);
+		err = vkEnumerateDeviceExtensionProperties(physical_device, NULL, &ext_count, ext_properties.data());
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::error() << "Could not fetch physical device extension properties!";
+		    return false;
+		}
+
+		bool has_found_swapchain = false;
+
+		for (const auto &property : ext_properties)
+		{
+		    string ext_name = property.extensionName;
+
+		    if (ext_name == VK_KHR_SWAPCHAIN_EXTENSION_NAME)
+		    {
+			kujogfxlog::debug() << "Swapchain extension found!";
+			has_found_swapchain = true;
+			break;
+		    }
+		}
+
+		if (assertVk(has_found_swapchain))
+		{
+		    kujogfxlog::error() << "Physical device does not support swapchains!";
+		    return false;
+		}
+
+		return true;
+	    }
+
+	    bool findQueueFamilies()
+	    {
+		uint32_t queue_family_count = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, NULL);
+
+		if (assertVk(queue_family_count != 0))
+		{
+		    kujogfxlog::error() << "Physical device has no queue families!";
+		    return false;
+		}
+
+		vector<VkQueueFamilyProperties> queue_family_properties(queue_family_count);
+		vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_family_properties.data());
+
+		bool has_graphics_queue_family = false;
+		bool has_present_queue_family = false;
+
+		for (size_t index = 0; index < queue_family_count; index++)
+		{
+		    // Without a surface, the graphics family doubles as the present family
+		    VkBool32 present_support = is_headless ? VK_TRUE : VK_FALSE;
+
+		    if (!is_headless)
+		    {
+			VkResult err = vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, index, surface, &present_support);
+
+			if (hasFailed(err))
+			{
+			    kujogfxlog::error() << "Could not check if physical device has present support!" << endl;
+			    return false;
+			}
+		    }
+
+		    if ((queue_family_properties[index].queueCount > 0) && (queue_family_properties[index].queueFlags & VK_QUEUE_GRAPHICS_BIT))
+		    {
+			graphics_queue_family = index;
+			has_graphics_queue_family = true;
+
+			if (present_support)
+			{
+			    present_queue_family = index;
+			    has_present_queue_family = true;
+			    break;
+			}
+		    }
+
+		    if (!has_present_queue_family && present_support)
+		    {
+			present_queue_family = index;
+			has_present_queue_family = true;
+		    }
+		}
+
+		if (assertVk(has_graphics_queue_family && has_present_queue_family))
+		{
+		    kujogfxlog::error() << "Could not find valid graphics queue family!";
+		    return false;
+		}
+
+		transfer_queue_family = graphics_queue_family;
+		has_transfer_queue = false;
+
+		#if defined(KUJOGFX_VULKAN_TRANSFER_QUEUE)
+		// A transfer-only family usually maps to a dedicated copy engine
+		for (size_t index = 0; index < queue_family_count; index++)
+		{
+		    VkQueueFlags queue_flags = queue_family_properties[index].queueFlags;
+
+		    if (index == present_queue_family)
+		    {
+			continue;
+		    }
+
+		    if ((queue_family_properties[index].queueCount > 0) && (queue_flags & VK_QUEUE_TRANSFER_BIT) && !(queue_flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+		    {
+			transfer_queue_family = index;
+			has_transfer_queue = true;
+			break;
+		    }
 		}
+		#endif
 
-		VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
-		vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		vertex_input_info.vertexBindingDescriptionCount = uint32_t(vertex_bindings.size());
-		vertex_input_info.pVertexBindingDescriptions = vertex_bindings.data();
-		vertex_input_info.vertexAttributeDescriptionCount = uint32_t(vertex_attribs.size());
-		vertex_input_info.pVertexAttributeDescriptions = vertex_attribs.data();
+		return true;
+	    }
 
-		VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
-		input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-		input_assembly.topology = getTopology(pipeline.primitive_type);
-		input_assembly.primitiveRestartEnable = VK_FALSE;
+	    bool createLogicalDevice()
+	    {
+		float queue_priority = 1.0f;
 
-		VkPipelineViewportStateCreateInfo viewport_state = {};
-		viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-		viewport_state.viewportCount = 1;
-		viewport_state.scissorCount = 1;
+		vector<uint32_t> queue_families = {graphics_queue_family};
 
-		VkPipelineRasterizationStateCreateInfo raster_state = {};
-		raster_state.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-		raster_state.depthClampEnable = VK_FALSE;
-		raster_state.rasterizerDiscardEnable = VK_FALSE;
-		raster_state.polygonMode = VK_POLYGON_MODE_FILL;
-		raster_state.lineWidth = 1.0f;
-		raster_state.cullMode = getCullMode(pipeline.cull_mode);
-		raster_state.frontFace = VK_FRONT_FACE_CLOCKWISE;
-		raster_state.depthBiasEnable = VK_FALSE;
-		raster_state.depthBiasConstantFactor = 0.f;
-		raster_state.depthBiasClamp = 0.f;
-		raster_state.depthBiasSlopeFactor = 0.f;
+		if (present_queue_family != graphics_queue_family)
+		{
+		    queue_families.push_back(present_queue_family);
+		}
 
-		VkPipelineMultisampleStateCreateInfo multisample_state = {};
-		multisample_state.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-		multisample_state.sampleShadingEnable = VK_FALSE;
-		multisample_state.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-		multisample_state.minSampleShading = 1.0f;
-		multisample_state.pSampleMask = NULL;
-		multisample_state.alphaToCoverageEnable = VK_FALSE;
-		multisample_state.alphaToOneEnable = VK_FALSE;
+		if (has_transfer_queue)
+		{
+		    queue_families.push_back(transfer_queue_family);
+		}
 
-		VkPipelineColorBlendAttachmentState color_blend_attachment = {};
-		color_blend_attachment.colorWriteMask = (VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT);
-		color_blend_attachment.blendEnable = VK_FALSE;
-		color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-		color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-		color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
-		color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-		color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-		color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+		vector<VkDeviceQueueCreateInfo> queue_create_info(queue_families.size());
 
-		VkPipelineColorBlendStateCreateInfo color_blend_state = {};
-		color_blend_state.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-		color_blend_state.logicOpEnable = VK_FALSE;
-		color_blend_state.attachmentCount = 1;
-		color_blend_state.pAttachments = &color_blend_attachment;
+		for (size_t i = 0; i < queue_families.size(); i++)
+		{
+		    queue_create_info[i] = {};
+		    queue_create_info[i].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		    queue_create_info[i].queueFamilyIndex = queue_families[i];
+		    queue_create_info[i].queueCount = 1;
+		    queue_create_info[i].pQueuePriorities = &queue_priority;
+		}
 
-		VkPipelineDepthStencilStateCreateInfo depth_stencil_state = {};
-		depth_stencil_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-		depth_stencil_state.depthTestEnable = VK_TRUE;
-		depth_stencil_state.depthWriteEnable = convertBoolVk(pipeline.depth_state.is_write_enabled);
-		depth_stencil_state.depthCompareOp = getCompareOp(pipeline.depth_state.compare_func);
-		depth_stencil_state.depthBoundsTestEnable = VK_FALSE;
-		depth_stencil_state.stencilTestEnable = VK_FALSE;
+		VkPhysicalDeviceFeatures supported_features = {};
+		vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
 
-		VkPipelineLayoutCreateInfo pipeline_layout_info = {};
-		pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		VkPhysicalDeviceFeatures enabled_features = {};
+		enabled_features.multiDrawIndirect = supported_features.multiDrawIndirect;
+		enabled_features.drawIndirectFirstInstance = supported_features.drawIndirectFirstInstance;
+		has_multi_draw_indirect = (supported_features.multiDrawIndirect == VK_TRUE);
+		has_draw_indirect_first_instance = (supported_features.drawIndirectFirstInstance == VK_TRUE);
 
-		VkResult err = vkCreatePipelineLayout(device, &pipeline_layout_info, NULL, &new_pipeline.layout);
+		VkDeviceCreateInfo device_create_info = {};
+		device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+		device_create_info.pQueueCreateInfos = queue_create_info.data();
+		device_create_info.queueCreateInfoCount = uint32_t(queue_create_info.size());
+		device_create_info.pEnabledFeatures = &enabled_features;
+
+		const char *device_extensions = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+
+		device_create_info.enabledExtensionCount = is_headless ? 0 : 1;
+		device_create_info.ppEnabledExtensionNames = &device_extensions;
+
+		VkResult err = vkCreateDevice(physical_device, &device_create_info, NULL, &device);
 
 		if (hasFailed(err))
 		{
-		    kujogfxlog::fatal() << "Could not create pipeline layout!";
+		    kujogfxlog::error() << "Could not create logical device!";
+		    return false;
 		}
 
-		VkGraphicsPipelineCreateInfo pipeline_info = {};
-		pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		pipeline_info.stageCount = 2;
-		pipeline_info.pStages = shader_stages.data();
-		pipeline_info.pVertexInputState = &vertex_input_info;
-		pipeline_info.pInputAssemblyState = &input_assembly;
-		pipeline_info.pViewportState = &viewport_state;
-		pipeline_info.pRasterizationState = &raster_state;
-		pipeline_info.pMultisampleState = &multisample_state;
-		pipeline_info.pColorBlendState = &color_blend_state;
-		pipeline_info.pDepthStencilState = &depth_stencil_state;
-		pipeline_info.pDynamicState = &dynamic_state;
-		pipeline_info.layout = new_pipeline.layout;
-		pipeline_info.renderPass = render_pass;
-		pipeline_info.subpass = 0;
+		vkGetDeviceQueue(device, graphics_queue_family, 0, &graphics_queue);
+		vkGetDeviceQueue(device, present_queue_family, 0, &present_queue);
+		vkGetDeviceQueue(device, transfer_queue_family, 0, &transfer_queue);
 
-		err = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, NULL, &new_pipeline.pipeline);
+		return true;
+	    }
+
+	    bool createSwapchain()
+	    {
+		if (is_headless)
+		{
+		    return createOffscreenImages();
+		}
+
+		VkSurfaceCapabilitiesKHR capabilities;
+
+		VkResult err = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &capabilities);
 
 		if (hasFailed(err))
 		{
-		    kujogfxlog::fatal() << "Could not create graphics pipeline!";
+		    kujogfxlog::error() << "Could not acquire presentation surface capabilities!";
+		    return false;
 		}
 
-		new_pipeline.index_type = getIndexType(pipeline.index_type);
+		uint32_t format_count = 0;
+		err = vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &format_count, NULL);
 
-		// Hack to determine if index buffer is active (because Vulkan doesn't have native support for a 'no indices provided' type
-		// (at least, not without out-of-scope extensions))
-		new_pipeline.is_index_active = (pipeline.index_type != IndexTypeNone);
+		if (hasFailed(err))
+		{
+		    kujogfxlog::error() << "Could not fetch number of supported surface formats!";
+		    return false;
+		}
 
-		vkDestroyShaderModule(device, vert_module, NULL);
-		vkDestroyShaderModule(device, frag_module, NULL);
+		if (assertVk(format_count != 0))
+		{
+		    kujogfxlog::error() << "No supported surface formats found!";
+		    return false;
+		}
 
-		pipelines.insert(make_pair(pipeline.getID(), new_pipeline));
-		current_pipeline = new_pipeline;
-	    }
+		vector<VkSurfaceFormatKHR> surface_formats(format_count);
 
-	    void applyPipeline()
-	    {
-		VkViewport viewport = {};
-		viewport.x = 0.f;
-		viewport.y = static_cast<float>(swapchain_extent.height);
-		viewport.width = static_cast<float>(swapchain_extent.width);
-		viewport.height = -static_cast<float>(swapchain_extent.height);
-		viewport.minDepth = 0.f;
-		viewport.maxDepth = 1.f;
+		err = vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &format_count, surface_formats.data());
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::error() << "Could not fetch supported surface formats!";
+		    return false;
+		}
+
+		uint32_t present_mode_count = 0;
+
+		err = vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &present_mode_count, NULL);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::error() << "Could not fetch supported presentation modes!";
+		    return false;
+		}
+
+		if (assertVk(present_mode_count != 0))
+		{
+		    kujogfxlog::error() << "No supported presentation modes found!";
+		    return false;
+		}
+
+		vector<VkPresentModeKHR> present_modes(present_mode_count);
+
+		err = vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &present_mode_count, present_modes.data());
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::error() << "Could not fetch supported presentation modes!";
+		    return false;
+		}
+
+		uint32_t image_count = (capabilities.minImageCount + 1);
+
+		if ((capabilities.maxImageCount != 0) && (image_count > capabilities.maxImageCount))
+		{
+		    image_count = capabilities.maxImageCount;
+		}
+
+		VkSurfaceFormatKHR surface_format = chooseSurfaceFormat(surface_formats);
+
+		swapchain_image_format = surface_format.format;
+		swapchain_extent = chooseSwapExtent(capabilities);
+
+		if (!(capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+		{
+		    cout << "Warning: swapchain image does not support VK_IMAGE_TRANSFER_DST usage" << endl;
+		}
+
+		VkSurfaceTransformFlagBitsKHR surface_transform;
+
+		if (capabilities.supportedTransforms & VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR)
+		{
+		    surface_transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+		}
+		else
+		{
+		    surface_transform = capabilities.currentTransform;
+		}
+
+		VkPresentModeKHR present_mode = choosePresentMode(present_modes);
+
+		VkSwapchainCreateInfoKHR create_info = {};
+		create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+		create_info.surface = surface;
+		create_info.minImageCount = image_count;
+		create_info.imageFormat = swapchain_image_format;
+		create_info.imageColorSpace = surface_format.colorSpace;
+		create_info.imageExtent = swapchain_extent;
+		create_info.imageArrayLayers = 1;
+		create_info.imageUsage = (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+
+		// Needed to read pixels back from the swapchain images
+		is_swapchain_readable = ((capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0);
+
+		if (is_swapchain_readable)
+		{
+		    create_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		}
+		create_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		create_info.queueFamilyIndexCount = 0;
+		create_info.pQueueFamilyIndices = NULL;
+		create_info.preTransform = surface_transform;
+		create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+		create_info.presentMode = present_mode;
+		create_info.clipped = VK_TRUE;
+		create_info.oldSwapchain = VK_NULL_HANDLE;
+
+		err = vkCreateSwapchainKHR(device, &create_info, NULL, &swapchain);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::error() << "Could not create swapchain!";
+		    return false;
+		}
+
+		uint32_t actual_image_count = 0;
+
+		err = vkGetSwapchainImagesKHR(device, swapchain, &actual_image_count, NULL);
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::error() << "Could not fetch swapchain images count!";
+		    return false;
+		}
+
+		if (assertVk(actual_image_count != 0))
+		{
+		    kujogfxlog::error() << "No swapchain images found!";
+		    return false;
+		}
 
-		VkRect2D scissor = {};
-		scissor.offset = {0, 0};
-		scissor.extent = swapchain_extent;
+		swapchain_images.resize(actual_image_count);
 
-		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, current_pipeline.pipeline);
-		vkCmdSetViewport(command_buffer, 0, 1, &viewport);
-		vkCmdSetScissor(command_buffer, 0, 1, &scissor);
-	    }
+		err = vkGetSwapchainImagesKHR(device, swapchain, &actual_image_count, swapchain_images.data());
 
-	    VkBufferUsageFlags getUsage(KujoGFXBuffer buffer)
-	    {
-		VkBufferUsageFlags flags = 0;
+		if (hasFailed(err))
+		{
+		    kujogfxlog::error() << "Could not acquire swapchain images!";
+		    return false;
+		}
 
-		if (buffer.isIndexBuffer())
+		if (assertVk(createImageViews()))
 		{
-		    flags |= VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+		    return false;
 		}
-		else if (buffer.isVertexBuffer())
+
+		if (assertVk(createDepthResources()))
 		{
-		    flags |= VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+		    return false;
 		}
 
-		return flags;
+		return true;
 	    }
 
-	    void createBuffer(KujoGFXBuffer buffer)
+	    bool createOffscreenImages()
 	    {
-		VulkanBuffer staging_buffer;
-		VkResult err = createBufferVk(buffer.getSize(),
-		    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		    (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
-		    staging_buffer);
+		swapchain_image_format = VK_FORMAT_R8G8B8A8_UNORM;
+		swapchain_extent = {window_width, window_height};
+		swapchain_images.resize(max_frames_in_flight, VK_NULL_HANDLE);
+		offscreen_image_memory.resize(max_frames_in_flight);
 
-		if (hasFailed(err))
+		for (size_t i = 0; i < swapchain_images.size(); i++)
 		{
-		    kujogfxlog::fatal() << "Could not create staging buffer!";
-		}
+		    VkImageUsageFlags usage = (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+		    VkResult err = createImageVk(swapchain_extent.width, swapchain_extent.height, swapchain_image_format, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapchain_images[i], offscreen_image_memory[i]);
 
-		void *mem_data = NULL;
-		vkMapMemory(device, staging_buffer.memory.memory, staging_buffer.memory.offset, buffer.getSize(), 0, &mem_data);
-		memcpy(mem_data, buffer.getData(), buffer.getSize());
-		vkUnmapMemory(device, staging_buffer.memory.memory);
-
-		VulkanBuffer main_buffer;
-		err = createBufferVk(buffer.getSize(),
-		    (VK_BUFFER_USAGE_TRANSFER_DST_BIT | getUsage(buffer)),
-		    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		    main_buffer);
+		    if (hasFailed(err))
+		    {
+			kujogfxlog::error() << "Could not create offscreen images!";
+			return false;
+		    }
+		}
 
-		if (hasFailed(err))
+		if (assertVk(createImageViews()))
 		{
-		    kujogfxlog::fatal() << "Could not create main buffer!";
+		    return false;
 		}
 
-		err = copyBufferVk(staging_buffer, main_buffer, buffer.getSize());
-
-		if (hasFailed(err))
+		if (assertVk(createDepthResources()))
 		{
-		    kujogfxlog::fatal() << "Could not copy buffer data!";
+		    return false;
 		}
 
-		vkDestroyBuffer(device, staging_buffer.buffer, NULL);
-		vkFreeMemory(device, staging_buffer.memory.memory, NULL);
-
-		buffers.insert(make_pair(buffer.getID(), main_buffer));
+		return true;
 	    }
 
-	    VulkanBuffer findBuffer(KujoGFXBuffer buffer)
+	    VkSurfaceFormatKHR chooseSurfaceFormat(const vector<VkSurfaceFormatKHR> &available_formats)
 	    {
-		auto iter = buffers.find(buffer.getID());
+		if ((available_formats.size() == 1) && (available_formats[0].format == VK_FORMAT_UNDEFINED))
+		{
+		    return {VK_FORMAT_B8G8R8A8_UNORM, VK_COLORSPACE_SRGB_NONLINEAR_KHR};
+		}
 
-		if (iter != buffers.end())
+		for (const auto &format : available_formats)
 		{
-		    return iter->second;
+		    if (format.format == VK_FORMAT_B8G8R8A8_UNORM)
+		    {
+			return format;
+		    }
 		}
 
-		return {VK_NULL_HANDLE, {VK_NULL_HANDLE, 0}};
+		return available_formats[0];
 	    }
 
-	    void applyBindings(KujoGFXBindings bindings)
+	    VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &surface_capabilities)
 	    {
-		vector<VkBuffer> vertex_buffers;
-		vector<VkDeviceSize> vertex_offsets;
+		if (int(surface_capabilities.currentExtent.width) == -1)
+		{
+		    VkExtent2D swapchain_extent = {};
 
-		for (size_t index = 0; index < bindings.vertex_buffers.size(); index++)
+		    auto min_extent = surface_capabilities.minImageExtent;
+		    auto max_extent = surface_capabilities.maxImageExtent;
+
+		    swapchain_extent.width = clamp(window_width, min_extent.width, max_extent.width);
+		    swapchain_extent.height = clamp(window_height, min_extent.height, max_extent.height);
+		    return swapchain_extent;
+		}
+		else
 		{
-		    auto buffer = findBuffer(bindings.vertex_buffers.at(index));
+		    return surface_capabilities.currentExtent;
+		}
+	    }
 
-		    if (buffer.buffer != VK_NULL_HANDLE)
+	    VkPresentModeKHR choosePresentMode(const vector<VkPresentModeKHR> present_modes)
+	    {
+		for (const auto &mode : present_modes)
+		{
+		    if (mode == VK_PRESENT_MODE_MAILBOX_KHR)
 		    {
-			vertex_buffers.push_back(buffer.buffer);
-			vertex_offsets.push_back(bindings.vertex_buffer_offsets.at(index));
+			return mode;
 		    }
 		}
 
-		vkCmdBindVertexBuffers(command_buffer, 0, vertex_buffers.size(), vertex_buffers.data(), vertex_offsets.data());
-
-		auto index_buffer = findBuffer(bindings.index_buffer);
+		return VK_PRESENT_MODE_FIFO_KHR;
+	    }
 
-		if (index_buffer.buffer != VK_NULL_HANDLE)
+	    VkFormat findSupportedFormat(const vector<VkFormat> &candidates, VkImageTiling tiling, VkFormatFeatureFlags features)
+	    {
+		for (auto &format : candidates)
 		{
-		    vkCmdBindIndexBuffer(command_buffer, index_buffer.buffer, bindings.index_buffer_offset, current_pipeline.index_type);
+		    VkFormatProperties properties;
+		    vkGetPhysicalDeviceFormatProperties(physical_device, format, &properties);
+
+		    if ((tiling == VK_IMAGE_TILING_LINEAR) && ((properties.linearTilingFeatures & features) == features))
+		    {
+			return format;
+		    }
+		    else if ((tiling == VK_IMAGE_TILING_OPTIMAL) && ((properties.optimalTilingFeatures & features) == features))
+		    {
+			return format;
+		    }
 		}
+
+		assertVk(false);
+		kujogfxlog::fatal() << "Could not find supported format!";
+		return VK_FORMAT_UNDEFINED;
 	    }
 
-	    void applyUniforms(int, KujoGFXData)
+	    VkFormat findDepthFormat()
 	    {
-		return;
+		return findSupportedFormat(
+		    {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
+		    VK_IMAGE_TILING_OPTIMAL,
+		    VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+		);
 	    }
 
-	    void draw(KujoGFXDraw draw)
+	    bool hasStencilComponent(VkFormat format)
 	    {
-		int base_element = draw.base_element;
-		int num_elements = draw.num_elements;
-		int num_instances = draw.num_instances;
+		return ((format == VK_FORMAT_D32_SFLOAT_S8_UINT) || (format == VK_FORMAT_D24_UNORM_S8_UINT));
+	    }
 
-		if (current_pipeline.is_index_active)
-		{
-		    vkCmdDrawIndexed(command_buffer, num_elements, num_instances, base_element, 0, 0);
-		}
-		else
+	    bool createImageViews()
+	    {
+		swapchain_image_views.resize(swapchain_images.size());
+		swapchain_image_layouts.assign(swapchain_images.size(), VK_IMAGE_LAYOUT_UNDEFINED);
+
+		for (size_t i = 0; i < swapchain_images.size(); i++)
 		{
-		    vkCmdDraw(command_buffer, num_elements, num_instances, base_element, 0);
+		    VkResult err = createImageViewVk(swapchain_images.at(i), swapchain_image_format, VK_IMAGE_ASPECT_COLOR_BIT, swapchain_image_views[i]);
+
+		    if (hasFailed(err))
+		    {
+			kujogfxlog::error() << "Could not create swapchain image views!";
+			return false;
+		    }
 		}
+
+		return true;
 	    }
 
-	    void commitFrame()
+	    bool createDepthResources()
 	    {
-		vkDeviceWaitIdle(device);
+		VkFormat depth_format = findDepthFormat();
+		depth_image_format = depth_format;
+		depth_image_layout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-		for (auto &framebuffer : swapchain_framebuffers)
+		VkResult err = createImageVk(swapchain_extent.width, swapchain_extent.height, depth_format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depth_image, depth_image_memory);
+
+		if (hasFailed(err))
 		{
-		    if (framebuffer != VK_NULL_HANDLE)
-		    {
-			vkDestroyFramebuffer(device, framebuffer, NULL);
-			framebuffer = VK_NULL_HANDLE;
-		    }
+		    kujogfxlog::error() << "Could not create depth image!";
+		    return false;
 		}
 
-		if (render_pass != VK_NULL_HANDLE)
+		err = createImageViewVk(depth_image, depth_format, VK_IMAGE_ASPECT_DEPTH_BIT, depth_image_view);
+
+		if (hasFailed(err))
 		{
-		    vkDestroyRenderPass(device, render_pass, NULL);
-		    render_pass = VK_NULL_HANDLE;
+		    kujogfxlog::error() << "Could not create depth image view!";
+		    return false;
 		}
+
+		return true;
 	    }
 
-	    vector<const char*> getDesiredExtensions()
+	    bool createCommandQueues()
 	    {
-		vector<const char*> desired_extensions = {
-		    "VK_EXT_debug_report",
-		    "VK_EXT_debug_utils",
-		    #if defined(KUJOGFX_PLATFORM_WINDOWS)
-		    VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
-		    #elif defined(KUJOGFX_PLATFORM_LINUX) || defined(KUJOGFX_PLATFORM_BSD)
-		    #if defined(KUJOGFX_IS_WAYLAND)
-		    VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME,
-		    #elif defined(KUJOGFX_IS_X11)
-		    VK_KHR_XLIB_SURFACE_EXTENSION_NAME,
-		    #endif
-		    #elif defined(KUJOGFX_PLATFORM_MACOS)
-		    VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME,
-		    VK_MVK_MACOS_SURFACE_EXTENSION_NAME,
-		    #else
-		    #error "Vulkan extension collection is unimplemented for this platform"
-		    #endif
-		    VK_KHR_SURFACE_EXTENSION_NAME
-		};
+		VkCommandPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		pool_info.queueFamilyIndex = present_queue_family;
 
-		if (api_version < VK_API_VERSION_1_1)
+		VkResult err = vkCreateCommandPool(device, &pool_info, NULL, &command_pool);
+
+		if (hasFailed(err))
 		{
-		    desired_extensions.push_back(VK_KHR_MAINTENANCE1_EXTENSION_NAME);
+		    kujogfxlog::error() << "Could not create command pool!";
+		    return false;
 		}
 
-		return desired_extensions;
+		command_buffers.resize(max_frames_in_flight);
+
+		VkCommandBufferAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.commandPool = command_pool;
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		alloc_info.commandBufferCount = uint32_t(command_buffers.size());
+
+		err = vkAllocateCommandBuffers(device, &alloc_info, command_buffers.data());
+
+		if (hasFailed(err))
+		{
+		    kujogfxlog::error() << "Could not allocate command buffers!";
+		    return false;
+		}
+
+		return true;
 	    }
 
-	    vector<const char*> getDesiredLayers()
+	    bool createSyncObjects()
 	    {
-		vector<const char*> desired_layers = {
-		    "VK_LAYER_KHRONOS_validation"
-		};
+		image_available_semaphores.resize(max_frames_in_flight);
+		render_finished_semaphores.resize(max_frames_in_flight);
+		in_flight_fences.resize(max_frames_in_flight);
 
-		return desired_layers;
+		VkSemaphoreCreateInfo semaphore_info = {};
+		semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+		VkFenceCreateInfo fence_info = {};
+		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+		for (size_t i = 0; i < max_frames_in_flight; i++)
+		{
+		    VkResult err = vkCreateSemaphore(device, &semaphore_info, NULL, &image_available_semaphores[i]);
+
+		    if (hasFailed(err))
+		    {
+			kujogfxlog::error() << "Could not create image semaphores!";
+			return false;
+		    }
+
+		    err = vkCreateSemaphore(device, &semaphore_info, NULL, &render_finished_semaphores[i]);
+
+		    if (hasFailed(err))
+		    {
+			kujogfxlog::error() << "Could not create render semaphores!";
+			return false;
+		    }
+
+		    err = vkCreateFence(device, &fence_info, NULL, &in_flight_fences[i]);
+
+		    if (hasFailed(err))
+		    {
+			kujogfxlog::error() << "Could not create fences!";
+			return false;
+		    }
+		}
+
+		return true;
 	    }
 
-	    bool getExtensions(vector<const char*> &extensions)
+	    bool createUploadObjects()
 	    {
-		uint32_t ext_count = 0;
-		VkResult err = vkEnumerateInstanceExtensionProperties(NULL, &ext_count, NULL);
+		VkResult err = createBufferVk((upload_chunk_size * num_upload_batches),
+		    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		    (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+		    staging_ring);
 
-		if (err != VK_SUCCESS)
+		if (hasFailed(err))
 		{
-		    kujogfxlog::error() << "Could not fetch extension properties count!";
+		    kujogfxlog::error() << "Could not create staging ring!";
 		    return false;
 		}
 
-		vector<VkExtensionProperties> ext_properties(ext_count);
+		VkCommandPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		pool_info.queueFamilyIndex = transfer_queue_family;
 
-		err = vkEnumerateInstanceExtensionProperties(NULL, &ext_count, ext_properties.data());
+		err = vkCreateCommandPool(device, &pool_info, NULL, &upload_command_pool);
 
-		if (err != VK_SUCCESS)
+		if (hasFailed(err))
 		{
-		    kujogfxlog::error() << "Could not fetch extension properties!";
+		    kujogfxlog::error() << "Could not create upload command pool!";
 		    return false;
 		}
 
-		vector<const char*> desired_extensions = getDesiredExtensions();
-
-		for (const auto &property : ext_properties)
-		{
-		    string ext_name = property.extensionName;
-
-		    for (const auto &ext : desired_extensions)
-		    {
-			if (ext_name == ext)
-			{
-			    extensions.push_back(ext);
-			    break;
-			}
-		    }
-		}
+		upload_batches.resize(num_upload_batches);
+		vector<VkCommandBuffer> upload_command_buffers(num_upload_batches);
 
-		return true;
-	    }
+		VkCommandBufferAllocateInfo alloc_info = {};
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.commandPool = upload_command_pool;
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		alloc_info.commandBufferCount = uint32_t(upload_command_buffers.size());
 
-	    bool getLayers(vector<const char*> &layers)
-	    {
-		uint32_t layer_count = 0;
-		VkResult err = vkEnumerateInstanceLayerProperties(&layer_count, NULL);
+		err = vkAllocateCommandBuffers(device, &alloc_info, upload_command_buffers.data());
 
-		if (err != VK_SUCCESS)
+		if (hasFailed(err))
 		{
-		    kujogfxlog::error() << "Could not fetch layer properties count!";
+		    kujogfxlog::error() << "Could not allocate upload command buffers!";
 		    return false;
 		}
 
-		vector<VkLayerProperties> layer_properties(layer_count);
-		err = vkEnumerateInstanceLayerProperties(&layer_count, layer_properties.data());
+		VkFenceCreateInfo fence_info = {};
+		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 
-		if (err != VK_SUCCESS)
+		for (uint32_t i = 0; i < num_upload_batches; i++)
 		{
-		    kujogfxlog::error() << "Could not fetch layer properties!";
-		    return false;
-		}
+		    auto &batch = upload_batches[i];
+		    batch.command_buffer = upload_command_buffers[i];
+		    batch.chunk_offset = (i * upload_chunk_size);
 
-		vector<const char*> desired_layers = getDesiredLayers();
+		    err = vkCreateFence(device, &fence_info, NULL, &batch.fence);
 
-		for (const auto &property : layer_properties)
+		    if (hasFailed(err))
+		    {
+			kujogfxlog::error() << "Could not create upload fences!";
+			return false;
+		    }
+		}
+
+		if (has_transfer_queue)
 		{
-		    string layer_name = property.layerName;
+		    upload_finished_semaphores.resize(max_frames_in_flight);
 
-		    for (const auto &layer : desired_layers)
+		    VkSemaphoreCreateInfo semaphore_info = {};
+		    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+		    for (auto &semaphore : upload_finished_semaphores)
 		    {
-			if (layer_name == layer)
+			err = vkCreateSemaphore(device, &semaphore_info, NULL, &semaphore);
+
+			if (hasFailed(err))
 			{
-			    layers.push_back(layer);
-			    break;
+			    kujogfxlog::error() << "Could not create upload semaphores!";
+			    return false;
 			}
 		    }
 		}
@@ -5317,890 +9815,1242 @@ namespace kujogfx
 		return true;
 	    }
 
-	    bool createInstance()
+	    bool createUniformObjects()
 	    {
-		VkApplicationInfo app_info = {};
-		app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-		app_info.pApplicationName = "KujoGFX-Vulkan";
-		app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-		app_info.pEngineName = "KujoGFX-Vulkan";
-		app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-		app_info.apiVersion = api_version;
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physical_device, &properties);
+		uniform_alignment = max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 16);
 
-		vector<const char*> extensions;
+		VkResult err = createBufferVk((uniform_ring_size * max_frames_in_flight),
+		    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		    (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+		    uniform_ring);
 
-		if (!getExtensions(extensions))
+		if (hasFailed(err))
 		{
+		    kujogfxlog::error() << "Could not create uniform ring!";
 		    return false;
 		}
 
-		vector<const char*> layers;
+		VkDescriptorPoolSize pool_size = {};
+		pool_size.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		pool_size.descriptorCount = (max_descriptor_sets * max_uniform_block_bind_slots);
 
-		if (!getLayers(layers))
-		{
-		    return false;
-		}
+		VkDescriptorPoolCreateInfo pool_info = {};
+		pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+		pool_info.maxSets = max_descriptor_sets;
+		pool_info.poolSizeCount = 1;
+		pool_info.pPoolSizes = &pool_size;
 
-		stringstream ext_str;
-		ext_str << "Available extensions: " << endl;
+		err = vkCreateDescriptorPool(device, &pool_info, NULL, &descriptor_pool);
 
-		for (const auto &extension : extensions)
+		if (hasFailed(err))
 		{
-		    ext_str << "\t" << extension << endl;
+		    kujogfxlog::error() << "Could not create descriptor pool!";
+		    return false;
 		}
 
-		kujogfxlog::debug() << ext_str.str();
-
-		stringstream layer_str;
-		layer_str << "Available layers: " << endl;
+		return true;
+	    }
 
-		for (const auto &layer : layers)
+	    void destroyUniformObjects()
+	    {
+		if (descriptor_pool != VK_NULL_HANDLE)
 		{
-		    layer_str << "\t" << layer << endl;
+		    vkDestroyDescriptorPool(device, descriptor_pool, NULL);
+		    descriptor_pool = VK_NULL_HANDLE;
 		}
 
-		kujogfxlog::debug() << layer_str.str();
+		releaseBuffer(uniform_ring);
+	    }
 
-		VkInstanceCreateInfo create_info = {};
-		create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-		create_info.pApplicationInfo = &app_info;
+	    void destroyUploadObjects()
+	    {
+		for (auto &batch : upload_batches)
+		{
+		    for (auto &large_buffer : batch.large_buffers)
+		    {
+			releaseBuffer(large_buffer);
+		    }
 
-		#if defined(KUJOGFX_PLATFORM_MACOS)
-		create_info.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
-		#endif
+		    batch.large_buffers.clear();
 
-		create_info.enabledExtensionCount = uint32_t(extensions.size());
-		create_info.ppEnabledExtensionNames = extensions.data();
+		    if (batch.fence != VK_NULL_HANDLE)
+		    {
+			vkDestroyFence(device, batch.fence, NULL);
+			batch.fence = VK_NULL_HANDLE;
+		    }
 
-		create_info.enabledLayerCount = uint32_t(layers.size());
-		create_info.ppEnabledLayerNames = layers.data();
+		    batch.command_buffer = VK_NULL_HANDLE;
+		    batch.chunk_used = 0;
+		    batch.is_recording = false;
+		    batch.is_pending = false;
+		}
 
-		VkResult err = vkCreateInstance(&create_info, NULL, &instance);
+		for (auto &semaphore : upload_finished_semaphores)
+		{
+		    if (semaphore != VK_NULL_HANDLE)
+		    {
+			vkDestroySemaphore(device, semaphore, NULL);
+			semaphore = VK_NULL_HANDLE;
+		    }
+		}
 
-		if (hasFailed(err))
+		if (upload_command_pool != VK_NULL_HANDLE)
 		{
-		    kujogfxlog::error() << "Could not create instance!";
-		    return false;
+		    vkDestroyCommandPool(device, upload_command_pool, NULL);
+		    upload_command_pool = VK_NULL_HANDLE;
 		}
 
-		return true;
+		upload_batches.clear();
+		releaseBuffer(staging_ring);
+		upload_index = 0;
+		has_unsignaled_uploads = false;
 	    }
+    };
+    #endif
 
-
-	    bool fetchWindowRes()
+    // Records draws on a thread of its own. Each encoder writes to its own
+    // command stream, so any number of them can be filled at the same time,
+    // as long as no two threads use the same encoder.
+    // Encoders don't touch the resource pools, so handles are only
+    // validated once the encoder is executed by KujoGFX::execute()
+    class KujoGFXEncoder
+    {
+	public:
+	    KujoGFXEncoder()
 	    {
-		#if defined(KUJOGFX_PLATFORM_WINDOWS)
-		HWND handle = reinterpret_cast<HWND>(win_handle);
-
-		RECT win_rect;
 
-		if (!GetWindowRect(handle, &win_rect))
-		{
-		    return false;
-		}
+	    }
 
-		window_width = (win_rect.right - win_rect.left);
-		window_height = (win_rect.bottom - win_rect.top);
-		#elif defined(KUJOGFX_PLATFORM_LINUX)
-		#if defined(KUJOGFX_IS_X11)
-		Display *dpy = reinterpret_cast<Display*>(disp_handle);
-		Window win = reinterpret_cast<Window>(win_handle);
+	    void applyPipeline(KujoGFXPipelineHandle pipeline)
+	    {
+		KujoGFXApplyPipelineCommand command;
+		command.pipeline = pipeline;
+		commands.push(CommandApplyPipeline, command);
+	    }
 
-		XWindowAttributes attrib;
-		XGetWindowAttributes(dpy, win, &attrib);
+	    void applyBindings(const KujoGFXBindings &bindings)
+	    {
+		KujoGFXApplyBindingsCommand command;
+		command.bindings = bindings;
+		commands.push(CommandApplyBindings, command);
+	    }
 
-		window_width = attrib.width;
-		window_height = attrib.height;
-		#else
-		#error "Vulkan window resolution fetch is unimplemented on Wayland"
-		#endif
-		#else
-		#error "Vulkan window resolution fetch is unimplemented for this platform"
-		#endif
-		return true;
+	    // The data is copied, since the recording thread's
+	    // buffers can be gone by the time the encoder is replayed
+	    void applyUniforms(int ub_slot, const KujoGFXData &data)
+	    {
+		KujoGFXApplyUniformsCommand command;
+		command.ub_slot = ub_slot;
+		command.data = frame_data.copy(data);
+		commands.push(CommandApplyUniforms, command);
 	    }
 
-	    bool createSurface()
+	    void draw(int base_element, int num_elements, int num_instances, int base_vertex = 0, int base_instance = 0)
 	    {
-		if (assertVk(fetchWindowRes()))
-		{
-		    kujogfxlog::error() << "Could not fetch window resolution!";
-		    return false;
-		}
+		KujoGFXDrawCommand command;
+		command.draw_call = KujoGFXDraw(base_element, num_elements, num_instances, base_vertex, base_instance);
+		commands.push(CommandDraw, command);
+	    }
 
-		VkResult err = VK_SUCCESS;
+	    void multiDraw(const KujoGFXDraw *draws, size_t num_draws)
+	    {
+		KujoGFXData data;
+		data.setData(draws, (num_draws * sizeof(KujoGFXDraw)));
 
-		#if defined(KUJOGFX_PLATFORM_WINDOWS)
-		HWND handle = reinterpret_cast<HWND>(win_handle);
+		KujoGFXMultiDrawCommand command;
+		command.draws = frame_data.copy(data);
+		commands.push(CommandMultiDraw, command);
+	    }
 
-		HINSTANCE hInstance = GetModuleHandle(NULL);
+	    void drawIndirect(KujoGFXBufferHandle buffer, uint32_t offset, uint32_t num_draws, uint32_t stride = 0)
+	    {
+		KujoGFXDrawIndirectCommand command;
+		command.buffer = buffer;
+		command.offset = offset;
+		command.num_draws = num_draws;
+		command.stride = stride;
+		commands.push(CommandDrawIndirect, command);
+	    }
 
-		VkWin32SurfaceCreateInfoKHR win32_create_info;
-		win32_create_info.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
-		win32_create_info.pNext = NULL;
-		win32_create_info.flags = 0;
-		win32_create_info.hinstance = hInstance;
-		win32_create_info.hwnd = handle;
+	    bool empty() const
+	    {
+		return commands.empty();
+	    }
 
-		err = vkCreateWin32SurfaceKHR(instance, &win32_create_info, NULL, &surface);
+	private:
+	    friend class KujoGFX;
+	    KujoGFXCommandStream commands;
+	    KujoGFXDataArena frame_data;
+    };
 
-		#elif defined(KUJOGFX_PLATFORM_LINUX)
-		#if defined(KUJOGFX_IS_X11)
-		Display *dpy = reinterpret_cast<Display*>(disp_handle);
-		Window win = reinterpret_cast<Window>(win_handle);
+    class KujoGFX
+    {
+	public:
+	    KujoGFX()
+	    {
 
-		VkXlibSurfaceCreateInfoKHR xlib_create_info;
-		xlib_create_info.sType = VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR;
-		xlib_create_info.pNext = NULL;
-		xlib_create_info.flags = 0;
-		xlib_create_info.dpy = dpy;
-		xlib_create_info.window = win;
+	    }
 
-		err = vkCreateXlibSurfaceKHR(instance, &xlib_create_info, NULL, &surface);
+	    ~KujoGFX()
+	    {
 
-		#else
-		#error "Vulkan surface creation is unimplemented on Wayland"
-		#endif
-		#else
-		#error "Vulkan surface creation is unimplemented for this platform"
-		#endif
+	    }
 
-		if (hasFailed(err))
-		{
-		    cout << "Could not create surface!" << endl;
-		    return false;
-		}
+	    void setBackend(KujoGFXBackendType type = BackendAuto)
+	    {
+		manual_backend_type = type;
+	    }
 
-		return true;
+	    // Number of frames the CPU may get ahead of the GPU. Must be set before init().
+	    // Higher values give more CPU/GPU overlap at the cost of input latency
+	    void setFrameLatency(uint32_t num_frames)
+	    {
+		frame_latency = num_frames;
 	    }
 
-	    int rateDeviceSuitability(VkPhysicalDevice device)
+	    // Sorts the draws of each pass before replay, so that draws sharing a pipeline,
+	    // and within that the same bindings, reach the backend next to each other.
+	    // Each draw keeps the pipeline, bindings and uniforms it was recorded with.
+	    // Draws with equal state keep their recorded order, and sortBarrier()
+	    // keeps draws that depend on their order, e.g. blended ones, in place.
+	    // Draws are never moved across an execute(), and encoder contents are replayed in recorded order
+	    void setDrawSorting(bool is_enabled)
 	    {
-		VkPhysicalDeviceProperties device_properties;
-		vkGetPhysicalDeviceProperties(device, &device_properties);
+		is_draw_sorting = is_enabled;
+	    }
 
-		int score = 0;
+	    // Merges a draw into the one before it if nothing was recorded in between
+	    // and it continues that draw's element range with the same instance count.
+	    // Off by default. Only the primitive IDs seen by shaders can tell the difference
+	    void setDrawMerging(bool is_enabled)
+	    {
+		is_draw_merging = is_enabled;
+	    }
 
-		// Discrete GPUs have a significant performance advantage
-		if (device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+	    // Must be called before init(). Moves the backend onto a render thread of its own,
+	    // which replays each frame while the calling thread records the next one.
+	    // frame() blocks while max_queued_frames frames are waiting on the render thread,
+	    // bounding the added latency. 0, the default, replays frames inside frame().
+	    // The rendering context belongs to the render thread,
+	    // which also runs the callbacks of readPixelsAsync()
+	    void setRenderThread(uint32_t max_queued_frames)
+	    {
+		#if defined(KUJOGFX_PLATFORM_EMSCRIPTEN)
+		if (max_queued_frames > 0)
 		{
-		    score += 1000;
+		    kujogfxlog::error() << "Render thread mode is unsupported on Emscripten";
 		}
-
-		// Maximum possible size of textures affects image quality
-		score += device_properties.limits.maxImageDimension2D;
-		return score;
+		#else
+		render_queue_depth = max_queued_frames;
+		#endif
 	    }
 
-	    bool pickPhysicalDevice()
+	    bool init(KujoGFXPlatformData data)
 	    {
-		uint32_t device_count = 0;
-		VkResult err = vkEnumeratePhysicalDevices(instance, &device_count, NULL);
-
-		if (hasFailed(err))
+		if (is_initialized)
 		{
-		    kujogfxlog::error() << "Could not fetch number of physical devices!";
-		    return false;
+		    return true;
 		}
 
-		if (assertVk(device_count != 0))
+		if (!validatePlatformData(data))
 		{
-		    kujogfxlog::error() << "Could not find any GPUs with Vulkan support!";
 		    return false;
 		}
 
-		vector<VkPhysicalDevice> devices(device_count);
-		err = vkEnumeratePhysicalDevices(instance, &device_count, devices.data());
-
-		if (hasFailed(err))
+		if (isRenderThreadEnabled())
+		{
+		    if (!startRenderThread())
+		    {
+			return false;
+		    }
+		}
+		else if (!initBackend())
 		{
-		    kujogfxlog::error() << "Could not fetch physical devices!";
 		    return false;
 		}
 
-		multimap<int, VkPhysicalDevice> candidates;
+		is_initialized = true;
+		return true;
+	    }
 
-		for (const auto &device : devices)
+	    void shutdown()
+	    {
+		if (!is_initialized)
 		{
-		    int score = rateDeviceSuitability(device);
-		    candidates.insert(make_pair(score, device));
+		    return;
 		}
 
-		if (candidates.rbegin()->first > 0)
+		if (isRenderThreadEnabled())
 		{
-		    physical_device = candidates.rbegin()->second;
+		    // Frames already handed over are replayed before the backend shuts down
+		    stopRenderThread();
 		}
 		else
 		{
-		    kujogfxlog::error() << "Could not find suitable physical device!";
-		    assertVk(false);
-		    return false;
+		    assert(backend != NULL);
+		    backend->shutdownBackend();
 		}
 
-		return true;
+		if (platform_data.context_handle != NULL)
+		{
+		    platform_data.context_handle = NULL;
+		}
+
+		if (platform_data.window_handle != NULL)
+		{
+		    platform_data.window_handle = NULL;
+		}
+
+		is_initialized = false;
 	    }
 
-	    bool checkSwapchainSupport()
+	    KujoGFXShaderHandle makeShader(const KujoGFXShader &shader)
 	    {
-		uint32_t ext_count = 0;
-		VkResult err = vkEnumerateDeviceExtensionProperties(physical_device, NULL, &ext_count, NULL);
+		auto lock = lockPools();
+		bytes_copied += shaderByteSize(shader);
+		return shader_pool.alloc(shader);
+	    }
 
-		if (hasFailed(err))
+	    // Buffers and pipelines are created on the backend right away,
+	    // so make*() must be called after init(). In render thread mode they are
+	    // created once the frame is replayed, and the handle can be used right away
+	    KujoGFXBufferHandle makeBuffer(const KujoGFXBuffer &buffer)
+	    {
+		if (!is_initialized)
 		{
-		    kujogfxlog::error() << "Could not fetch physical device extension properties count!";
-		    return false;
+		    kujogfxlog::error() << "Could not make buffer before initialization!";
+		    return KujoGFXBufferHandle();
 		}
 
-		if (assertVk(ext_count != 0))
+		if (buffer.getUsage() == BufferUsageImmutable)
 		{
-		    kujogfxlog::error() << "Physical device does not support any extensions!";
-		    return false;
+		    if ((buffer.getData() == NULL) || (buffer.getSize() != buffer.getBufferSize()))
+		    {
+			kujogfxlog::error() << "Could not make immutable buffer without data for all of its contents!";
+			return KujoGFXBufferHandle();
+		    }
+		}
+		else if (buffer.getSize() > buffer.getBufferSize())
+		{
+		    kujogfxlog::error() << "Could not make buffer with initial data larger than the buffer!";
+		    return KujoGFXBufferHandle();
 		}
 
-		vector<VkExtensionProperties> ext_properties(ext_count);
-		err = vkEnumerateDeviceExtensionProperties(physical_device, NULL, &ext_count, ext_properties.data());
-
-		if (hasFailed(err))
+		if (buffer.getBufferSize() == 0)
 		{
-		    kujogfxlog::error() << "Could not fetch physical device extension properties!";
-		    return false;
+		    kujogfxlog::error() << "Could not make buffer with a size of 0!";
+		    return KujoGFXBufferHandle();
 		}
 
-		bool has_found_swapchain = false;
+		BufferSlot slot;
+		slot.desc = buffer;
+		bytes_copied += sizeof(KujoGFXBuffer);
+
+		KujoGFXBufferHandle handle;
 
-		for (const auto &property : ext_properties)
 		{
-		    string ext_name = property.extensionName;
+		    auto lock = lockPools();
+		    handle = buffer_pool.alloc(slot);
+		}
 
-		    if (ext_name == VK_KHR_SWAPCHAIN_EXTENSION_NAME)
-		    {
-			kujogfxlog::debug() << "Swapchain extension found!";
-			has_found_swapchain = true;
-			break;
-		    }
+		if (!handle.isValid())
+		{
+		    return handle;
 		}
 
-		if (assertVk(has_found_swapchain))
+		if (isRenderThreadEnabled())
 		{
-		    kujogfxlog::error() << "Physical device does not support swapchains!";
-		    return false;
+		    KujoGFXCreateBufferCommand command;
+		    command.buffer = handle;
+		    command.desc = buffer;
+		    static_cast<KujoGFXData&>(command.desc) = retainData(buffer);
+		    commands.push(CommandCreateBuffer, command);
+		}
+		else
+		{
+		    backend->createBuffer(handle, buffer);
 		}
 
-		return true;
+		return handle;
 	    }
 
-	    bool findQueueFamilies()
+	    KujoGFXPipelineHandle makePipeline(const KujoGFXPipeline &pipeline)
 	    {
-		uint32_t queue_family_count = 0;
-		vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, NULL);
-
-		if (assertVk(queue_family_count != 0))
+		if (!is_initialized)
 		{
-		    kujogfxlog::error() << "Physical device has no queue families!";
-		    return false;
+		    kujogfxlog::error() << "Could not make pipeline before initialization!";
+		    return KujoGFXPipelineHandle();
 		}
 
-		vector<VkQueueFamilyProperties> queue_family_properties(queue_family_count);
-		vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_family_properties.data());
-
-		bool has_graphics_queue_family = false;
-		bool has_present_queue_family = false;
+		auto lock = lockPools();
+		auto shader = shader_pool.lookup(pipeline.shader);
 
-		for (size_t index = 0; index < queue_family_count; index++)
+		if (shader == NULL)
 		{
-		    VkBool32 present_support = VK_FALSE;
-		    VkResult err = vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, index, surface, &present_support);
+		    kujogfxlog::error() << "Could not make pipeline with invalid shader handle of " << hex << pipeline.shader.id;
+		    return KujoGFXPipelineHandle();
+		}
 
-		    if (hasFailed(err))
-		    {
-			kujogfxlog::error() << "Could not check if physical device has present support!" << endl;
-			return false;
-		    }
+		bytes_copied += sizeof(KujoGFXPipeline);
+		auto handle = pipeline_pool.alloc(pipeline);
 
-		    if ((queue_family_properties[index].queueCount > 0) && (queue_family_properties[index].queueFlags & VK_QUEUE_GRAPHICS_BIT))
-		    {
-			graphics_queue_family = index;
-			has_graphics_queue_family = true;
+		if (!handle.isValid())
+		{
+		    return handle;
+		}
 
-			if (present_support)
-			{
-			    present_queue_family = index;
-			    has_present_queue_family = true;
-			    break;
-			}
-		    }
+		auto desc = pipeline_pool.lookup(handle);
+		initPipelineLayout(*desc);
 
-		    if (!has_present_queue_family && present_support)
-		    {
-			present_queue_family = index;
-			has_present_queue_family = true;
-		    }
+		if (isRenderThreadEnabled())
+		{
+		    KujoGFXCreatePipelineCommand command;
+		    command.pipeline = handle;
+		    commands.push(CommandCreatePipeline, command);
 		}
-
-		if (assertVk(has_graphics_queue_family && has_present_queue_family))
+		else if (!backend->createPipeline(handle, *desc, *shader))
 		{
-		    kujogfxlog::error() << "Could not find valid graphics queue family!";
-		    return false;
+		    pipeline_pool.free(handle);
+		    return KujoGFXPipelineHandle();
 		}
 
-		return true;
+		return handle;
 	    }
 
-	    bool createLogicalDevice()
+	    // Destruction is deferred until the command is replayed in frame(),
+	    // and the backend only releases the GPU object once it is no longer in use.
+	    // The handle becomes stale for all commands recorded after the destroy call
+	    void destroyShader(KujoGFXShaderHandle shader)
 	    {
-		float queue_priority = 1.0f;
-
-		array<VkDeviceQueueCreateInfo, 2> queue_create_info = {{}};
+		KujoGFXDestroyShaderCommand command;
+		command.shader = shader;
+		commands.push(CommandDestroyShader, command);
+	    }
 
-		queue_create_info[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-		queue_create_info[0].queueFamilyIndex = graphics_queue_family;
-		queue_create_info[0].queueCount = 1;
-		queue_create_info[0].pQueuePriorities = &queue_priority;
+	    void destroyBuffer(KujoGFXBufferHandle buffer)
+	    {
+		KujoGFXDestroyBufferCommand command;
+		command.buffer = buffer;
+		commands.push(CommandDestroyBuffer, command);
+	    }
 
-		queue_create_info[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-		queue_create_info[1].queueFamilyIndex = present_queue_family;
-		queue_create_info[1].queueCount = 1;
-		queue_create_info[1].pQueuePriorities = &queue_priority;
+	    void destroyPipeline(KujoGFXPipelineHandle pipeline)
+	    {
+		KujoGFXDestroyPipelineCommand command;
+		command.pipeline = pipeline;
+		commands.push(CommandDestroyPipeline, command);
+	    }
 
-		VkDeviceCreateInfo device_create_info = {};
-		device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-		device_create_info.pQueueCreateInfos = queue_create_info.data();
+	    // Like applyUniforms(), the data is only read when the frame is replayed,
+	    // so it must stay valid until frame() returns. In render thread mode
+	    // the data of all three is copied instead, as frame() returns early.
+	    // Neither function ever waits on the GPU: backends write to memory
+	    // that no frame still in flight can be reading from
+	    void updateBuffer(KujoGFXBufferHandle buffer, const KujoGFXData &data)
+	    {
+		auto lock = lockPools();
+		auto slot = buffer_pool.lookup(buffer);
 
-		if (graphics_queue_family == present_queue_family)
+		if (slot == NULL)
 		{
-		    device_create_info.queueCreateInfoCount = 1;
+		    kujogfxlog::error() << "Could not update buffer with invalid handle of " << hex << buffer.id;
+		    return;
 		}
-		else
+
+		if (slot->desc.getUsage() != BufferUsageDynamic)
 		{
-		    device_create_info.queueCreateInfoCount = 2;
+		    kujogfxlog::error() << "Only dynamic buffers can be updated!";
+		    return;
 		}
 
-		const char *device_extensions = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
-
-		device_create_info.enabledExtensionCount = 1;
-		device_create_info.ppEnabledExtensionNames = &device_extensions;
-
-		VkResult err = vkCreateDevice(physical_device, &device_create_info, NULL, &device);
+		if (slot->update_frame == frame_number)
+		{
+		    kujogfxlog::error() << "Dynamic buffers can only be updated once per frame!";
+		    return;
+		}
 
-		if (hasFailed(err))
+		if (data.getSize() > slot->desc.getBufferSize())
 		{
-		    kujogfxlog::error() << "Could not create logical device!";
-		    return false;
+		    kujogfxlog::error() << "Could not update buffer with data larger than the buffer!";
+		    return;
 		}
 
-		vkGetDeviceQueue(device, graphics_queue_family, 0, &graphics_queue);
-		vkGetDeviceQueue(device, present_queue_family, 0, &present_queue);
+		slot->update_frame = frame_number;
 
-		return true;
+		KujoGFXUpdateBufferCommand command;
+		command.buffer = buffer;
+		command.data = retainData(data);
+		commands.push(CommandUpdateBuffer, command);
 	    }
 
-	    bool createSwapchain()
+	    // Returns the offset of the appended data, to be passed in the bindings.
+	    // Data that doesn't fit into the rest of the buffer is dropped,
+	    // in which case, like on any other error, invalid_append_offset is returned
+	    uint32_t appendBuffer(KujoGFXBufferHandle buffer, const KujoGFXData &data)
 	    {
-		VkSurfaceCapabilitiesKHR capabilities;
-
-		VkResult err = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &capabilities);
+		auto lock = lockPools();
+		auto slot = buffer_pool.lookup(buffer);
 
-		if (hasFailed(err))
+		if (slot == NULL)
 		{
-		    kujogfxlog::error() << "Could not acquire presentation surface capabilities!";
-		    return false;
+		    kujogfxlog::error() << "Could not append to buffer with invalid handle of " << hex << buffer.id;
+		    return invalid_append_offset;
 		}
 
-		uint32_t format_count = 0;
-		err = vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &format_count, NULL);
-
-		if (hasFailed(err))
+		if (slot->desc.getUsage() != BufferUsageStream)
 		{
-		    kujogfxlog::error() << "Could not fetch number of supported surface formats!";
-		    return false;
+		    kujogfxlog::error() << "Only stream buffers can be appended to!";
+		    return invalid_append_offset;
 		}
 
-		if (assertVk(format_count != 0))
+		if (slot->append_frame != frame_number)
 		{
-		    kujogfxlog::error() << "No supported surface formats found!";
-		    return false;
+		    slot->append_frame = frame_number;
+		    slot->append_pos = 0;
 		}
 
-		vector<VkSurfaceFormatKHR> surface_formats(format_count);
-
-		err = vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &format_count, surface_formats.data());
+		uint32_t offset = slot->append_pos;
 
-		if (hasFailed(err))
+		if ((offset + data.getSize()) > slot->desc.getBufferSize())
 		{
-		    kujogfxlog::error() << "Could not fetch supported surface formats!";
-		    return false;
+		    kujogfxlog::error() << "Stream buffer overflow!";
+		    return invalid_append_offset;
 		}
 
-		uint32_t present_mode_count = 0;
+		// Keep every append 4-byte aligned, as required for vertex and index offsets
+		slot->append_pos = uint32_t((offset + data.getSize() + 3) & ~size_t(3));
 
-		err = vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &present_mode_count, NULL);
+		KujoGFXAppendBufferCommand command;
+		command.buffer = buffer;
+		command.offset = offset;
+		command.data = retainData(data);
+		commands.push(CommandAppendBuffer, command);
+		return offset;
+	    }
 
-		if (hasFailed(err))
-		{
-		    kujogfxlog::error() << "Could not fetch supported presentation modes!";
-		    return false;
-		}
+	    void beginPass(KujoGFXPassAction pass_action)
+	    {
+		KujoGFXPass pass;
+		pass.action = pass_action;
+		beginPass(pass);
+	    }
 
-		if (assertVk(present_mode_count != 0))
-		{
-		    kujogfxlog::error() << "No supported presentation modes found!";
-		    return false;
-		}
+	    void beginPass(const KujoGFXPass &pass)
+	    {
+		KujoGFXBeginPassCommand command;
+		command.pass = pass;
+		commands.push(CommandBeginPass, command);
+	    }
 
-		vector<VkPresentModeKHR> present_modes(present_mode_count);
+	    void endPass()
+	    {
+		commands.push(CommandEndPass);
+	    }
 
-		err = vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device, surface, &present_mode_count, present_modes.data());
+	    void applyPipeline(KujoGFXPipelineHandle pipeline)
+	    {
+		KujoGFXApplyPipelineCommand command;
+		command.pipeline = pipeline;
+		commands.push(CommandApplyPipeline, command);
+	    }
 
-		if (hasFailed(err))
+	    void applyBindings(const KujoGFXBindings &bindings)
+	    {
+		KujoGFXApplyBindingsCommand command;
+		command.bindings = bindings;
+		commands.push(CommandApplyBindings, command);
+	    }
+
+	    void applyUniforms(int ub_slot, const KujoGFXData &data)
+	    {
+		KujoGFXApplyUniformsCommand command;
+		command.ub_slot = ub_slot;
+		command.data = retainData(data);
+		commands.push(CommandApplyUniforms, command);
+	    }
+
+	    // With draw sorting enabled, draws are never moved across this point,
+	    // e.g. to keep blended draws behind the opaque ones they cover
+	    void sortBarrier()
+	    {
+		commands.push(CommandSortBarrier);
+	    }
+
+	    // Like applyUniforms(), but the data is copied right away,
+	    // so it can come from a temporary that is gone before frame()
+	    void applyUniformsCopy(int ub_slot, const KujoGFXData &data)
+	    {
+		KujoGFXApplyUniformsCommand command;
+		command.ub_slot = ub_slot;
+		command.data = frame_data.copy(data);
+		commands.push(CommandApplyUniforms, command);
+	    }
+
+	    // Returns 16-byte aligned memory that stays valid until the current frame
+	    // has been replayed, for building payloads in place. It comes out of
+	    // a per-frame arena that is reused once the frame's replay is done,
+	    // so there are no heap allocations once the arena has grown large enough
+	    void *allocTransient(size_t size)
+	    {
+		return frame_data.alloc(size);
+	    }
+
+	    void draw(int base_element, int num_elements, int num_instances, int base_vertex = 0, int base_instance = 0)
+	    {
+		KujoGFXDrawCommand command;
+		command.draw_call = KujoGFXDraw(base_element, num_elements, num_instances, base_vertex, base_instance);
+		commands.push(CommandDraw, command);
+	    }
+
+	    // Issues all of the draws with the current state in a single command.
+	    // The draws are copied, so the array can be reused right away
+	    void multiDraw(const KujoGFXDraw *draws, size_t num_draws)
+	    {
+		KujoGFXData data;
+		data.setData(draws, (num_draws * sizeof(KujoGFXDraw)));
+
+		KujoGFXMultiDrawCommand command;
+		command.draws = frame_data.copy(data);
+		commands.push(CommandMultiDraw, command);
+	    }
+
+	    void multiDraw(const vector<KujoGFXDraw> &draws)
+	    {
+		multiDraw(draws.data(), draws.size());
+	    }
+
+	    // Issues num_draws draws whose arguments are read from an indirect buffer
+	    // when the frame is replayed, stride bytes apart, starting at offset.
+	    // A stride of 0 means tightly packed arguments
+	    void drawIndirect(KujoGFXBufferHandle buffer, uint32_t offset, uint32_t num_draws, uint32_t stride = 0)
+	    {
+		KujoGFXDrawIndirectCommand command;
+		command.buffer = buffer;
+		command.offset = offset;
+		command.num_draws = num_draws;
+		command.stride = stride;
+		commands.push(CommandDrawIndirect, command);
+	    }
+
+	    void commit()
+	    {
+		commands.push(CommandCommit);
+	    }
+
+	    // Reads back the color target as left by the passes recorded before this call.
+	    // The callback runs in a later frame() once the GPU has finished the copy,
+	    // so rendering never stalls on it. It must not record any commands.
+	    // In render thread mode it runs on the render thread
+	    void readPixelsAsync(KujoGFXReadCallback callback)
+	    {
+		KujoGFXReadPixelsCommand command;
+		command.callback_index = uint32_t(read_callbacks.size());
+		read_callbacks.push_back(callback);
+		commands.push(CommandReadPixels, command);
+	    }
+
+	    // Replays the encoder's commands at this point of the current pass.
+	    // Encoders run in the order execute() is called in, no matter which
+	    // thread finished first, so the output is deterministic.
+	    // Each encoder starts without a pipeline, and its state doesn't
+	    // carry over to later commands. The encoder must stay alive until frame()
+	    // is called, which empties it for the next frame. An encoder
+	    // can be executed more than once in the same frame
+	    void execute(KujoGFXEncoder &encoder)
+	    {
+		auto iter = find(executed_encoders.begin(), executed_encoders.end(), &encoder);
+
+		KujoGFXExecuteEncoderCommand command;
+		command.encoder_index = uint32_t(iter - executed_encoders.begin());
+
+		if (iter == executed_encoders.end())
 		{
-		    kujogfxlog::error() << "Could not fetch supported presentation modes!";
-		    return false;
+		    executed_encoders.push_back(&encoder);
 		}
 
-		uint32_t image_count = (capabilities.minImageCount + 1);
+		commands.push(CommandExecuteEncoder, command);
+	    }
+
+	    // Has to be called whenever the window is resized, since
+	    // backends don't query the window size on their own every frame
+	    void resize(int width, int height)
+	    {
+		KujoGFXResizeCommand command;
+		command.width = width;
+		command.height = height;
+		commands.push(CommandResize, command);
+	    }
+
+	    // Hands the recorded frame over for replay. The commands are moved into a
+	    // frame packet, so recording of the next frame can start right away
+	    void frame()
+	    {
+		auto packet = acquirePacket();
+		swap(packet->commands, commands);
+		swap(packet->frame_data, frame_data);
+		swap(packet->read_callbacks, read_callbacks);
+		packet->bytes_copied = bytes_copied;
+		bytes_copied = 0;
 
-		if ((capabilities.maxImageCount != 0) && (image_count > capabilities.maxImageCount))
+		if (packet->encoders.size() < executed_encoders.size())
 		{
-		    image_count = capabilities.maxImageCount;
+		    packet->encoders.resize(executed_encoders.size());
 		}
 
-		VkSurfaceFormatKHR surface_format = chooseSurfaceFormat(surface_formats);
-
-		swapchain_image_format = surface_format.format;
-		swapchain_extent = chooseSwapExtent(capabilities);
-
-		if (!(capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+		for (size_t index = 0; index < executed_encoders.size(); index++)
 		{
-		    cout << "Warning: swapchain image does not support VK_IMAGE_TRANSFER_DST usage" << endl;
+		    auto encoder = executed_encoders[index];
+		    swap(packet->encoders[index].commands, encoder->commands);
+		    swap(packet->encoders[index].frame_data, encoder->frame_data);
 		}
 
-		VkSurfaceTransformFlagBitsKHR surface_transform;
+		executed_encoders.clear();
+		frame_number += 1;
 
-		if (capabilities.supportedTransforms & VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR)
+		if (isRenderThreadEnabled())
 		{
-		    surface_transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+		    {
+			lock_guard<mutex> lock(queue_mutex);
+			queued_packets.push_back(move(packet));
+		    }
+
+		    queue_cond.notify_all();
 		}
 		else
 		{
-		    surface_transform = capabilities.currentTransform;
+		    auto stats = replayFrame(*packet);
+		    recyclePacket(move(packet), stats);
 		}
+	    }
 
-		VkPresentModeKHR present_mode = choosePresentMode(present_modes);
-
-		VkSwapchainCreateInfoKHR create_info = {};
-		create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-		create_info.surface = surface;
-		create_info.minImageCount = image_count;
-		create_info.imageFormat = swapchain_image_format;
-		create_info.imageColorSpace = surface_format.colorSpace;
-		create_info.imageExtent = swapchain_extent;
-		create_info.imageArrayLayers = 1;
-		create_info.imageUsage = (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
-		create_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		create_info.queueFamilyIndexCount = 0;
-		create_info.pQueueFamilyIndices = NULL;
-		create_info.preTransform = surface_transform;
-		create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-		create_info.presentMode = present_mode;
-		create_info.clipped = VK_TRUE;
-		create_info.oldSwapchain = VK_NULL_HANDLE;
-
-		err = vkCreateSwapchainKHR(device, &create_info, NULL, &swapchain);
+	    // Statistics of the most recently replayed frame
+	    KujoGFXFrameStats getFrameStats() const
+	    {
+		lock_guard<mutex> lock(queue_mutex);
+		return frame_stats;
+	    }
 
-		if (hasFailed(err))
+	    // Only filled in by backends that sub-allocate device memory themselves.
+	    // In render thread mode, this is as of the most recently replayed frame
+	    KujoGFXMemoryStats getMemoryStats()
+	    {
+		if (!is_initialized)
 		{
-		    kujogfxlog::error() << "Could not create swapchain!";
-		    return false;
+		    return KujoGFXMemoryStats();
 		}
 
-		uint32_t actual_image_count = 0;
-
-		err = vkGetSwapchainImagesKHR(device, swapchain, &actual_image_count, NULL);
-
-		if (hasFailed(err))
+		if (isRenderThreadEnabled())
 		{
-		    kujogfxlog::error() << "Could not fetch swapchain images count!";
-		    return false;
+		    lock_guard<mutex> lock(queue_mutex);
+		    return memory_stats;
 		}
 
-		if (assertVk(actual_image_count != 0))
-		{
-		    kujogfxlog::error() << "No swapchain images found!";
-		    return false;
-		}
+		return backend->getMemoryStats();
+	    }
 
-		swapchain_images.resize(actual_image_count);
+	private:
+	    KujoGFXBackendType manual_backend_type = BackendAuto;
+	    KujoGFXBackendType backend_type = BackendAuto;
+	    uint32_t frame_latency = 2;
+	    KujoGFXPlatformData platform_data;
+	    unique_ptr<KujoGFXBackend> backend;
 
-		err = vkGetSwapchainImagesKHR(device, swapchain, &actual_image_count, swapchain_images.data());
+	    // Recording state of the current frame, moved into a frame packet by frame()
+	    KujoGFXCommandStream commands;
+	    KujoGFXDataArena frame_data;
+	    vector<KujoGFXReadCallback> read_callbacks;
+	    vector<KujoGFXEncoder*> executed_encoders;
+	    size_t bytes_copied = 0;
+
+	    struct EncoderPacket
+	    {
+		KujoGFXCommandStream commands;
+		KujoGFXDataArena frame_data;
+	    };
+
+	    // Everything a frame needs for its replay. Packets are recycled,
+	    // so their storage is only allocated once
+	    struct FramePacket
+	    {
+		KujoGFXCommandStream commands;
+		KujoGFXDataArena frame_data;
+		vector<KujoGFXReadCallback> read_callbacks;
+		vector<EncoderPacket> encoders;
+		size_t bytes_copied = 0;
+	    };
+
+	    // The packet being replayed
+	    FramePacket *replay_packet = NULL;
+
+	    // A draw of a sorted pass, along with the state it was recorded with.
+	    // The pointers point into the command stream being replayed
+	    struct SortedDraw
+	    {
+		uint64_t key = 0;
+		// A draw, multi-draw or indirect draw command
+		const KujoGFXCommandHeader *header = NULL;
+		KujoGFXPipelineHandle pipeline;
+		const KujoGFXBindings *bindings = NULL;
+		array<const KujoGFXData*, max_uniform_block_bind_slots> uniforms = {};
+	    };
+
+	    // State of a sorted pass in recorded order, and as replayed
+	    struct SortState
+	    {
+		KujoGFXPipelineHandle pipeline;
+		const KujoGFXBindings *bindings = NULL;
+		array<const KujoGFXData*, max_uniform_block_bind_slots> uniforms = {};
+	    };
+
+	    // Draw held back by the merging stage until a command
+	    // that can't be merged into it comes along
+	    bool is_draw_merging = false;
+	    bool is_draw_pending = false;
+	    KujoGFXDraw pending_draw;
+
+	    bool is_draw_sorting = false;
+	    vector<SortedDraw> sorted_draws;
+	    // Bindings of the current segment by hash, giving each distinct set an ID in the sort key
+	    unordered_map<uint64_t, uint32_t> sort_bindings_ids;
+	    SortState recorded_state;
+	    SortState replayed_state;
+
+	    // Render thread mode. Packets wait in the queue, oldest first,
+	    // and are only removed once their replay has finished.
+	    // queue_mutex also guards the free packets and the published stats
+	    uint32_t render_queue_depth = 0;
+	    thread render_thread;
+	    mutable mutex queue_mutex;
+	    condition_variable queue_cond;
+	    deque<unique_ptr<FramePacket>> queued_packets;
+	    vector<unique_ptr<FramePacket>> free_packets;
+	    bool is_render_thread_exiting = false;
+	    KujoGFXMemoryStats memory_stats;
+
+	    // Guards the resource pools, which the recording thread
+	    // allocates from while the render thread validates handles
+	    mutex pool_mutex;
+
+	    struct BufferSlot
+	    {
+		KujoGFXBuffer desc;
+		// Frames in which the buffer was last written to, used to
+		// enforce the per-frame rules of dynamic and stream buffers
+		uint64_t update_frame = UINT64_MAX;
+		uint64_t append_frame = UINT64_MAX;
+		uint32_t append_pos = 0;
+	    };
+
+	    KujoGFXPool<KujoGFXShader, KujoGFXShaderHandle> shader_pool;
+	    KujoGFXPool<BufferSlot, KujoGFXBufferHandle> buffer_pool;
+	    KujoGFXPool<KujoGFXPipeline, KujoGFXPipelineHandle> pipeline_pool;
+
+	    // NULL at the start of every pass, or if the last applied pipeline was invalid,
+	    // in which case bindings, uniforms and draws are skipped until the next valid one.
+	    // Draws are also skipped after bindings with stale buffer handles
+	    KujoGFXPipelineHandle current_pipeline_handle;
+	    const KujoGFXPipeline *current_pipeline = NULL;
+	    bool is_bindings_valid = false;
+
+	    bool is_pass_active = false;
+
+	    KujoGFXFrameStats current_stats;
+	    KujoGFXFrameStats frame_stats;
+
+	    // Number of frames recorded so far
+	    uint64_t frame_number = 0;
 
-		if (hasFailed(err))
-		{
-		    kujogfxlog::error() << "Could not acquire swapchain images!";
-		    return false;
-		}
+	    bool is_initialized = false;
 
-		if (assertVk(createImageViews()))
+	    bool isRenderThreadEnabled() const
+	    {
+		return (render_queue_depth > 0);
+	    }
+
+	    // A no-op without a render thread, where the pools are only used by one thread
+	    unique_lock<mutex> lockPools()
+	    {
+		if (!isRenderThreadEnabled())
 		{
-		    return false;
+		    return unique_lock<mutex>();
 		}
 
-		if (assertVk(createDepthResources()))
+		return unique_lock<mutex>(pool_mutex);
+	    }
+
+	    // Data only has to be copied if the caller might reuse it before the replay
+	    KujoGFXData retainData(const KujoGFXData &data)
+	    {
+		if (!isRenderThreadEnabled() || frame_data.owns(data.getData()))
 		{
-		    return false;
+		    return data;
 		}
 
-		return true;
+		return frame_data.copy(data);
 	    }
 
-	    VkSurfaceFormatKHR chooseSurfaceFormat(const vector<VkSurfaceFormatKHR> &available_formats)
+	    bool initBackend()
 	    {
-		if ((available_formats.size() == 1) && (available_formats[0].format == VK_FORMAT_UNDEFINED))
+		detectBackend();
+
+		if (backend == NULL)
 		{
-		    return {VK_FORMAT_B8G8R8A8_UNORM, VK_COLORSPACE_SRGB_NONLINEAR_KHR};
+		    kujogfxlog::error() << "Could not initialize any backend!";
+		    return false;
 		}
 
-		for (const auto &format : available_formats)
+		if (platform_data.context_handle == NULL)
 		{
-		    if (format.format == VK_FORMAT_B8G8R8A8_UNORM)
-		    {
-			return format;
-		    }
+		    platform_data.context_handle = backend->getContextHandle();
 		}
 
-		return available_formats[0];
+		return true;
 	    }
 
-	    VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &surface_capabilities)
+	    // The backend is initialized on the render thread,
+	    // since rendering contexts are bound to the thread that made them current
+	    bool startRenderThread()
 	    {
-		if (int(surface_capabilities.currentExtent.width) == -1)
-		{
-		    VkExtent2D swapchain_extent = {};
+		promise<bool> init_promise;
+		auto init_future = init_promise.get_future();
+		is_render_thread_exiting = false;
 
-		    auto min_extent = surface_capabilities.minImageExtent;
-		    auto max_extent = surface_capabilities.maxImageExtent;
+		render_thread = thread([this, &init_promise]()
+		{
+		    renderThreadMain(init_promise);
+		});
 
-		    swapchain_extent.width = clamp(window_width, min_extent.width, max_extent.width);
-		    swapchain_extent.height = clamp(window_height, min_extent.height, max_extent.height);
-		    return swapchain_extent;
-		}
-		else
+		if (!init_future.get())
 		{
-		    return surface_capabilities.currentExtent;
+		    render_thread.join();
+		    return false;
 		}
+
+		return true;
 	    }
 
-	    VkPresentModeKHR choosePresentMode(const vector<VkPresentModeKHR> present_modes)
+	    void stopRenderThread()
 	    {
-		for (const auto &mode : present_modes)
 		{
-		    if (mode == VK_PRESENT_MODE_MAILBOX_KHR)
-		    {
-			return mode;
-		    }
+		    lock_guard<mutex> lock(queue_mutex);
+		    is_render_thread_exiting = true;
 		}
 
-		return VK_PRESENT_MODE_FIFO_KHR;
+		queue_cond.notify_all();
+		render_thread.join();
 	    }
 
-	    VkFormat findSupportedFormat(const vector<VkFormat> &candidates, VkImageTiling tiling, VkFormatFeatureFlags features)
+	    void renderThreadMain(promise<bool> &init_promise)
 	    {
-		for (auto &format : candidates)
-		{
-		    VkFormatProperties properties;
-		    vkGetPhysicalDeviceFormatProperties(physical_device, format, &properties);
+		bool is_init_done = initBackend();
+		init_promise.set_value(is_init_done);
 
-		    if ((tiling == VK_IMAGE_TILING_LINEAR) && ((properties.linearTilingFeatures & features) == features))
-		    {
-			return format;
-		    }
-		    else if ((tiling == VK_IMAGE_TILING_OPTIMAL) && ((properties.optimalTilingFeatures & features) == features))
-		    {
-			return format;
-		    }
+		if (!is_init_done)
+		{
+		    return;
 		}
 
-		assertVk(false);
-		kujogfxlog::fatal() << "Could not find supported format!";
-		return VK_FORMAT_UNDEFINED;
-	    }
+		while (true)
+		{
+		    FramePacket *packet = NULL;
 
-	    VkFormat findDepthFormat()
-	    {
-		return findSupportedFormat(
-		    {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
-		    VK_IMAGE_TILING_OPTIMAL,
-		    VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
-		);
-	    }
+		    {
+			unique_lock<mutex> lock(queue_mutex);
+			queue_cond.wait(lock, [this]() { return (!queued_packets.empty() || is_render_thread_exiting); });
 
-	    bool hasStencilComponent(VkFormat format)
-	    {
-		return ((format == VK_FORMAT_D32_SFLOAT_S8_UINT) || (format == VK_FORMAT_D24_UNORM_S8_UINT));
-	    }
+			if (queued_packets.empty())
+			{
+			    break;
+			}
 
-	    bool createImageViews()
-	    {
-		swapchain_image_views.resize(swapchain_images.size());
+			packet = queued_packets.front().get();
+		    }
 
-		for (size_t i = 0; i < swapchain_images.size(); i++)
-		{
-		    VkResult err = createImageViewVk(swapchain_images.at(i), swapchain_image_format, VK_IMAGE_ASPECT_COLOR_BIT, swapchain_image_views[i]);
+		    auto stats = replayFrame(*packet);
+		    auto mem_stats = backend->getMemoryStats();
 
-		    if (hasFailed(err))
 		    {
-			kujogfxlog::error() << "Could not create swapchain image views!";
-			return false;
+			lock_guard<mutex> lock(queue_mutex);
+			auto done_packet = move(queued_packets.front());
+			queued_packets.pop_front();
+			memory_stats = mem_stats;
+			resetPacket(*done_packet);
+			free_packets.push_back(move(done_packet));
+			frame_stats = stats;
 		    }
+
+		    queue_cond.notify_all();
 		}
 
-		return true;
+		backend->shutdownBackend();
 	    }
 
-	    bool createDepthResources()
+	    // Blocks in render thread mode while the queue is full
+	    unique_ptr<FramePacket> acquirePacket()
 	    {
-		VkFormat depth_format = findDepthFormat();
-
-		VkResult err = createImageVk(swapchain_extent.width, swapchain_extent.height, depth_format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depth_image, depth_image_memory);
+		unique_lock<mutex> lock(queue_mutex);
 
-		if (hasFailed(err))
+		if (isRenderThreadEnabled())
 		{
-		    kujogfxlog::error() << "Could not create depth image!";
-		    return false;
+		    queue_cond.wait(lock, [this]() { return (queued_packets.size() < render_queue_depth); });
 		}
 
-		err = createImageViewVk(depth_image, depth_format, VK_IMAGE_ASPECT_DEPTH_BIT, depth_image_view);
-
-		if (hasFailed(err))
+		if (free_packets.empty())
 		{
-		    kujogfxlog::error() << "Could not create depth image view!";
-		    return false;
+		    return unique_ptr<FramePacket>(new FramePacket());
 		}
 
-		return true;
+		auto packet = move(free_packets.back());
+		free_packets.pop_back();
+		return packet;
 	    }
 
-	    bool createCommandQueues()
+	    void recyclePacket(unique_ptr<FramePacket> packet, const KujoGFXFrameStats &stats)
 	    {
-		VkCommandPoolCreateInfo pool_info = {};
-		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-		pool_info.queueFamilyIndex = present_queue_family;
-
-		VkResult err = vkCreateCommandPool(device, &pool_info, NULL, &command_pool);
-
-		if (hasFailed(err))
-		{
-		    kujogfxlog::error() << "Could not create command pool!";
-		    return false;
-		}
-
-		command_buffers.resize(max_frames_in_flight);
-
-		VkCommandBufferAllocateInfo alloc_info = {};
-		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-		alloc_info.commandPool = command_pool;
-		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-		alloc_info.commandBufferCount = uint32_t(command_buffers.size());
+		resetPacket(*packet);
+		lock_guard<mutex> lock(queue_mutex);
+		free_packets.push_back(move(packet));
+		frame_stats = stats;
+	    }
 
-		err = vkAllocateCommandBuffers(device, &alloc_info, command_buffers.data());
+	    void resetPacket(FramePacket &packet)
+	    {
+		packet.commands.reset();
+		packet.frame_data.reset();
+		packet.read_callbacks.clear();
 
-		if (hasFailed(err))
+		for (auto &encoder : packet.encoders)
 		{
-		    kujogfxlog::error() << "Could not allocate command buffers!";
-		    return false;
+		    encoder.commands.reset();
+		    encoder.frame_data.reset();
 		}
 
-		return true;
+		packet.bytes_copied = 0;
 	    }
 
-	    bool createSyncObjects()
+	    // Runs on the render thread in render thread mode, and inside frame() otherwise
+	    KujoGFXFrameStats replayFrame(FramePacket &packet)
 	    {
-		image_available_semaphores.resize(max_frames_in_flight);
-		render_finished_semaphores.resize(max_frames_in_flight);
-		in_flight_fences.resize(max_frames_in_flight);
+		replay_packet = &packet;
 
-		VkSemaphoreCreateInfo semaphore_info = {};
-		semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		KujoGFXFrameStats stats;
+		current_stats = KujoGFXFrameStats();
+		current_stats.bytes_recorded = packet.commands.size();
+		current_stats.bytes_copied = (packet.bytes_copied + packet.frame_data.size());
 
-		VkFenceCreateInfo fence_info = {};
-		fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		auto header = packet.commands.first();
 
-		for (size_t i = 0; i < max_frames_in_flight; i++)
+		while (header != NULL)
 		{
-		    VkResult err = vkCreateSemaphore(device, &semaphore_info, NULL, &image_available_semaphores[i]);
+		    processCommand(header);
+		    current_stats.num_commands += 1;
 
-		    if (hasFailed(err))
+		    if (is_draw_sorting && (header->cmd_type == CommandBeginPass))
 		    {
-			kujogfxlog::error() << "Could not create image semaphores!";
-			return false;
+			header = replaySortedPass(packet.commands, packet.commands.next(header));
 		    }
-
-		    err = vkCreateSemaphore(device, &semaphore_info, NULL, &render_finished_semaphores[i]);
-
-		    if (hasFailed(err))
+		    else
 		    {
-			kujogfxlog::error() << "Could not create render semaphores!";
-			return false;
+			header = packet.commands.next(header);
 		    }
+		}
 
-		    err = vkCreateFence(device, &fence_info, NULL, &in_flight_fences[i]);
+		flushPendingDraw();
+		replay_packet = NULL;
 
-		    if (hasFailed(err))
-		    {
-			kujogfxlog::error() << "Could not create fences!";
-			return false;
-		    }
+		if (backend != NULL)
+		{
+		    backend->fillFrameStats(current_stats);
 		}
 
-		return true;
+		stats = current_stats;
+		current_stats = KujoGFXFrameStats();
+		return stats;
 	    }
-    };
-    #endif
 
-    class KujoGFX
-    {
-	public:
-	    KujoGFX()
+	    // Replays the rest of a pass, up to and including its end.
+	    // Pipeline, bindings, uniform and draw commands are collected into segments,
+	    // which end at sort barriers and at any other command, and the draws of
+	    // each segment are replayed sorted by their key of
+	    // [pipeline index : 20][bindings ID : 20][recorded order : 24]
+	    const KujoGFXCommandHeader *replaySortedPass(const KujoGFXCommandStream &stream, const KujoGFXCommandHeader *header)
 	    {
+		recorded_state = SortState();
+		replayed_state = SortState();
+
+		for (; header != NULL; header = stream.next(header))
+		{
+		    current_stats.num_commands += 1;
+
+		    switch (header->cmd_type)
+		    {
+			case CommandApplyPipeline:
+			{
+			    auto &command = KujoGFXCommandStream::payload<KujoGFXApplyPipelineCommand>(header);
+			    recorded_state.pipeline = command.pipeline;
+			    recorded_state.uniforms.fill(NULL);
+			    current_stats.num_pipeline_changes_recorded += 1;
+			}
+			break;
+			case CommandApplyBindings:
+			{
+			    auto &command = KujoGFXCommandStream::payload<KujoGFXApplyBindingsCommand>(header);
+			    recorded_state.bindings = &command.bindings;
+			    current_stats.num_bindings_changes_recorded += 1;
+			}
+			break;
+			case CommandApplyUniforms:
+			{
+			    auto &command = KujoGFXCommandStream::payload<KujoGFXApplyUniformsCommand>(header);
 
-	    }
+			    if ((command.ub_slot < 0) || (uint32_t(command.ub_slot) >= max_uniform_block_bind_slots))
+			    {
+				kujogfxlog::error() << "Could not apply uniforms to invalid slot of " << dec << command.ub_slot;
+				break;
+			    }
 
-	    ~KujoGFX()
-	    {
+			    recorded_state.uniforms[command.ub_slot] = &command.data;
+			}
+			break;
+			case CommandDraw:
+			case CommandMultiDraw:
+			case CommandDrawIndirect: addSortedDraw(header); break;
+			case CommandSortBarrier: flushSortedDraws(); break;
+			default:
+			{
+			    flushSortedDraws();
+			    processCommand(header);
 
-	    }
+			    // Commands like encoder executions reset the frontend's pipeline
+			    replayed_state = SortState();
 
-	    void setBackend(KujoGFXBackendType type = BackendAuto)
-	    {
-		manual_backend_type = type;
+			    if (header->cmd_type == CommandEndPass)
+			    {
+				return stream.next(header);
+			    }
+			}
+			break;
+		    }
+		}
+
+		flushSortedDraws();
+		return NULL;
 	    }
 
-	    bool init(KujoGFXPlatformData data)
+	    void addSortedDraw(const KujoGFXCommandHeader *header)
 	    {
-		if (is_initialized)
+		if (sorted_draws.empty())
 		{
-		    return true;
+		    sort_bindings_ids.clear();
 		}
 
-		if (!validatePlatformData(data))
-		{
-		    return false;
-		}
+		uint32_t bindings_id = 0;
 
-		detectBackend();
+		if (recorded_state.bindings != NULL)
+		{
+		    uint64_t hash = getBindingsHash(*recorded_state.bindings);
+		    auto iter = sort_bindings_ids.find(hash);
 
-		assert(backend != NULL);
+		    if (iter == sort_bindings_ids.end())
+		    {
+			iter = sort_bindings_ids.insert(make_pair(hash, uint32_t(sort_bindings_ids.size() + 1))).first;
+		    }
 
-		if (platform_data.context_handle == NULL)
-		{
-		    platform_data.context_handle = backend->getContextHandle();
+		    bindings_id = iter->second;
 		}
 
-		is_initialized = true;
-		return true;
+		SortedDraw sorted_draw;
+		sorted_draw.key = ((uint64_t(recorded_state.pipeline.getIndex()) << 44) |
+		    (uint64_t(bindings_id & handle_index_mask) << 24) |
+		    uint64_t(min<size_t>(sorted_draws.size(), 0xFFFFFF)));
+		sorted_draw.header = header;
+		sorted_draw.pipeline = recorded_state.pipeline;
+		sorted_draw.bindings = recorded_state.bindings;
+		sorted_draw.uniforms = recorded_state.uniforms;
+		sorted_draws.push_back(sorted_draw);
 	    }
 
-	    void shutdown()
+	    void flushSortedDraws()
 	    {
-		if (!is_initialized)
+		if (sorted_draws.empty())
 		{
 		    return;
 		}
 
-		assert(backend != NULL);
-		backend->shutdownBackend();
-
-		if (platform_data.context_handle != NULL)
+		sort(sorted_draws.begin(), sorted_draws.end(), [](const SortedDraw &a, const SortedDraw &b) -> bool
 		{
-		    platform_data.context_handle = NULL;
-		}
+		    return (a.key < b.key);
+		});
 
-		if (platform_data.window_handle != NULL)
+		for (auto &sorted_draw : sorted_draws)
 		{
-		    platform_data.window_handle = NULL;
-		}
-
-		is_initialized = false;
-	    }
+		    if (sorted_draw.pipeline != replayed_state.pipeline)
+		    {
+			applyPipelineCmd(sorted_draw.pipeline);
+			replayed_state.pipeline = sorted_draw.pipeline;
+			replayed_state.bindings = NULL;
+			replayed_state.uniforms.fill(NULL);
+		    }
 
-	    void beginPass(KujoGFXPassAction pass_action)
-	    {
-		KujoGFXPass pass;
-		pass.action = pass_action;
-		beginPass(pass);
-	    }
+		    auto bindings = sorted_draw.bindings;
 
-	    void beginPass(KujoGFXPass pass)
-	    {
-		KujoGFXCommand command(pass);
-		commands.push_back(command);
-	    }
+		    if ((bindings != NULL) && ((replayed_state.bindings == NULL) || (memcmp(bindings, replayed_state.bindings, sizeof(KujoGFXBindings)) != 0)))
+		    {
+			applyBindingsCmd(*bindings);
+			replayed_state.bindings = bindings;
+		    }
 
-	    void endPass()
-	    {
-		KujoGFXCommand command(CommandEndPass);
-		commands.push_back(command);
-	    }
+		    for (uint32_t slot = 0; slot < max_uniform_block_bind_slots; slot++)
+		    {
+			auto data = sorted_draw.uniforms[slot];
+			auto replayed_data = replayed_state.uniforms[slot];
 
-	    void applyPipeline(KujoGFXPipeline pipeline)
-	    {
-		KujoGFXCommand command(pipeline);
-		commands.push_back(command);
-	    }
+			// The same memory holds the same contents until the replay is over
+			if ((data == NULL) || ((replayed_data != NULL) && (data->getData() == replayed_data->getData()) && (data->getSize() == replayed_data->getSize())))
+			{
+			    continue;
+			}
 
-	    void applyBindings(KujoGFXBindings bindings)
-	    {
-		KujoGFXCommand command(bindings);
-		commands.push_back(command);
-	    }
+			applyUniformsCmd(int(slot), *data);
+			replayed_state.uniforms[slot] = data;
+		    }
 
-	    void applyUniforms(int ub_slot, KujoGFXData data)
-	    {
-		KujoGFXCommand command(ub_slot, data);
-		commands.push_back(command);
-	    }
+		    processCommand(sorted_draw.header);
+		}
 
-	    void draw(int base_element, int num_elements, int num_instances)
-	    {
-		KujoGFXCommand command(KujoGFXDraw(base_element, num_elements, num_instances));
-		commands.push_back(command);
+		current_stats.num_sorted_draws += sorted_draws.size();
+		sorted_draws.clear();
 	    }
 
-	    void commit()
+	    uint64_t getBindingsHash(const KujoGFXBindings &bindings)
 	    {
-		KujoGFXCommand command(CommandCommit);
-		commands.push_back(command);
-	    }
+		// FNV-1a
+		uint64_t hash = 0xCBF29CE484222325ULL;
+		auto bytes = reinterpret_cast<const uint8_t*>(&bindings);
 
-	    void frame()
-	    {
-		while (!commands.empty())
+		for (size_t index = 0; index < sizeof(KujoGFXBindings); index++)
 		{
-		    KujoGFXCommand command = commands.front();
-		    commands.pop_front();
-		    processCommand(command);
+		    hash ^= bytes[index];
+		    hash *= 0x100000001B3ULL;
 		}
-	    }
-
-	private:
-	    KujoGFXBackendType manual_backend_type = BackendAuto;
-	    KujoGFXBackendType backend_type = BackendAuto;
-	    KujoGFXPlatformData platform_data;
-	    unique_ptr<KujoGFXBackend> backend;
-
-	    deque<KujoGFXCommand> commands;
-
-	    unordered_map<uint32_t, KujoGFXPipeline> pipeline_cache;
-	    KujoGFXPipeline current_pipeline;
 
-	    unordered_map<uint32_t, KujoGFXBuffer> buffer_cache;
-
-	    bool is_initialized = false;
+		return hash;
+	    }
 
 	    bool validatePlatformData(KujoGFXPlatformData data)
 	    {
-		if (data.window_handle == NULL)
+		if (data.is_headless)
+		{
+		    if ((data.width <= 0) || (data.height <= 0))
+		    {
+			kujogfxlog::error() << "Headless framebuffer size is not set";
+			return false;
+		    }
+		}
+		else if (data.window_handle == NULL)
 		{
 		    kujogfxlog::error() << "Window handle is not set";
 		    return false;
@@ -6249,6 +11099,15 @@ namespace kujogfx
 
 		    if (backend_ptr != NULL)
 		    {
+			backend_ptr->setFrameLatency(frame_latency);
+
+			if (platform_data.is_headless && !backend_ptr->setHeadless(platform_data.width, platform_data.height))
+			{
+			    delete backend_ptr;
+			    backend_ptr = NULL;
+			    continue;
+			}
+
 			if (backend_ptr->initBackend(platform_data.window_handle, platform_data.display_handle))
 			{
 			    platform_data.context_handle = backend_ptr->getContextHandle();
@@ -6344,119 +11203,336 @@ namespace kujogfx
 		    score += 10;
 		}
 
-		#elif defined(KUJOGFX_PLATFORM_LINUX) || defined(KUJOGFX_PLATFORM_BSD)
+		#elif defined(KUJOGFX_PLATFORM_LINUX) || defined(KUJOGFX_PLATFORM_BSD)
+
+		if (isBackendSelected(BackendVulkan))
+		{
+		    score += 20;
+		}
+		else if (isBackendSelected(BackendOpenGL))
+		{
+		    score += 10;
+		}
+
+		#elif defined(KUJOGFX_PLATFORM_MACOS)
+
+		if (isBackendSelected(BackendVulkan))
+		{
+		    score += 10;
+		}
+
+		#elif defined(KUJOGFX_PLATFORM_ANDROID)
+
+		if (isBackendSelected(BackendVulkan))
+		{
+		    score += 20;
+		}
+		else if (isBackendSelected(BackendOpenGL))
+		{
+		    score += 10;
+		}
+
+		#elif defined(KUJOGFX_PLATFORM_EMSCRIPTEN)
+		if (isBackendSelected(BackendOpenGL))
+		{
+		    score += 10;
+		}
+		#endif
+		return score;
+	    }
+
+	    uint16_t getWindowsVersion()
+	    {
+		#if defined(KUJOGFX_PLATFORM_WINDOWS)
+		RTL_OSVERSIONINFOW os_vers;
+		ZeroMemory(&os_vers, sizeof(os_vers));
+		os_vers.dwOSVersionInfoSize = sizeof(os_vers);
+		const HMODULE hmodule = GetModuleHandle("ntdll.dll");
+
+		if (hmodule == NULL)
+		{
+		    kujogfxlog::error() << "Could not fetch ntdll handle!";
+		    return 0;
+		}
+
+		FARPROC (WINAPI *rtlGetVersion_ptr)(PRTL_OSVERSIONINFOW) = reinterpret_cast<FARPROC (WINAPI*)(PRTL_OSVERSIONINFOW)>(GetProcAddress(hmodule, "RtlGetVersion"));
+
+		if (rtlGetVersion_ptr == NULL)
+		{
+		    kujogfxlog::error() << "Could not fetch address of RtlGetVersion()";
+		    return 0;
+		}
+
+		rtlGetVersion_ptr(&os_vers);
+
+		if (os_vers.dwMajorVersion == 0)
+		{
+		    kujogfxlog::error() << "Call to rtlGetVersion() failed!";
+		    return 0;
+		}
+
+		uint16_t major_version = uint8_t(os_vers.dwMajorVersion);
+		uint16_t minor_version = uint8_t(os_vers.dwMinorVersion);
+		return ((major_version << 8) | minor_version);
+		#else
+		return 0;
+		#endif
+	    }
+
+	    void processCommand(const KujoGFXCommandHeader *header)
+	    {
+		if (header->cmd_type != CommandDraw)
+		{
+		    flushPendingDraw();
+		}
+
+		switch (header->cmd_type)
+		{
+		    case CommandNop: break;
+		    case CommandBeginPass:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXBeginPassCommand>(header);
+			beginPassCmd(command.pass);
+		    }
+		    break;
+		    case CommandEndPass: endPassCmd(); break;
+		    case CommandCommit: commitFrameCmd(); break;
+		    case CommandApplyPipeline:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXApplyPipelineCommand>(header);
+			current_stats.num_pipeline_changes_recorded += 1;
+			applyPipelineCmd(command.pipeline);
+		    }
+		    break;
+		    case CommandApplyBindings:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXApplyBindingsCommand>(header);
+			current_stats.num_bindings_changes_recorded += 1;
+			applyBindingsCmd(command.bindings);
+		    }
+		    break;
+		    case CommandApplyUniforms:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXApplyUniformsCommand>(header);
+			applyUniformsCmd(command.ub_slot, command.data);
+		    }
+		    break;
+		    case CommandDraw:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXDrawCommand>(header);
+			drawCmd(command.draw_call);
+		    }
+		    break;
+		    case CommandDestroyShader:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXDestroyShaderCommand>(header);
+			destroyShaderCmd(command.shader);
+		    }
+		    break;
+		    case CommandDestroyBuffer:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXDestroyBufferCommand>(header);
+			destroyBufferCmd(command.buffer);
+		    }
+		    break;
+		    case CommandDestroyPipeline:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXDestroyPipelineCommand>(header);
+			destroyPipelineCmd(command.pipeline);
+		    }
+		    break;
+		    case CommandUpdateBuffer:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXUpdateBufferCommand>(header);
+			updateBufferCmd(command.buffer, command.data);
+		    }
+		    break;
+		    case CommandAppendBuffer:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXAppendBufferCommand>(header);
+			appendBufferCmd(command.buffer, command.offset, command.data);
+		    }
+		    break;
+		    case CommandResize:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXResizeCommand>(header);
+			resizeCmd(command.width, command.height);
+		    }
+		    break;
+		    case CommandReadPixels:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXReadPixelsCommand>(header);
+			readPixelsCmd(command.callback_index);
+		    }
+		    break;
+		    case CommandExecuteEncoder:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXExecuteEncoderCommand>(header);
+			executeEncoderCmd(command.encoder_index);
+		    }
+		    break;
+		    case CommandCreateBuffer:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXCreateBufferCommand>(header);
+			createBufferCmd(command.buffer, command.desc);
+		    }
+		    break;
+		    case CommandCreatePipeline:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXCreatePipelineCommand>(header);
+			createPipelineCmd(command.pipeline);
+		    }
+		    break;
+		    case CommandSortBarrier: break;
+		    case CommandMultiDraw:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXMultiDrawCommand>(header);
+			multiDrawCmd(command.draws);
+		    }
+		    break;
+		    case CommandDrawIndirect:
+		    {
+			auto &command = KujoGFXCommandStream::payload<KujoGFXDrawIndirectCommand>(header);
+			drawIndirectCmd(command);
+		    }
+		    break;
+		    default:
+		    {
+			kujogfxlog::fatal() << "Unrecognized command of " << dec << int(header->cmd_type);
+			throw runtime_error("KujoGFX error");
+		    }
+		    break;
+		}
+	    }
+
+	    void beginPassCmd(const KujoGFXPass &pass)
+	    {
+		assert(backend != NULL);
+		current_pipeline_handle = KujoGFXPipelineHandle();
+		current_pipeline = NULL;
+		is_bindings_valid = false;
+		is_pass_active = true;
+		backend->beginPass(pass);
+	    }
+
+	    void endPassCmd()
+	    {
+		assert(backend != NULL);
+		is_pass_active = false;
+		backend->endPass();
+	    }
 
-		if (isBackendSelected(BackendVulkan))
-		{
-		    score += 20;
-		}
-		else if (isBackendSelected(BackendOpenGL))
+	    void executeEncoderCmd(uint32_t encoder_index)
+	    {
+		assert((backend != NULL) && (replay_packet != NULL));
+		auto encoder = &replay_packet->encoders.at(encoder_index);
+
+		if (!is_pass_active)
 		{
-		    score += 10;
+		    kujogfxlog::error() << "Encoders can only be executed inside a pass!";
+		    return;
 		}
 
-		#elif defined(KUJOGFX_PLATFORM_MACOS)
+		current_stats.bytes_recorded += encoder->commands.size();
+		current_stats.bytes_copied += encoder->frame_data.size();
 
-		if (isBackendSelected(BackendVulkan))
+		if (encoder->commands.empty())
 		{
-		    score += 10;
+		    return;
 		}
 
-		#elif defined(KUJOGFX_PLATFORM_ANDROID)
+		current_pipeline_handle = KujoGFXPipelineHandle();
+		current_pipeline = NULL;
+		is_bindings_valid = false;
 
-		if (isBackendSelected(BackendVulkan))
-		{
-		    score += 20;
-		}
-		else if (isBackendSelected(BackendOpenGL))
+		for (auto header = encoder->commands.first(); header != NULL; header = encoder->commands.next(header))
 		{
-		    score += 10;
+		    processCommand(header);
+		    current_stats.num_commands += 1;
 		}
 
-		#elif defined(KUJOGFX_PLATFORM_EMSCRIPTEN)
-		if (isBackendSelected(BackendOpenGL))
-		{
-		    score += 10;
-		}
-		#endif
-		return score;
+		flushPendingDraw();
+		current_pipeline_handle = KujoGFXPipelineHandle();
+		current_pipeline = NULL;
+		is_bindings_valid = false;
 	    }
 
-	    uint16_t getWindowsVersion()
+	    void commitFrameCmd()
 	    {
-		#if defined(KUJOGFX_PLATFORM_WINDOWS)
-		RTL_OSVERSIONINFOW os_vers;
-		ZeroMemory(&os_vers, sizeof(os_vers));
-		os_vers.dwOSVersionInfoSize = sizeof(os_vers);
-		const HMODULE hmodule = GetModuleHandle("ntdll.dll");
+		assert(backend != NULL);
+		backend->commitFrame();
+	    }
 
-		if (hmodule == NULL)
+	    void resizeCmd(int width, int height)
+	    {
+		assert(backend != NULL);
+
+		if ((width <= 0) || (height <= 0))
 		{
-		    kujogfxlog::error() << "Could not fetch ntdll handle!";
-		    return 0;
+		    kujogfxlog::error() << "Invalid window size of " << dec << width << "x" << height;
+		    return;
 		}
 
-		FARPROC (WINAPI *rtlGetVersion_ptr)(PRTL_OSVERSIONINFOW) = reinterpret_cast<FARPROC (WINAPI*)(PRTL_OSVERSIONINFOW)>(GetProcAddress(hmodule, "RtlGetVersion"));
+		backend->resize(width, height);
+	    }
 
-		if (rtlGetVersion_ptr == NULL)
+	    void readPixelsCmd(uint32_t callback_index)
+	    {
+		assert((backend != NULL) && (replay_packet != NULL));
+
+		if (!backend->readPixels(move(replay_packet->read_callbacks.at(callback_index))))
 		{
-		    kujogfxlog::error() << "Could not fetch address of RtlGetVersion()";
-		    return 0;
+		    kujogfxlog::error() << "Could not read pixels!";
 		}
+	    }
 
-		rtlGetVersion_ptr(&os_vers);
+	    void createBufferCmd(KujoGFXBufferHandle handle, const KujoGFXBuffer &desc)
+	    {
+		assert(backend != NULL);
 
-		if (os_vers.dwMajorVersion == 0)
+		// Destroyed by an earlier command before it was ever created
+		if (!isBufferValid(handle))
 		{
-		    kujogfxlog::error() << "Call to rtlGetVersion() failed!";
-		    return 0;
+		    return;
 		}
 
-		uint16_t major_version = uint8_t(os_vers.dwMajorVersion);
-		uint16_t minor_version = uint8_t(os_vers.dwMinorVersion);
-		return ((major_version << 8) | minor_version);
-		#else
-		return 0;
-		#endif
+		backend->createBuffer(handle, desc);
 	    }
 
-	    void processCommand(KujoGFXCommand cmd)
+	    void createPipelineCmd(KujoGFXPipelineHandle handle)
 	    {
-		switch (cmd.cmd_type)
+		assert(backend != NULL);
+		KujoGFXPipeline pipeline;
+		KujoGFXShader shader;
+
+		// Copied out, so that the pools aren't held while the backend compiles
 		{
-		    case CommandNop: break;
-		    case CommandBeginPass: beginPassCmd(cmd.current_pass); break;
-		    case CommandEndPass: endPassCmd(); break;
-		    case CommandCommit: commitFrameCmd(); break;
-		    case CommandApplyPipeline: applyPipelineCmd(cmd.current_pipeline); break;
-		    case CommandApplyBindings: applyBindingsCmd(cmd.current_bindings); break;
-		    case CommandApplyUniforms: applyUniformsCmd(cmd.current_uniform_slot, cmd.current_uniform_data); break;
-		    case CommandDraw: drawCmd(cmd.current_draw_call); break;
-		    default:
+		    auto lock = lockPools();
+		    auto desc = pipeline_pool.lookup(handle);
+
+		    if (desc == NULL)
 		    {
-			kujogfxlog::fatal() << "Unrecognized command of " << dec << int(cmd.cmd_type);
-			throw runtime_error("KujoGFX error");
+			return;
 		    }
-		    break;
-		}
-	    }
 
-	    void beginPassCmd(KujoGFXPass pass)
-	    {
-		assert(backend != NULL);
-		backend->beginPass(pass);
-	    }
+		    auto shader_desc = shader_pool.lookup(desc->shader);
 
-	    void endPassCmd()
-	    {
-		assert(backend != NULL);
-		backend->endPass();
-	    }
+		    if (shader_desc == NULL)
+		    {
+			kujogfxlog::error() << "Could not create pipeline whose shader was destroyed before the replay!";
+			return;
+		    }
 
-	    void commitFrameCmd()
-	    {
-		assert(backend != NULL);
-		backend->commitFrame();
+		    pipeline = *desc;
+		    shader = *shader_desc;
+		}
+
+		// The handle was already returned, so it goes stale instead
+		if (!backend->createPipeline(handle, pipeline, shader))
+		{
+		    auto lock = lockPools();
+		    pipeline_pool.free(handle);
+		}
 	    }
 
 	    size_t vertexFormatByteSize(KujoGFXVertexFormat format)
@@ -6471,9 +11547,24 @@ namespace kujogfx
 		}
 	    }
 
-	    KujoGFXPipeline createPipeline(KujoGFXPipeline pipeline)
+	    size_t shaderByteSize(const KujoGFXShader &shader)
+	    {
+		size_t byte_size = sizeof(KujoGFXShader);
+
+		for (auto code : {&shader.vert_code, &shader.frag_code})
+		{
+		    byte_size += code->glsl_code.size();
+		    byte_size += code->glsl_es_code.size();
+		    byte_size += code->hlsl_5_0_code.size();
+		    byte_size += code->hlsl_4_0_code.size();
+		    byte_size += (code->spv_code.size() * sizeof(uint32_t));
+		}
+
+		return byte_size;
+	    }
+
+	    void initPipelineLayout(KujoGFXPipeline &init_pipeline)
 	    {
-		KujoGFXPipeline init_pipeline = pipeline;
 
 		for (size_t i = 0; i < max_vertex_buffer_bind_slots; i++)
 		{
@@ -6490,7 +11581,7 @@ namespace kujogfx
 
 		bool use_auto_offs = true;
 
-		for (auto &attrib : pipeline.layout.attribs)
+		for (auto &attrib : init_pipeline.layout.attribs)
 		{
 		    if (attrib.offset != 0)
 		    {
@@ -6526,84 +11617,308 @@ namespace kujogfx
 			buffer.stride = auto_offs[buf_index];
 		    }
 		}
-
-		return init_pipeline;
 	    }
 
-	    void applyPipelineCmd(KujoGFXPipeline pipeline)
+	    void applyPipelineCmd(KujoGFXPipelineHandle handle)
 	    {
 		assert(backend != NULL);
-		auto cached_pipeline = pipeline_cache.find(pipeline.getID());
+		flushPendingDraw();
+		current_pipeline_handle = KujoGFXPipelineHandle();
+		current_pipeline = NULL;
+
+		// Pipelines are only freed by replayed commands, so the slot stays
+		// put after the lock is released, and the backend runs without it
+		const KujoGFXPipeline *pipeline = NULL;
 
-		if (cached_pipeline != pipeline_cache.end())
 		{
-		    backend->setPipeline(cached_pipeline->second);
-		    current_pipeline = cached_pipeline->second;
+		    auto lock = lockPools();
+		    pipeline = pipeline_pool.lookup(handle);
 		}
-		else
+
+		if (pipeline == NULL)
 		{
-		    auto init_pipeline = createPipeline(pipeline);
-		    backend->createPipeline(init_pipeline);
-		    pipeline_cache.insert(make_pair(pipeline.getID(), init_pipeline));
-		    current_pipeline = init_pipeline;
+		    kujogfxlog::error() << "Invalid pipeline handle of " << hex << handle.id;
+		    return;
 		}
 
+		backend->setPipeline(handle);
+		current_pipeline_handle = handle;
+		current_pipeline = pipeline;
+		is_bindings_valid = true;
 		backend->applyPipeline();
+		current_stats.num_pipeline_changes += 1;
+	    }
+
+	    bool isBufferValid(KujoGFXBufferHandle handle)
+	    {
+		auto lock = lockPools();
+		return buffer_pool.isValid(handle);
+	    }
+
+	    // Called with the pools locked
+	    bool setupBuffer(KujoGFXBufferHandle handle)
+	    {
+		// Unbound slots are skipped by the backends
+		if (!handle.isValid())
+		{
+		    return true;
+		}
+
+		if (!buffer_pool.isValid(handle))
+		{
+		    kujogfxlog::error() << "Invalid buffer handle of " << hex << handle.id;
+		    return false;
+		}
+
+		return true;
+	    }
+
+	    void applyBindingsCmd(const KujoGFXBindings &bindings)
+	    {
+		assert(backend != NULL);
+		flushPendingDraw();
+		is_bindings_valid = false;
+
+		if (current_pipeline == NULL)
+		{
+		    return;
+		}
+
+		{
+		    auto lock = lockPools();
+
+		    for (size_t i = 0; i < max_vertex_buffer_bind_slots; i++)
+		    {
+			if (current_pipeline->layout.vertex_buffer_layout_active[i] && !setupBuffer(bindings.vertex_buffers[i]))
+			{
+			    return;
+			}
+		    }
+
+		    if (!setupBuffer(bindings.index_buffer))
+		    {
+			return;
+		    }
+		}
+
+		is_bindings_valid = true;
+		backend->applyBindings(bindings);
+		current_stats.num_bindings_changes += 1;
 	    }
 
-	    bool isBufferCached(KujoGFXBuffer &buffer)
+	    void applyUniformsCmd(int ub_slot, const KujoGFXData &data)
 	    {
-		return (buffer_cache.find(buffer.getID()) != buffer_cache.end());
+		assert(backend != NULL);
+		flushPendingDraw();
+
+		if (current_pipeline == NULL)
+		{
+		    return;
+		}
+
+		backend->applyUniforms(ub_slot, data);
 	    }
 
-	    void insertBuffer(KujoGFXBuffer &buffer)
+	    void drawCmd(const KujoGFXDraw &draw)
 	    {
-		if (isBufferCached(buffer))
+		assert(backend != NULL);
+
+		if ((current_pipeline == NULL) || !is_bindings_valid)
+		{
+		    return;
+		}
+
+		if (!is_draw_merging)
+		{
+		    backend->draw(draw);
+		    return;
+		}
+
+		if (is_draw_pending && canMergeDraws(pending_draw, draw))
 		{
+		    pending_draw.num_elements += draw.num_elements;
+		    current_stats.num_merged_draws += 1;
 		    return;
 		}
 
-		buffer_cache.insert(make_pair(buffer.getID(), buffer));
+		flushPendingDraw();
+		pending_draw = draw;
+		is_draw_pending = true;
 	    }
 
-	    void setupBuffer(KujoGFXBuffer &buffer)
+	    void multiDrawCmd(const KujoGFXData &draws)
 	    {
-		if ((buffer.getData() == NULL) || isBufferCached(buffer))
+		assert(backend != NULL);
+
+		if ((current_pipeline == NULL) || !is_bindings_valid || (draws.getSize() == 0))
 		{
 		    return;
 		}
 
-		backend->createBuffer(buffer);
-		insertBuffer(buffer);
+		backend->multiDraw(reinterpret_cast<const KujoGFXDraw*>(draws.getData()), (draws.getSize() / sizeof(KujoGFXDraw)));
 	    }
 
-	    void applyBindingsCmd(KujoGFXBindings bindings)
+	    void drawIndirectCmd(const KujoGFXDrawIndirectCommand &command)
 	    {
 		assert(backend != NULL);
-		for (size_t i = 0; i < bindings.vertex_buffers.size(); i++)
+
+		if ((current_pipeline == NULL) || !is_bindings_valid || (command.num_draws == 0))
+		{
+		    return;
+		}
+
+		bool is_indirect_buffer = false;
+		size_t buffer_size = 0;
+
 		{
-		    if (!current_pipeline.layout.vertex_buffer_layout_active[i])
+		    auto lock = lockPools();
+		    auto slot = buffer_pool.lookup(command.buffer);
+
+		    if (slot != NULL)
 		    {
-			continue;
+			is_indirect_buffer = slot->desc.isIndirectBuffer();
+			buffer_size = slot->desc.getBufferSize();
 		    }
+		}
 
-		    setupBuffer(bindings.vertex_buffers.at(i));
+		if (!is_indirect_buffer)
+		{
+		    kujogfxlog::error() << "Could not draw from invalid indirect buffer handle of " << hex << command.buffer.id;
+		    return;
 		}
 
-		setupBuffer(bindings.index_buffer);
-		backend->applyBindings(bindings);
+		uint32_t args_size = (current_pipeline->index_type != IndexTypeNone) ? sizeof(KujoGFXDrawIndexedIndirectArgs) : sizeof(KujoGFXDrawIndirectArgs);
+		uint32_t stride = (command.stride != 0) ? command.stride : args_size;
+
+		if (((command.offset % 4) != 0) || ((stride % 4) != 0) || (stride < args_size))
+		{
+		    kujogfxlog::error() << "Indirect draw offsets and strides must be aligned to 4 bytes, and strides must fit the arguments!";
+		    return;
+		}
+
+		if ((command.offset + (uint64_t(command.num_draws - 1) * stride) + args_size) > buffer_size)
+		{
+		    kujogfxlog::error() << "Indirect draws read past the end of their buffer!";
+		    return;
+		}
+
+		if (!backend->drawIndirect(command.buffer, command.offset, command.num_draws, stride))
+		{
+		    kujogfxlog::error() << "Could not draw indirect!";
+		}
 	    }
 
-	    void applyUniformsCmd(int ub_slot, KujoGFXData data)
+	    // Only lists of whole triangles can be joined without adding primitives across the seam
+	    bool canMergeDraws(const KujoGFXDraw &prev_draw, const KujoGFXDraw &draw) const
+	    {
+		if ((current_pipeline->primitive_type != PrimitiveTriangles) || ((prev_draw.num_elements % 3) != 0))
+		{
+		    return false;
+		}
+
+		if ((prev_draw.base_vertex != draw.base_vertex) || (prev_draw.base_instance != draw.base_instance))
+		{
+		    return false;
+		}
+
+		return ((prev_draw.num_instances == draw.num_instances) && ((prev_draw.base_element + prev_draw.num_elements) == draw.base_element));
+	    }
+
+	    // Must be called before anything that changes the state the pending draw uses
+	    void flushPendingDraw()
+	    {
+		if (!is_draw_pending)
+		{
+		    return;
+		}
+
+		is_draw_pending = false;
+		backend->draw(pending_draw);
+	    }
+
+	    void destroyShaderCmd(KujoGFXShaderHandle handle)
+	    {
+		auto lock = lockPools();
+
+		if (!shader_pool.isValid(handle))
+		{
+		    kujogfxlog::error() << "Could not destroy shader with invalid handle of " << hex << handle.id;
+		    return;
+		}
+
+		// Shaders only live on the frontend; pipelines made from them are unaffected
+		shader_pool.free(handle);
+	    }
+
+	    void destroyBufferCmd(KujoGFXBufferHandle handle)
 	    {
 		assert(backend != NULL);
-		backend->applyUniforms(ub_slot, data);
+
+		{
+		    auto lock = lockPools();
+
+		    if (!buffer_pool.isValid(handle))
+		    {
+			kujogfxlog::error() << "Could not destroy buffer with invalid handle of " << hex << handle.id;
+			return;
+		    }
+
+		    buffer_pool.free(handle);
+		}
+
+		backend->destroyBuffer(handle);
+	    }
+
+	    void destroyPipelineCmd(KujoGFXPipelineHandle handle)
+	    {
+		assert(backend != NULL);
+
+		{
+		    auto lock = lockPools();
+
+		    if (!pipeline_pool.isValid(handle))
+		    {
+			kujogfxlog::error() << "Could not destroy pipeline with invalid handle of " << hex << handle.id;
+			return;
+		    }
+
+		    pipeline_pool.free(handle);
+		}
+
+		if (handle == current_pipeline_handle)
+		{
+		    current_pipeline_handle = KujoGFXPipelineHandle();
+		    current_pipeline = NULL;
+		}
+
+		backend->destroyPipeline(handle);
+	    }
+
+	    // The buffer may have been destroyed by an earlier command in the frame
+	    void updateBufferCmd(KujoGFXBufferHandle handle, const KujoGFXData &data)
+	    {
+		assert(backend != NULL);
+
+		if (!isBufferValid(handle))
+		{
+		    kujogfxlog::error() << "Could not update buffer with invalid handle of " << hex << handle.id;
+		    return;
+		}
+
+		backend->updateBuffer(handle, data);
 	    }
 
-	    void drawCmd(KujoGFXDraw draw)
+	    void appendBufferCmd(KujoGFXBufferHandle handle, uint32_t offset, const KujoGFXData &data)
 	    {
 		assert(backend != NULL);
-		backend->draw(draw);
+
+		if (!isBufferValid(handle))
+		{
+		    kujogfxlog::error() << "Could not append to buffer with invalid handle of " << hex << handle.id;
+		    return;
+		}
+
+		backend->appendBuffer(handle, offset, data);
 	    }
     };
 };
@@ -215,7 +215,8 @@ bool toGLSL(vector<uint32_t> spv_code, GLSLShaderLang shader_lang, string &out_g
     glsl_options.emit_line_directives = false;
     glsl_options.vulkan_semantics = false;
     glsl_options.enable_420pack_extension = false;
-    glsl_options.emit_uniform_buffer_as_plain_uniforms = true;
+    // Uniform blocks stay blocks, so that OpenGL can source them from a buffer
+    glsl_options.emit_uniform_buffer_as_plain_uniforms = false;
     compiler.set_common_options(glsl_options);
 
     out_glsl = compiler.compile();